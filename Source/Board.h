@@ -60,9 +60,15 @@ struct board {
 
         signed char castleFlags;
         signed char enPassantPawn;
-        //signed char lastZeroing; // TODO: change to halfmoveClock
 
         int plyNumber; // holds both side to move and full move number
+        int lastZeroing; // ply number after the last capture or pawn move
+
+        /*
+         *  Keys kept up to date by makeMove and undoMove: see updateKeys()
+         */
+        unsigned long long pawnKey;
+        unsigned long long materialKey;
 
         /*
          *  Side data
@@ -75,10 +81,13 @@ struct board {
 #endif
 
         /*
-         *  Move undo administration
+         *  Move undo administration. The history moves to the heap
+         *  when it outgrows undoStack[]: see freeBoard().
          */
         signed char undoStack[256];
         int undoLen;
+        signed char *undoHeap; // NULL while undoStack[] is in use
+        int undoHeapSize;
         int *movePtr; // For in move generation
 };
 
@@ -109,6 +118,10 @@ enum castleFlag {
 
 #define sideToMove(board) ((board)->plyNumber & 1)
 
+// Move counters as in FEN
+#define halfmoveClock(board)  ((board)->plyNumber - (board)->lastZeroing)
+#define fullmoveNumber(board) ((board)->plyNumber >> 1)
+
 /*
  *  Moves
  */
@@ -146,29 +159,125 @@ extern const char startpos[];
  +----------------------------------------------------------------------*/
 
 /*
- *  Setup chess board from position description in FEN notation
+ *  Thread safety: the core has no mutable global state. All state is in
+ *  the board and in the other objects passed by the caller, and the global
+ *  tables are constant. Any number of threads can work at the same time,
+ *  each on its own board.
+ */
+
+/*
+ *  Setup chess board from position description in FEN notation. The
+ *  halfmove clock and fullmove number are optional, and default to 0 and 1.
  *
  *  Return the length of the FEN on success, or 0 on failure.
  */
 int setupBoard(Board_t self, const char *fen);
 
+/*
+ *  Forget the move history, and release it if makeMove has moved it to
+ *  the heap. Needed before a board with a long history goes out of scope
+ *  or is set up again. The position stays. A board with its history on
+ *  the heap must not be copied.
+ */
+void freeBoard(Board_t self);
+
+/*
+ *  Setup an empty board with the given side to move, and no castling or
+ *  en passant rights. Pieces can then be placed directly in squares[],
+ *  followed by updateKeys().
+ */
+void clearBoard(Board_t self, int sideToMove);
+
 /*
  *  Convert the current position to FEN
  */
 void boardToFen(Board_t self, char *fen);
 
+/*
+ *  Convert the current position to FEN, with the halfmove clock and the
+ *  fullmove number
+ */
+void boardToFullFen(Board_t self, char *fen);
+
+/*
+ *  The piece placement of a position in FEN, with the location of each
+ *  rank, to derive the FENs of its children from
+ */
+struct fenPlacement {
+        char text[maxFenSize];
+        unsigned char start[8], end[8]; // indexed by rank
+        int length;
+};
+
+/*
+ *  Prepare the FEN piece placement of the current position
+ */
+void preparePlacement(Board_t self, struct fenPlacement *placement);
+
+/*
+ *  Convert the current position to FEN, after making a move in the
+ *  position of the placement. Only the ranks that the move changed are
+ *  converted again. The result is the same as from boardToFen.
+ */
+void childToFen(Board_t self, const struct fenPlacement *parent, int move, char *fen);
+
 /*
  *  Compute a 64-bit hash for the current position using Polyglot-Zobrist hashing
  */
 unsigned long long hash64(Board_t self);
 
+/*
+ *  Compute a second 64-bit hash, independent of hash64, so that the two
+ *  form a 128-bit fingerprint. Can invalidate the side info.
+ */
+unsigned long long secondHash64(Board_t self);
+
+/*
+ *  Compute the pawn key and the material key from scratch. setupBoard does
+ *  this, and makeMove and undoMove keep them up to date. Needed after
+ *  placing pieces in squares[] directly.
+ *
+ *  The pawn key is the part of hash64 for the pawns. The material key only
+ *  depends on the number of pieces of each kind: it is the sum of a random
+ *  value for each piece on the board.
+ */
+void updateKeys(Board_t self);
+
 /*
  *  Generate all pseudo-legal moves for the position and return the move count
  */
 int generateMoves(Board_t self, int moveList[maxMoves]);
 
 /*
- *  Make the move on the board
+ *  Kinds of moves for generateMovesOfKind
+ */
+enum moveKind {
+        captureMoves  = 1 << 0, // captures, including en passant, and promotions
+        quietMoves    = 1 << 1, // all other moves, including castling
+        allMoves      = captureMoves | quietMoves,
+        onlyChecks    = 1 << 2, // keep only the moves of the above kinds that give check
+        checkingMoves = allMoves | onlyChecks
+};
+
+/*
+ *  Generate the pseudo-legal moves of the given kinds, in the order of
+ *  generateMoves, and return the move count. Quiet moves are skipped
+ *  without generating them. Checks, discovered checks included, are found
+ *  from the opponent's king position without making the moves.
+ */
+int generateMovesOfKind(Board_t self, int moveList[maxMoves], int kinds);
+
+/*
+ *  Generate all moves by the side not to move that can have led to the
+ *  position, excluding captures and promotions, and return the count.
+ *  Each retraction is given as the forward move: from its origin to the
+ *  square the piece is on now. Castling and en passant are not considered.
+ *  This does not need side info.
+ */
+int generateUnmoves(Board_t self, int moveList[maxMoves]);
+
+/*
+ *  Make the move on the board. The history grows as needed.
  */
 void makeMove(Board_t self, int move);
 
@@ -230,6 +339,14 @@ extern int inCheck(Board_t self);
 // Is move legal? Move must come from generateMoves, so be safe to make.
 extern bool isLegalMove(Board_t self, int move);
 
+/*
+ *  Count the legal moves of each board and tell if the side to move is in
+ *  check, without generating the moves. Boards are taken four at a time
+ *  where the processor has vector instructions for it. Needs no side info,
+ *  and can invalidate it.
+ */
+extern void countLegalMoves(Board_t boards[], int nrBoards, int counts[], bool isInCheck[]);
+
 // Is the move a pawn promotion?
 extern bool isPromotion(Board_t self, int from, int to);
 
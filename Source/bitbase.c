@@ -0,0 +1,681 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      bitbase.c -- retrograde generation and probing of bitbases      |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  Positions are indexed by side to move and the squares of the pieces
+ *  in signature order, without any symmetry reduction. That gives an O(1)
+ *  index computation for probing.
+ *
+ *  Generation is iterative. The first pass evaluates every position with
+ *  the forward move generator. Then, in each round, the predecessors of
+ *  the positions resolved in the previous round are found by retraction
+ *  and evaluated again, until no more positions get resolved. What is
+ *  still unresolved then is a draw. Each pass is split over threads by
+ *  index range. Threads only resolve positions in their own range, and
+ *  a value never changes after it is resolved.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// mmap()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Other module includes
+#include "Board.h"
+#include "workers.h"
+
+// Own include
+#include "bitbase.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  File layout: magic, signature (zero padded), then 2 bits per position
+ */
+static const char fileMagic[8] = { 'C', 'M', 'B', 'B', '0', '0', '0', '1' };
+
+enum {
+        signatureOffset = sizeof fileMagic,
+        valuesOffset    = signatureOffset + 8
+};
+
+// Intermediate values during generation, written as draws
+enum { unknown = 3, invalid = 4 };
+
+enum { nrPieceTypes = blackPawn + 1 };
+
+#define squareIndex(square)  (8 * rank(square) + file(square))
+#define indexSquare(index)   square((index) & 7, (index) >> 3)
+#define flipColor(piece)     ((piece) >= blackKing ? (piece) - (blackKing - whiteKing) \
+                                                   : (piece) + (blackKing - whiteKing))
+
+/*
+ *  Bytes that other threads read or write during the same pass. Relaxed
+ *  order is enough: a resolved value doesn't change anymore, a candidate
+ *  flag is only ever set to 1, and the passes are separated by joins.
+ */
+#define loadShared(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define storeShared(p, value) __atomic_store_n((p), (value), __ATOMIC_RELAXED)
+
+struct table {
+        struct table *next;
+        int nrPieces;
+        signed char pieces[maxBitbasePieces];
+        signed char counts[nrPieceTypes];
+        long size;
+        unsigned char *values; // one byte per position during generation
+        char signature[maxBitbasePieces+1];
+};
+
+struct generator {
+        struct table *tables; // completed tables, for probing after conversions
+        int nrThreads;
+};
+
+enum phase { phaseInitialize, phaseMark, phaseEvaluate };
+
+struct worker {
+        struct generator *generator;
+        struct table *table;
+        unsigned char *fresh;     // resolved in the last pass
+        unsigned char *candidate; // successor was resolved, so evaluate again
+        enum phase phase;
+        long start, end;
+        long nrResolved;
+};
+
+/*----------------------------------------------------------------------+
+ |      Data                                                            |
+ +----------------------------------------------------------------------*/
+
+static const char pieceChars[] = "KQRBNP";
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      Material signatures                                             |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Parse "KRKP" or "KRvKP" into piece counts and return the number
+ *  of pieces, or -1 if it is not valid
+ */
+static int parseSignature(const char *signature, signed char counts[nrPieceTypes])
+{
+        memset(counts, 0, nrPieceTypes);
+
+        int color = -1;
+        int nrPieces = 0;
+        for (const char *s=signature; *s; s++) {
+                if (*s == 'v' && color == white)
+                        continue;
+                const char *c = strchr(pieceChars, *s);
+                if (!c || *c == '\0')
+                        return -1;
+                if (*s == 'K')
+                        color++;
+                if (color < 0 || color > black)
+                        return -1;
+                counts[whiteKing + (c - pieceChars) + color * (blackKing - whiteKing)]++;
+                nrPieces++;
+        }
+
+        if (color != black || nrPieces > maxBitbasePieces)
+                return -1;
+        return nrPieces;
+}
+
+// Set pieces and signature of a table from its counts
+static void setupPieces(int *nrPieces, signed char pieces[], char *signature, const signed char counts[])
+{
+        int n = 0;
+        for (int piece=whiteKing; piece<=blackPawn; piece++) {
+                for (int i=0; i<counts[piece]; i++) {
+                        pieces[n] = piece;
+                        signature[n] = pieceChars[(piece - whiteKing) % (blackKing - whiteKing)];
+                        n++;
+                }
+        }
+        signature[n] = '\0';
+        *nrPieces = n;
+}
+
+/*----------------------------------------------------------------------+
+ |      Indexing                                                        |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Compute the index of the position, optionally with the colors reversed,
+ *  or return -1 if the material doesn't match
+ */
+static long positionIndex(int nrPieces, const signed char pieces[], Board_t board, bool flip)
+{
+        int squares[maxBitbasePieces];
+        bool used[maxBitbasePieces] = { false };
+        int n = 0;
+
+        for (int i=0; i<boardSize; i++) {
+                int piece = board->squares[indexSquare(i)];
+                if (piece == empty)
+                        continue;
+                if (flip)
+                        piece = flipColor(piece);
+
+                int slot;
+                for (slot=0; slot<nrPieces; slot++)
+                        if (pieces[slot] == piece && !used[slot])
+                                break;
+                if (slot >= nrPieces)
+                        return -1;
+
+                used[slot] = true;
+                squares[slot] = flip ? (i ^ 070) : i; // mirror the ranks
+                n++;
+        }
+        if (n != nrPieces)
+                return -1;
+
+        long index = sideToMove(board) ^ flip;
+        for (int slot=0; slot<nrPieces; slot++)
+                index = index * boardSize + squares[slot];
+        return index;
+}
+
+/*
+ *  Setup the board from an index, or return false if the pieces
+ *  overlap or a pawn is on the first or last rank
+ */
+static bool setupFromIndex(const struct table *table, Board_t board, long index, int squares[])
+{
+        for (int slot=table->nrPieces-1; slot>=0; slot--) {
+                squares[slot] = index % boardSize;
+                index /= boardSize;
+        }
+
+        clearBoard(board, index);
+        for (int slot=0; slot<table->nrPieces; slot++) {
+                int square = indexSquare(squares[slot]);
+                int piece = table->pieces[slot];
+                if (board->squares[square] != empty)
+                        return false;
+                if ((piece == whitePawn || piece == blackPawn)
+                 && (squares[slot] >> 3 == 0 || squares[slot] >> 3 == 7))
+                        return false;
+                board->squares[square] = piece;
+        }
+        updateKeys(board);
+        return true;
+}
+
+/*----------------------------------------------------------------------+
+ |      Evaluation                                                      |
+ +----------------------------------------------------------------------*/
+
+// Value of the position after a move, for the side to move there
+static int probeSuccessor(struct generator *self, struct table *table, Board_t board)
+{
+        long index = positionIndex(table->nrPieces, table->pieces, board, false);
+        if (index >= 0)
+                return loadShared(&table->values[index]); // still being generated
+
+        // Capture or promotion
+        for (struct table *t=self->tables; t; t=t->next) {
+                index = positionIndex(t->nrPieces, t->pieces, board, false);
+                if (index < 0)
+                        index = positionIndex(t->nrPieces, t->pieces, board, true);
+                if (index >= 0)
+                        return t->values[index];
+        }
+
+        assert(0); // all reachable tables are generated beforehand
+        return unknown;
+}
+
+/*
+ *  Try to resolve a position from the values of its successors
+ */
+static int evaluate(struct generator *self, struct table *table, Board_t board, long index)
+{
+        int squares[maxBitbasePieces];
+        if (!setupFromIndex(table, board, index, squares))
+                return invalid;
+
+        updateSideInfo(board);
+        if (board->side->attacks[board->xside->king] != 0)
+                return invalid; // side not to move is in check
+        bool isCheck = inCheck(board);
+
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(board, moveList);
+
+        bool hasLegalMoves = false;
+        bool allLose = true;
+        for (int i=0; i<nrMoves; i++) {
+                makeMove(board, moveList[i]);
+                updateSideInfo(board);
+                if (board->side->attacks[board->xside->king] != 0) {
+                        undoMove(board);
+                        continue;
+                }
+                hasLegalMoves = true;
+                int value = probeSuccessor(self, table, board);
+                undoMove(board);
+
+                if (value == bitbaseLoss)
+                        return bitbaseWin;
+                if (value != bitbaseWin)
+                        allLose = false;
+        }
+
+        if (!hasLegalMoves)
+                return isCheck ? bitbaseLoss : bitbaseDraw;
+
+        return allLose ? bitbaseLoss : unknown;
+}
+
+/*----------------------------------------------------------------------+
+ |      Retrograde iteration                                            |
+ +----------------------------------------------------------------------*/
+
+// Mark the predecessors of a resolved position as candidates
+static void markPredecessors(struct worker *self, Board_t board, long index)
+{
+        struct table *table = self->table;
+
+        int squares[maxBitbasePieces];
+        setupFromIndex(table, board, index, squares);
+
+        long sideWeight = table->size / 2;
+        long pred0 = index + (sideToMove(board) == white ? sideWeight : -sideWeight);
+
+        int moveList[maxMoves];
+        int nrUnmoves = generateUnmoves(board, moveList);
+
+        for (int i=0; i<nrUnmoves; i++) {
+                int origin = squareIndex(from(moveList[i]));
+                int current = squareIndex(to(moveList[i]));
+
+                long weight = sideWeight;
+                for (int slot=0; slot<table->nrPieces; slot++) {
+                        weight /= boardSize;
+                        if (squares[slot] == current) {
+                                long pred = pred0 + (origin - current) * weight;
+                                if (table->values[pred] == unknown)
+                                        storeShared(&self->candidate[pred], 1); // maybe in another range
+                                break;
+                        }
+                }
+        }
+}
+
+static void work(void *argument, int i)
+{
+        struct worker *self = (struct worker *)argument + i;
+        struct table *table = self->table;
+        struct board board;
+
+        for (long index=self->start; index<self->end; index++) {
+                int value;
+
+                switch (self->phase) {
+                case phaseInitialize:
+                        value = evaluate(self->generator, table, &board, index);
+                        storeShared(&table->values[index], value);
+                        if (value == bitbaseWin || value == bitbaseLoss) {
+                                self->fresh[index] = 1;
+                                self->nrResolved++;
+                        }
+                        break;
+
+                case phaseMark:
+                        if (self->fresh[index]) {
+                                self->fresh[index] = 0;
+                                markPredecessors(self, &board, index);
+                        }
+                        break;
+
+                case phaseEvaluate:
+                        if (!self->candidate[index])
+                                break;
+                        self->candidate[index] = 0;
+                        if (table->values[index] != unknown)
+                                break;
+                        value = evaluate(self->generator, table, &board, index);
+                        if (value == bitbaseWin || value == bitbaseLoss) {
+                                storeShared(&table->values[index], value);
+                                self->fresh[index] = 1;
+                                self->nrResolved++;
+                        }
+                        break;
+                }
+        }
+}
+
+// Run one pass over the table on all threads and return the number of resolved positions
+static long runPhase(struct generator *self, struct table *table, enum phase phase,
+        unsigned char *fresh, unsigned char *candidate)
+{
+        int nrThreads = self->nrThreads;
+        struct worker workers[nrThreads];
+
+        for (int i=0; i<nrThreads; i++) {
+                workers[i] = (struct worker) {
+                        .generator = self,
+                        .table = table,
+                        .fresh = fresh,
+                        .candidate = candidate,
+                        .phase = phase,
+                        .start = table->size * i / nrThreads,
+                        .end = table->size * (i + 1) / nrThreads,
+                        .nrResolved = 0,
+                };
+        }
+
+        runWorkers(work, workers, nrThreads);
+
+        long nrResolved = 0;
+        for (int i=0; i<nrThreads; i++)
+                nrResolved += workers[i].nrResolved;
+        return nrResolved;
+}
+
+static int computeTable(struct generator *self, struct table *table)
+{
+        unsigned char *fresh = calloc(table->size, 1);
+        unsigned char *candidate = calloc(table->size, 1);
+        if (!fresh || !candidate) {
+                free(fresh);
+                free(candidate);
+                return -1;
+        }
+
+        memset(table->values, unknown, table->size);
+
+        long nrResolved = runPhase(self, table, phaseInitialize, fresh, candidate);
+        while (nrResolved > 0) {
+                runPhase(self, table, phaseMark, fresh, candidate);
+                nrResolved = runPhase(self, table, phaseEvaluate, fresh, candidate);
+        }
+
+        for (long index=0; index<table->size; index++)
+                if (table->values[index] == unknown)
+                        table->values[index] = bitbaseDraw;
+
+        free(fresh);
+        free(candidate);
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      Table management                                                |
+ +----------------------------------------------------------------------*/
+
+static bool hasTable(struct generator *self, const signed char counts[nrPieceTypes])
+{
+        for (struct table *t=self->tables; t; t=t->next) {
+                bool same = true, reversed = true;
+                for (int piece=whiteKing; piece<=blackPawn; piece++) {
+                        same     &= t->counts[piece] == counts[piece];
+                        reversed &= t->counts[piece] == counts[flipColor(piece)];
+                }
+                if (same || reversed)
+                        return true;
+        }
+        return false;
+}
+
+/*
+ *  Generate the table for the material, after all tables that
+ *  can be reached from it by captures and promotions
+ */
+static struct table *buildTable(struct generator *self, const signed char counts[nrPieceTypes])
+{
+        signed char next[nrPieceTypes];
+
+        for (int piece=whiteQueen; piece<=blackPawn; piece++) {
+                if (piece == blackKing || counts[piece] == 0)
+                        continue;
+
+                // Capture
+                memcpy(next, counts, nrPieceTypes);
+                next[piece]--;
+                if (!hasTable(self, next) && !buildTable(self, next))
+                        return NULL;
+
+                if (piece != whitePawn && piece != blackPawn)
+                        continue;
+
+                // Promotion, with or without capture
+                int queen = (piece == whitePawn) ? whiteQueen : blackQueen;
+                for (int promotion=queen; promotion<queen+4; promotion++) {
+                        memcpy(next, counts, nrPieceTypes);
+                        next[piece]--;
+                        next[promotion]++;
+                        if (!hasTable(self, next) && !buildTable(self, next))
+                                return NULL;
+
+                        for (int victim=whiteQueen; victim<=blackPawn; victim++) {
+                                if (victim == blackKing || next[victim] == 0
+                                 || victim == whitePawn || victim == blackPawn
+                                 || pieceColor(victim) == pieceColor(piece))
+                                        continue;
+                                next[victim]--;
+                                if (!hasTable(self, next) && !buildTable(self, next))
+                                        return NULL;
+                                next[victim]++;
+                        }
+                }
+        }
+
+        struct table *table = calloc(1, sizeof *table);
+        if (!table)
+                return NULL;
+
+        memcpy(table->counts, counts, nrPieceTypes);
+        setupPieces(&table->nrPieces, table->pieces, table->signature, counts);
+        table->size = 2;
+        for (int i=0; i<table->nrPieces; i++)
+                table->size *= boardSize;
+
+        table->values = malloc(table->size);
+        if (!table->values || computeTable(self, table) != 0) {
+                free(table->values);
+                free(table);
+                return NULL;
+        }
+
+        table->next = self->tables;
+        self->tables = table;
+        return table;
+}
+
+static int writeTable(const struct table *table, const char *path)
+{
+        FILE *fp = fopen(path, "wb");
+        if (!fp)
+                return -1;
+
+        char signature[valuesOffset - signatureOffset] = { 0 };
+        strncpy(signature, table->signature, sizeof signature);
+        fwrite(fileMagic, sizeof fileMagic, 1, fp);
+        fwrite(signature, sizeof signature, 1, fp);
+
+        for (long index=0; index<table->size; index+=4) {
+                int byte = 0;
+                for (int i=0; i<4 && index+i<table->size; i++) {
+                        int value = table->values[index+i];
+                        if (value == unknown || value == invalid)
+                                value = bitbaseDraw;
+                        byte |= value << (2 * i);
+                }
+                putc(byte, fp);
+        }
+
+        int error = ferror(fp);
+        if (fclose(fp) != 0 || error)
+                return -1;
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      generateBitbase                                                 |
+ +----------------------------------------------------------------------*/
+
+extern int generateBitbase(const char *signature, const char *path, int nrThreads)
+{
+        signed char counts[nrPieceTypes];
+        if (parseSignature(signature, counts) < 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        struct generator generator = { .tables = NULL, .nrThreads = resolveThreads(nrThreads) };
+
+        struct table *table = buildTable(&generator, counts);
+        int result = table ? writeTable(table, path) : -1;
+
+        int saveErrno = errno;
+        while (generator.tables) {
+                struct table *next = generator.tables->next;
+                free(generator.tables->values);
+                free(generator.tables);
+                generator.tables = next;
+        }
+        errno = saveErrno;
+
+        return result;
+}
+
+/*----------------------------------------------------------------------+
+ |      openBitbase / closeBitbase                                      |
+ +----------------------------------------------------------------------*/
+
+extern int openBitbase(struct bitbase *self, const char *path)
+{
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return -1;
+        }
+
+        self->mapSize = st.st_size;
+        self->map = (self->mapSize >= valuesOffset)
+                ? mmap(NULL, self->mapSize, PROT_READ, MAP_SHARED, fd, 0)
+                : MAP_FAILED;
+        int saveErrno = errno;
+        close(fd);
+        if (self->map == MAP_FAILED) {
+                errno = (self->mapSize < valuesOffset) ? EINVAL : saveErrno;
+                return -1;
+        }
+
+        const char *bytes = self->map;
+        signed char counts[nrPieceTypes];
+        char signature[valuesOffset - signatureOffset + 1] = { 0 };
+        memcpy(signature, bytes + signatureOffset, valuesOffset - signatureOffset);
+
+        bool ok = memcmp(bytes, fileMagic, sizeof fileMagic) == 0
+               && parseSignature(signature, counts) >= 0;
+        if (ok) {
+                setupPieces(&self->nrPieces, self->pieces, self->signature, counts);
+                size_t size = 2;
+                for (int i=0; i<self->nrPieces; i++)
+                        size *= boardSize;
+                ok = self->mapSize == valuesOffset + (size + 3) / 4;
+        }
+        if (!ok) {
+                munmap(self->map, self->mapSize);
+                errno = EINVAL;
+                return -1;
+        }
+
+        self->values = (const unsigned char *)bytes + valuesOffset;
+        return 0;
+}
+
+extern void closeBitbase(struct bitbase *self)
+{
+        munmap(self->map, self->mapSize);
+        self->map = NULL;
+        self->values = NULL;
+}
+
+/*----------------------------------------------------------------------+
+ |      probeBitbase                                                    |
+ +----------------------------------------------------------------------*/
+
+extern int probeBitbase(const struct bitbase *self, Board_t board)
+{
+        long index = positionIndex(self->nrPieces, self->pieces, board, false);
+        if (index < 0)
+                index = positionIndex(self->nrPieces, self->pieces, board, true);
+        if (index < 0)
+                return -1;
+
+        return (self->values[index >> 2] >> (2 * (index & 3))) & 3;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
@@ -0,0 +1,53 @@
+
+/*
+ *  Win/draw/loss bitbases for endgames with few pieces
+ *
+ *  Results are for the side to move. Castling and en passant rights
+ *  are ignored.
+ */
+
+enum bitbaseResult {
+        bitbaseDraw = 0,
+        bitbaseWin  = 1,
+        bitbaseLoss = 2
+};
+
+enum { maxBitbasePieces = 4 }; // including kings
+
+struct bitbase {
+        void *map;
+        size_t mapSize;
+        int nrPieces;
+        signed char pieces[maxBitbasePieces]; // white pieces first
+        const unsigned char *values;          // 2 bits per position
+        char signature[maxBitbasePieces+1];
+};
+
+/*
+ *  Generate the bitbase for a material signature, such as "KRKP", and
+ *  write it to a file. The white pieces come first, each side starting
+ *  with its king. Endgames reached by captures or promotions are computed
+ *  along the way. With nrThreads <= 0, use one thread per processor.
+ *
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int generateBitbase(const char *signature, const char *path, int nrThreads);
+
+/*
+ *  Map a bitbase file into memory for probing.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int openBitbase(struct bitbase *self, const char *path);
+
+/*
+ *  Release the bitbase mapping
+ */
+void closeBitbase(struct bitbase *self);
+
+/*
+ *  Look up the position in constant time. Positions with the colors
+ *  reversed are also found. Return a bitbaseResult for the side to move,
+ *  or -1 if the material doesn't belong to this bitbase.
+ */
+int probeBitbase(const struct bitbase *self, Board_t board);
+
@@ -0,0 +1,187 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      budget.c -- node and time limits for traversals                 |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// clock_gettime()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Own include
+#include "budget.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  The flags that threads read without holding the lock. Relaxed order is
+ *  enough: a stop is only noticed a little later, and the node count and
+ *  the limits are always read under the lock.
+ */
+#define loadShared(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define storeShared(p, value) __atomic_store_n((p), (value), __ATOMIC_RELAXED)
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------+
+ |      initBudget / freeBudget                                         |
+ +----------------------------------------------------------------------*/
+
+extern int initBudget(struct budget *self, unsigned long long maxNodes, double timeout)
+{
+        *self = (struct budget) {
+                .maxNodes = maxNodes,
+                .timeout = timeout,
+                .isCancelled = 0,
+                .stop = budgetRunning,
+        };
+        if ((errno = pthread_mutex_init(&self->lock, NULL)) != 0)
+                return -1;
+        return 0;
+}
+
+extern void freeBudget(struct budget *self)
+{
+        pthread_mutex_destroy(&self->lock);
+}
+
+/*----------------------------------------------------------------------+
+ |      startBudget                                                     |
+ +----------------------------------------------------------------------*/
+
+extern void startBudget(struct budget *self)
+{
+        pthread_mutex_lock(&self->lock);
+        self->nodes = 0;
+        self->deadline = (self->timeout > 0.0) ? now() + self->timeout : 0.0;
+        self->interval = budgetInterval;
+        if (self->maxNodes > 0 && self->maxNodes < budgetInterval)
+                self->interval = self->maxNodes; // so that small budgets are kept
+        storeShared(&self->stop, loadShared(&self->isCancelled) ? budgetCancelled : budgetRunning);
+        pthread_mutex_unlock(&self->lock);
+}
+
+/*----------------------------------------------------------------------+
+ |      cancelBudget                                                    |
+ +----------------------------------------------------------------------*/
+
+extern void cancelBudget(struct budget *self)
+{
+        storeShared(&self->isCancelled, 1); // picked up at the next check
+}
+
+/*----------------------------------------------------------------------+
+ |      getBudgetStop / isBudgetCancelled                               |
+ +----------------------------------------------------------------------*/
+
+extern enum budgetStop getBudgetStop(const struct budget *self)
+{
+        return loadShared(&self->stop);
+}
+
+extern bool isBudgetCancelled(const struct budget *self)
+{
+        return loadShared(&self->isCancelled);
+}
+
+/*----------------------------------------------------------------------+
+ |      countNode / flushNodes                                          |
+ +----------------------------------------------------------------------*/
+
+// Charge nodes and check the limits
+static bool charge(struct budget *self, int nodes)
+{
+        pthread_mutex_lock(&self->lock);
+        self->nodes += nodes;
+        if (self->stop == budgetRunning) { // only changed under the lock
+                if (loadShared(&self->isCancelled))
+                        storeShared(&self->stop, budgetCancelled);
+                else if (self->maxNodes > 0 && self->nodes >= self->maxNodes)
+                        storeShared(&self->stop, budgetNodesUsed);
+                else if (self->deadline > 0.0 && now() >= self->deadline)
+                        storeShared(&self->stop, budgetTimeUp);
+        }
+        bool mustStop = (self->stop != budgetRunning);
+        pthread_mutex_unlock(&self->lock);
+        return mustStop;
+}
+
+extern bool countNode(struct budget *self, int *pending)
+{
+        if (self == NULL)
+                return false;
+
+        if (++*pending < self->interval)
+                return loadShared(&self->stop) != budgetRunning; // another thread may have stopped it
+
+        int nodes = *pending;
+        *pending = 0;
+        return charge(self, nodes);
+}
+
+extern void flushNodes(struct budget *self, int *pending)
+{
+        if (self != NULL && *pending > 0)
+                charge(self, *pending);
+        *pending = 0;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,76 @@
+
+/*
+ *  Budgets to stop a traversal early: a number of nodes, a time limit,
+ *  and a cancellation flag that any thread can set
+ *
+ *  Threads that share a budget count their nodes separately and charge
+ *  them to the budget every budgetInterval nodes. That is also when the
+ *  clock and the flag are checked, so the limits are approximate.
+ */
+
+enum { budgetInterval = 1024 };
+
+enum budgetStop {
+        budgetRunning,
+        budgetNodesUsed,
+        budgetTimeUp,
+        budgetCancelled
+};
+
+struct budget {
+        unsigned long long maxNodes;   // 0 for no limit
+        double timeout;                // seconds from startBudget(), 0 for no limit
+        int isCancelled;               // see cancelBudget()
+
+        // The current traversal
+        double deadline;
+        int interval;                  // nodes between checks
+        unsigned long long nodes;      // charged so far
+        int stop;                      // enum budgetStop, see getBudgetStop()
+        pthread_mutex_t lock;
+};
+
+/*
+ *  Setup a budget. Return 0 on success, or -1 with errno set on failure.
+ */
+int initBudget(struct budget *self, unsigned long long maxNodes, double timeout);
+
+/*
+ *  Release the budget
+ */
+void freeBudget(struct budget *self);
+
+/*
+ *  Start a traversal: reset the node count and start the clock.
+ *  A cancellation stays in effect.
+ */
+void startBudget(struct budget *self);
+
+/*
+ *  Make the current and all later traversals stop as soon as possible.
+ *  Can be called from any thread at any time.
+ */
+void cancelBudget(struct budget *self);
+
+/*
+ *  Why the current traversal stops, or budgetRunning if it doesn't.
+ *  Can be called from any thread at any time.
+ */
+enum budgetStop getBudgetStop(const struct budget *self);
+
+/*
+ *  True after cancelBudget(). Can be called from any thread at any time.
+ */
+bool isBudgetCancelled(const struct budget *self);
+
+/*
+ *  Count a node of a traversal against a budget, which can be NULL for
+ *  none. pending holds the thread's nodes that aren't charged yet, and
+ *  must start at 0. Return true if the traversal must stop.
+ */
+bool countNode(struct budget *self, int *pending);
+
+/*
+ *  Charge the pending nodes at the end of a traversal
+ */
+void flushNodes(struct budget *self, int *pending);
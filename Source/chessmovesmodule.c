@@ -43,14 +43,34 @@
  +----------------------------------------------------------------------*/
 
 // Python include (must come first)
+#define PY_SSIZE_T_CLEAN
 #include "Python.h"
 
 // Standard includes
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 // Other module includes
 #include "Board.h"
+#include "bitbase.h"
+#include "budget.h"
+#include "gameCodec.h"
+#include "hashKeys.h"
+#include "history.h"
+#include "mate.h"
+#include "moveCount.h"
+#include "perft.h"
+#include "planes.h"
+#include "playout.h"
+#include "positionDb.h"
 #include "stringCopy.h"
+#include "symmetry.h"
+#include "workers.h"
 
 /*----------------------------------------------------------------------+
  |      Module                                                          |
@@ -69,12 +89,641 @@ enum {
         nrNotations
 };
 
-static char *notations[] = {
+static const char *notations[] = {
         [uciNotation] = "uci",
         [sanNotation] = "san",
         [longNotation] = "long"
 };
 
+/*----------------------------------------------------------------------+
+ |      Play and playout outputs                                        |
+ +----------------------------------------------------------------------*/
+
+enum {
+        movesOutput, fensOutput, hashesOutput, samplesOutput, clocksOutput, repetitionsOutput,
+        pawnKeysOutput, materialKeysOutput,
+        nrOutputs
+};
+
+static const char *outputs[] = {
+        [movesOutput] = "moves",
+        [fensOutput] = "fens",
+        [hashesOutput] = "hashes",
+        [samplesOutput] = "samples",
+        [clocksOutput] = "clocks",
+        [repetitionsOutput] = "repetitions",
+        [pawnKeysOutput] = "pawn_keys",
+        [materialKeysOutput] = "material_keys"
+};
+
+// The outputs of each function, as bit sets
+enum {
+        playOutputs = (1 << movesOutput) | (1 << fensOutput) | (1 << hashesOutput)
+                    | (1 << clocksOutput) | (1 << repetitionsOutput)
+                    | (1 << pawnKeysOutput) | (1 << materialKeysOutput),
+        playoutOutputs = (1 << movesOutput) | (1 << fensOutput) | (1 << hashesOutput) | (1 << samplesOutput)
+};
+
+/*----------------------------------------------------------------------+
+ |      Moves cache                                                     |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Results of moves(), keyed by the hash of the position and the notation.
+ *  An open addressing table with linear probing, and CLOCK eviction when
+ *  the estimated memory use goes over the limit. Only used with the GIL.
+ */
+struct cacheEntry {
+        unsigned long long key;
+        PyObject *value;         // NULL for an empty slot
+        Py_ssize_t size;         // estimated bytes, including the strings
+        unsigned char notation;
+        bool isReferenced;       // since the clock hand last passed
+};
+
+struct movesCache {
+        struct cacheEntry *entries;
+        Py_ssize_t capacity;     // a power of two, or 0 before the first entry
+        Py_ssize_t count;
+        Py_ssize_t size, maxSize; // a maxSize of 0 disables the cache
+        Py_ssize_t hand;
+        unsigned long long hits, misses, evictions;
+};
+
+/*----------------------------------------------------------------------+
+ |      Module state                                                    |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Interned strings, so that notation and keyword arguments can
+ *  normally be recognized by identity instead of by comparison
+ */
+struct moduleState {
+        struct movesCache movesCache;
+        PyObject *notations[nrNotations];
+        PyObject *outputs[nrOutputs];
+        PyObject *budgetType;
+        PyObject *movesType;
+        PyObject *budgetKeyword;
+        PyObject *countKeyword;
+        PyObject *countersKeyword;
+        PyObject *dataKeyword;
+        PyObject *depthKeyword;
+        PyObject *entropyKeyword;
+        PyObject *fenKeyword;
+        PyObject *fensKeyword;
+        PyObject *flipKeyword;
+        PyObject *indexKeyword;
+        PyObject *indicesKeyword;
+        PyObject *keysKeyword;
+        PyObject *maxPliesKeyword;
+        PyObject *moveKeyword;
+        PyObject *movesKeyword;
+        PyObject *nKeyword;
+        PyObject *notationKeyword;
+        PyObject *outKeyword;
+        PyObject *outputKeyword;
+        PyObject *seedKeyword;
+        PyObject *threadsKeyword;
+        PyObject *transformKeyword;
+        PyObject *weightsKeyword;
+};
+
+#define moduleState(module) ((struct moduleState *)PyModule_GetState(module))
+
+/*----------------------------------------------------------------------+
+ |      Argument helpers                                                |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Distribute METH_FASTCALL|METH_KEYWORDS arguments over the values
+ *  array, in the order given by keywords. Absent optional arguments
+ *  are set to NULL. Return 0 on success or -1 with an exception set.
+ */
+static int parseArguments(const char *functionName,
+        PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+        PyObject *const keywords[], int nrKeywords, int nrRequired,
+        PyObject *values[])
+{
+        if (nargs > nrKeywords) {
+                PyErr_Format(PyExc_TypeError, "%s() takes at most %d arguments (%zd given)",
+                             functionName, nrKeywords, nargs);
+                return -1;
+        }
+
+        for (int i=0; i<nrKeywords; i++)
+                values[i] = (i < nargs) ? args[i] : NULL;
+
+        Py_ssize_t nrKwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+        for (Py_ssize_t k=0; k<nrKwargs; k++) {
+                PyObject *name = PyTuple_GET_ITEM(kwnames, k);
+
+                int i;
+                for (i=0; i<nrKeywords; i++)
+                        if (name == keywords[i])
+                                break; // found by identity
+                if (i >= nrKeywords)
+                        for (i=0; i<nrKeywords; i++)
+                                if (PyUnicode_Compare(name, keywords[i]) == 0)
+                                        break; // found by value
+
+                if (i >= nrKeywords) {
+                        PyErr_Format(PyExc_TypeError, "'%U' is an invalid keyword argument for %s()",
+                                     name, functionName);
+                        return -1;
+                }
+                if (values[i]) {
+                        PyErr_Format(PyExc_TypeError, "%s() got multiple values for argument '%U'",
+                                     functionName, name);
+                        return -1;
+                }
+                values[i] = args[nargs + k];
+        }
+
+        for (int i=0; i<nrRequired; i++) {
+                if (!values[i]) {
+                        PyErr_Format(PyExc_TypeError, "%s() missing required argument '%U'",
+                                     functionName, keywords[i]);
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ *  Get the character data of a str or bytes object, without copying.
+ *  The result stays valid for as long as the object is alive.
+ */
+static const char *getString(PyObject *object, const char *what)
+{
+        if (PyUnicode_Check(object))
+                return PyUnicode_AsUTF8AndSize(object, NULL);
+
+        if (PyBytes_Check(object))
+                return PyBytes_AS_STRING(object);
+
+        PyErr_Format(PyExc_TypeError, "%s must be str or bytes, not %.200s",
+                     what, Py_TYPE(object)->tp_name);
+        return NULL;
+}
+
+/*
+ *  Map the notation argument to its index, or return -1 with an
+ *  exception set. Absent means SAN.
+ */
+static int getNotation(struct moduleState *state, PyObject *object)
+{
+        if (!object)
+                return sanNotation; // default
+
+        for (int i=0; i<nrNotations; i++)
+                if (object == state->notations[i])
+                        return i; // found by identity
+
+        if (PyUnicode_Check(object))
+                for (int i=0; i<nrNotations; i++)
+                        if (PyUnicode_Compare(object, state->notations[i]) == 0)
+                                return i; // found by value
+
+        PyErr_Format(PyExc_ValueError, "Invalid notation (%R)", object);
+        return -1;
+}
+
+/*
+ *  Map the output argument to its index, or return -1 with an exception
+ *  set. Only the outputs in the allowed bit set are accepted. Absent means
+ *  moves.
+ */
+static int getOutput(struct moduleState *state, PyObject *object, int allowed)
+{
+        if (!object)
+                return movesOutput; // default
+
+        for (int i=0; i<nrOutputs; i++)
+                if ((allowed >> i & 1) && object == state->outputs[i])
+                        return i; // found by identity
+
+        if (PyUnicode_Check(object))
+                for (int i=0; i<nrOutputs; i++)
+                        if ((allowed >> i & 1) && PyUnicode_Compare(object, state->outputs[i]) == 0)
+                                return i; // found by value
+
+        PyErr_Format(PyExc_ValueError, "Invalid output (%R)", object);
+        return -1;
+}
+
+// Get an optional number of threads, 0 for all processors. Return -1 with an exception set on failure.
+static int getThreads(PyObject *object, int *nrThreads)
+{
+        *nrThreads = 0;
+        if (object) {
+                long n = PyLong_AsLong(object);
+                if (n == -1 && PyErr_Occurred())
+                        return -1;
+                if (n < 0 || n > maxThreads) {
+                        PyErr_Format(PyExc_ValueError, "threads must be between 0 and %d", maxThreads);
+                        return -1;
+                }
+                *nrThreads = n;
+        }
+        return 0;
+}
+
+/*
+ *  Convert a move in the current position to a string in the given
+ *  notation. The board is unchanged on return.
+ */
+static PyObject *moveToObject(Board_t board, int notationIndex, int move)
+{
+        int moveList[maxMoves];
+        updateSideInfo(board);
+        int nrMoves = generateMoves(board, moveList);
+
+        char moveString[maxMoveSize];
+        char *s = moveString;
+
+        switch (notationIndex) {
+        case uciNotation:
+                s = moveToUci(board, s, move);
+                break;
+        case sanNotation:
+                s = moveToStandardAlgebraic(board, s, move, moveList, nrMoves);
+                break;
+        case longNotation:
+                s = moveToLongAlgebraic(board, s, move);
+                break;
+        default:
+                assert(0);
+        }
+
+        if (notationIndex != uciNotation) {
+                makeMove(board, move);
+                updateSideInfo(board);
+                s = stringCopy(s, getCheckMark(board));
+                undoMove(board);
+        }
+
+        return PyUnicode_FromStringAndSize(moveString, s - moveString);
+}
+
+/*
+ *  Convert a variation to a list of move strings in the given notation.
+ *  The board is unchanged on return.
+ */
+static PyObject *variationToList(Board_t board, int notationIndex, const int variation[], int nrPlies)
+{
+        PyObject *list = PyList_New(nrPlies);
+        if (!list)
+                return NULL;
+
+        int i;
+        for (i=0; i<nrPlies; i++) {
+                PyObject *item = moveToObject(board, notationIndex, variation[i]);
+                if (!item) {
+                        Py_CLEAR(list);
+                        break;
+                }
+                PyList_SET_ITEM(list, i, item);
+                makeMove(board, variation[i]);
+        }
+
+        while (i-- > 0)
+                undoMove(board);
+
+        return list;
+}
+
+/*
+ *  Get the depth argument for mate searches, or return -1 with an exception set
+ */
+static int getMateDepth(PyObject *object)
+{
+        long depth = PyLong_AsLong(object);
+        if (depth == -1 && PyErr_Occurred())
+                return -1;
+
+        if (depth < 1 || depth > maxMateDepth) {
+                PyErr_Format(PyExc_ValueError, "n must be between 1 and %d", maxMateDepth);
+                return -1;
+        }
+        return depth;
+}
+
+/*----------------------------------------------------------------------+
+ |      Moves type                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  The result of moves(...): a read-only mapping from moves to positions.
+ *  The moves are formatted up front, because they are the keys. Each new
+ *  position is only converted to FEN when it is first looked up, and kept
+ *  from then on. Callers typically look at a few of the positions at most.
+ *  The keys(), items(), values() and get() methods and comparison come from
+ *  collections.abc.Mapping, see chessmovesExec().
+ */
+typedef struct {
+        PyObject_VAR_HEAD               // the size is the number of moves
+        struct board board;             // the parent position
+        struct fenPlacement placement;
+        PyObject *keys;                 // tuple of move strings
+        struct movesItem {
+                int move;
+                PyObject *fen;          // NULL until looked up
+        } items[];
+} MovesObject;
+
+static PyObject *
+Moves_new(PyTypeObject *type, PyObject *args, PyObject *keywords)
+{
+        return PyErr_Format(PyExc_TypeError, "cannot create '%.200s' instances", type->tp_name);
+}
+
+static void
+Moves_dealloc(MovesObject *self)
+{
+        PyTypeObject *type = Py_TYPE(self);
+
+        for (Py_ssize_t i=0; i<Py_SIZE(self); i++)
+                Py_XDECREF(self->items[i].fen);
+        Py_XDECREF(self->keys);
+        freeBoard(&self->board);
+
+        type->tp_free(self);
+        Py_DECREF(type);
+}
+
+// Find the index of a move, or return -1 if there is no such key
+static Py_ssize_t findMove(MovesObject *self, PyObject *key)
+{
+        if (!PyUnicode_Check(key))
+                return -1;
+
+        for (Py_ssize_t i=0; i<Py_SIZE(self); i++)
+                if (PyTuple_GET_ITEM(self->keys, i) == key)
+                        return i; // found by identity
+
+        Py_hash_t hash = PyObject_Hash(key);
+        for (Py_ssize_t i=0; i<Py_SIZE(self); i++) {
+                PyObject *move = PyTuple_GET_ITEM(self->keys, i);
+                if (PyObject_Hash(move) == hash && PyUnicode_Compare(move, key) == 0)
+                        return i; // found by value
+        }
+        return -1;
+}
+
+// Get the position after a move as a borrowed reference, or NULL with an exception set
+static PyObject *getMovesValue(MovesObject *self, Py_ssize_t i)
+{
+        struct movesItem *item = &self->items[i];
+        if (!item->fen) {
+                char newFen[maxFenSize];
+                makeMove(&self->board, item->move);
+                childToFen(&self->board, &self->placement, item->move, newFen);
+                undoMove(&self->board);
+                item->fen = PyUnicode_FromString(newFen);
+        }
+        return item->fen;
+}
+
+static Py_ssize_t
+Moves_length(MovesObject *self)
+{
+        return Py_SIZE(self);
+}
+
+static PyObject *
+Moves_subscript(MovesObject *self, PyObject *key)
+{
+        Py_ssize_t i = findMove(self, key);
+        if (i < 0) {
+                PyObject *args = PyTuple_Pack(1, key); // also for a tuple as key
+                if (args) {
+                        PyErr_SetObject(PyExc_KeyError, args);
+                        Py_DECREF(args);
+                }
+                return NULL;
+        }
+
+        PyObject *fen = getMovesValue(self, i);
+        Py_XINCREF(fen);
+        return fen;
+}
+
+static int
+Moves_contains(MovesObject *self, PyObject *key)
+{
+        return findMove(self, key) >= 0;
+}
+
+static PyObject *
+Moves_iter(MovesObject *self)
+{
+        return PyObject_GetIter(self->keys);
+}
+
+PyDoc_STRVAR(Moves_copy_doc,
+        "copy() -> { move : newPosition, ... }\n"
+        "\n"
+        "Return the moves and positions as a new dictionary."
+);
+
+static PyObject *
+Moves_copy(MovesObject *self, PyObject *unused)
+{
+        PyObject *dict = PyDict_New();
+        if (!dict)
+                return NULL;
+
+        for (Py_ssize_t i=0; i<Py_SIZE(self); i++) {
+                PyObject *fen = getMovesValue(self, i);
+                if (!fen || PyDict_SetItem(dict, PyTuple_GET_ITEM(self->keys, i), fen)) {
+                        Py_DECREF(dict);
+                        return NULL;
+                }
+        }
+
+        return dict;
+}
+
+static PyObject *
+Moves_repr(MovesObject *self)
+{
+        PyObject *dict = Moves_copy(self, NULL);
+        if (!dict)
+                return NULL;
+
+        PyObject *repr = PyObject_Repr(dict);
+        Py_DECREF(dict);
+        return repr;
+}
+
+static PyMethodDef Moves_methods[] = {
+        { "copy", (PyCFunction)Moves_copy, METH_NOARGS, Moves_copy_doc },
+        { NULL, }
+};
+
+static PyType_Slot Moves_slots[] = {
+        { Py_tp_doc,        (void *)"Moves and the positions they lead to, see moves(...)" },
+        { Py_tp_new,        (void *)(uintptr_t)Moves_new },
+        { Py_tp_dealloc,    (void *)(uintptr_t)Moves_dealloc },
+        { Py_tp_repr,       (void *)(uintptr_t)Moves_repr },
+        { Py_tp_iter,       (void *)(uintptr_t)Moves_iter },
+        { Py_mp_length,     (void *)(uintptr_t)Moves_length },
+        { Py_mp_subscript,  (void *)(uintptr_t)Moves_subscript },
+        { Py_sq_contains,   (void *)(uintptr_t)Moves_contains },
+        { Py_tp_methods,    Moves_methods },
+        { 0, NULL }
+};
+
+static PyType_Spec Moves_spec = {
+        .name      = "chessmoves.Moves",
+        .basicsize = sizeof(MovesObject),
+        .itemsize  = sizeof(struct movesItem),
+        .flags     = Py_TPFLAGS_DEFAULT,
+        .slots     = Moves_slots,
+};
+
+/*
+ *  Estimate the memory use of a result, as if all its positions were
+ *  looked up, for the cache
+ */
+static Py_ssize_t movesSize(MovesObject *self)
+{
+        Py_ssize_t size = Py_TYPE(self)->tp_basicsize + Py_SIZE(self) * Py_TYPE(self)->tp_itemsize;
+        size += PyTuple_Type.tp_basicsize + Py_SIZE(self) * sizeof(PyObject *);
+
+        Py_ssize_t fenLength = self->placement.length + sizeof(" w KQkq e3");
+        for (Py_ssize_t i=0; i<Py_SIZE(self); i++)
+                size += 2 * sizeof(PyASCIIObject) + PyUnicode_GET_LENGTH(PyTuple_GET_ITEM(self->keys, i)) + fenLength + 1;
+        return size;
+}
+
+/*----------------------------------------------------------------------+
+ |      Moves cache functions                                           |
+ +----------------------------------------------------------------------*/
+
+#define homeSlot(cache, key, notation) \
+        (((key) + (notation) * 0x9e3779b97f4a7c15ULL) & ((cache)->capacity - 1))
+
+static struct cacheEntry *findEntry(struct movesCache *cache, unsigned long long key, int notation)
+{
+        Py_ssize_t mask = cache->capacity - 1;
+        for (Py_ssize_t slot=homeSlot(cache, key, notation); ; slot=(slot+1)&mask) {
+                struct cacheEntry *entry = &cache->entries[slot];
+                if (!entry->value || (entry->key == key && entry->notation == notation))
+                        return entry;
+        }
+}
+
+// Remove the entry in the slot, and close the gap in its probe sequence
+static void removeEntry(struct movesCache *cache, Py_ssize_t slot)
+{
+        Py_ssize_t mask = cache->capacity - 1;
+        struct cacheEntry *entries = cache->entries;
+
+        cache->size -= entries[slot].size;
+        cache->count--;
+        Py_DECREF(entries[slot].value);
+
+        for (Py_ssize_t next=(slot+1)&mask; entries[next].value; next=(next+1)&mask) {
+                Py_ssize_t home = homeSlot(cache, entries[next].key, entries[next].notation);
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                        entries[slot] = entries[next];
+                        slot = next;
+                }
+        }
+        entries[slot].value = NULL;
+}
+
+static void evictEntry(struct movesCache *cache)
+{
+        Py_ssize_t mask = cache->capacity - 1;
+        for (;;) {
+                struct cacheEntry *entry = &cache->entries[cache->hand];
+                if (entry->value && !entry->isReferenced) {
+                        removeEntry(cache, cache->hand); // the slot may get another entry
+                        cache->evictions++;
+                        return;
+                }
+                entry->isReferenced = false;
+                cache->hand = (cache->hand + 1) & mask;
+        }
+}
+
+static int resizeCache(struct movesCache *cache, Py_ssize_t capacity)
+{
+        struct cacheEntry *entries = PyMem_Calloc(capacity, sizeof *entries);
+        if (!entries) {
+                PyErr_NoMemory();
+                return -1;
+        }
+
+        struct movesCache old = *cache;
+        cache->entries = entries;
+        cache->capacity = capacity;
+        cache->hand = 0;
+        for (Py_ssize_t i=0; i<old.capacity; i++)
+                if (old.entries[i].value)
+                        *findEntry(cache, old.entries[i].key, old.entries[i].notation) = old.entries[i];
+        PyMem_Free(old.entries);
+        return 0;
+}
+
+static void clearCache(struct movesCache *cache)
+{
+        for (Py_ssize_t i=0; i<cache->capacity; i++)
+                Py_XDECREF(cache->entries[i].value);
+        PyMem_Free(cache->entries);
+        *cache = (struct movesCache) { .entries = NULL, .maxSize = cache->maxSize };
+}
+
+static PyObject *lookupMoves(struct movesCache *cache, unsigned long long key, int notation)
+{
+        struct cacheEntry *entry = (cache->count > 0) ? findEntry(cache, key, notation) : NULL;
+        if (!entry || !entry->value) {
+                cache->misses++;
+                return NULL;
+        }
+        cache->hits++;
+        entry->isReferenced = true;
+        return entry->value;
+}
+
+/*
+ *  Add a result, evicting others as needed to stay within the memory
+ *  limit. Return 0 on success, or -1 with an exception set.
+ */
+static int insertMoves(struct movesCache *cache, unsigned long long key, int notation, MovesObject *moves)
+{
+        Py_ssize_t size = sizeof(struct cacheEntry) + movesSize(moves);
+        if (size > cache->maxSize)
+                return 0; // never fits
+
+        // Another thread may have added it meanwhile
+        if (cache->count > 0) {
+                struct cacheEntry *entry = findEntry(cache, key, notation);
+                if (entry->value)
+                        removeEntry(cache, entry - cache->entries);
+        }
+
+        while (cache->size + size > cache->maxSize)
+                evictEntry(cache);
+
+        if (2 * (cache->count + 1) > cache->capacity)
+                if (resizeCache(cache, cache->capacity ? 2 * cache->capacity : 64) != 0)
+                        return -1;
+
+        struct cacheEntry *entry = findEntry(cache, key, notation);
+        Py_INCREF(moves);
+        *entry = (struct cacheEntry) {
+                .key = key, .value = (PyObject *)moves, .size = size, .notation = notation, .isReferenced = false
+        };
+        cache->count++;
+        cache->size += size;
+        return 0;
+}
+
 /*----------------------------------------------------------------------+
  |      moves(...)                                                      |
  +----------------------------------------------------------------------*/
@@ -83,47 +732,72 @@ PyDoc_STRVAR(moves_doc,
         "moves(position, notation='san') -> { move : newPosition, ... }\n"
         "\n"
         "Generate all legal moves from a position.\n"
-        "Return the result as a dictionary, mapping moves to positions.\n"
+        "Return the result as a read-only mapping from moves to positions.\n"
+        "A new position is only converted to FEN when it is looked up, so\n"
+        "the keys and the length come cheaply. copy() gives a dictionary.\n"
         "\n"
         "The `notation' keyword controls the output move syntax.\n"
         "Available notations are:\n"
         "    'san': Standard Algebraic Notation (e.g. Nc3+, O-O, dxe8=Q)\n"
         "    'long': Long Algebraic Notation (e.g. Nb1-c3+, O-O, d7xe8=Q)\n"
-        "    'uci': Universal Chess Interface computer notation (e.g. b1c3, e8g8, d7e8q)"
+        "    'uci': Universal Chess Interface computer notation (e.g. b1c3, e8g8, d7e8q)\n"
+        "\n"
+        "Results can be cached, see set_moves_cache(...)."
 );
 
 static PyObject *
-chessmovesmodule_moves(PyObject *self, PyObject *args, PyObject *keywords)
+chessmovesmodule_moves(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
 {
-        char *fen;
-        char *notation = "san"; // default
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->fenKeyword, state->notationKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("moves", args, nargs, kwnames, keywords, 2, 1, values))
+                return NULL;
 
-        static char *keywordList[] = { "fen", "notation", NULL };
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
 
-        if (!PyArg_ParseTupleAndKeywords(args, keywords, "s|s:moves", keywordList,
-                                         &fen, &notation))
+        int notationIndex = getNotation(state, values[1]);
+        if (notationIndex < 0)
                 return NULL;
 
+        // Generate and format the moves first, without holding the GIL
         struct board board;
-        int len = setupBoard(&board, fen);
+        int moveList[maxMoves];
+        int nrMoves = 0, nrLegalMoves = 0;
+        struct {
+                char moveString[maxMoveSize];
+                int moveLength;
+                int move;
+        } results[maxMoves];
+
+        // Decide once: another thread can change the cache while the GIL is released
+        struct movesCache *cache = &state->movesCache;
+        bool useCache = cache->maxSize > 0;
+        unsigned long long hashKey = 0;
+        int len;
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0 && useCache)
+                hashKey = hash64(&board);
+        Py_END_ALLOW_THREADS
+
         if (len <= 0)
                 return PyErr_Format(PyExc_ValueError, "Invalid FEN");
 
-        int notationIndex;
-        for (notationIndex=0; notationIndex<nrNotations; notationIndex++)
-                if (0==strcmp(notations[notationIndex], notation))
-                        break; // found
-
-        if (notationIndex >= nrNotations) // not found
-                return PyErr_Format(PyExc_ValueError, "Invalid notation");
+        if (useCache) {
+                PyObject *moves = lookupMoves(cache, hashKey, notationIndex);
+                if (moves) {
+                        Py_INCREF(moves); // read-only, so it can be shared
+                        return moves;
+                }
+        }
 
-        int moveList[maxMoves];
+        Py_BEGIN_ALLOW_THREADS
         updateSideInfo(&board);
-        int nrMoves = generateMoves(&board, moveList);
-
-        PyObject *dict = PyDict_New();
-        if (!dict)
-                return NULL;
+        nrMoves = generateMoves(&board, moveList);
 
         for (int i=0; i<nrMoves; i++) {
                 int move = moveList[i];
@@ -138,29 +812,23 @@ chessmovesmodule_moves(PyObject *self, PyObject *args, PyObject *keywords)
                 }
 
                 // key is move
-                char moveString[maxMoveSize];
+                char *moveString = results[nrLegalMoves].moveString;
                 char *s = moveString;
                 const char *checkmark;
 
-                // value is new position
-                char newFen[maxFenSize];
-
                 switch (notationIndex) {
                 case uciNotation:
-                        boardToFen(&board, newFen);
                         undoMove(&board);
                         s = moveToUci(&board, s, move);
                         break;
                 case sanNotation:
                         checkmark = getCheckMark(&board);
-                        boardToFen(&board, newFen);
                         undoMove(&board);
                         s = moveToStandardAlgebraic(&board, s, move, moveList, nrMoves);
                         s = stringCopy(s, checkmark);
                         break;
                 case longNotation:
                         checkmark = getCheckMark(&board);
-                        boardToFen(&board, newFen);
                         undoMove(&board);
                         s = moveToLongAlgebraic(&board, s, move);
                         s = stringCopy(s, checkmark);
@@ -168,262 +836,2876 @@ chessmovesmodule_moves(PyObject *self, PyObject *args, PyObject *keywords)
                 default:
                         assert(0);
                 }
+                results[nrLegalMoves].moveLength = s - moveString;
+                results[nrLegalMoves++].move = move;
+        }
+        Py_END_ALLOW_THREADS
+
+        PyTypeObject *movesType = (PyTypeObject *)state->movesType;
+        MovesObject *moves = (MovesObject *)movesType->tp_alloc(movesType, nrLegalMoves);
+        if (!moves)
+                return NULL;
+
+        // The side info points into the board, so set it up again in its new place
+        moves->board = board;
+        updateSideInfo(&moves->board);
+        preparePlacement(&moves->board, &moves->placement);
+        for (int i=0; i<nrLegalMoves; i++)
+                moves->items[i] = (struct movesItem) { .move = results[i].move, .fen = NULL };
+
+        moves->keys = PyTuple_New(nrLegalMoves);
+        if (!moves->keys) {
+                Py_DECREF(moves);
+                return NULL;
+        }
+
+        for (int i=0; i<nrLegalMoves; i++) {
+                PyObject *key = PyUnicode_FromStringAndSize(results[i].moveString, results[i].moveLength);
+                if (!key) {
+                        Py_DECREF(moves);
+                        return NULL;
+                }
+                PyTuple_SET_ITEM(moves->keys, i, key);
+        }
+
+        if (useCache && insertMoves(cache, hashKey, notationIndex, moves) != 0) {
+                Py_DECREF(moves);
+                return NULL;
+        }
+
+        return (PyObject *)moves;
+}
+
+/*----------------------------------------------------------------------+
+ |      set_moves_cache(...)                                            |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(set_moves_cache_doc,
+        "set_moves_cache(max_bytes)\n"
+        "\n"
+        "Cache the results of moves(...) for repeated positions, keyed by the\n"
+        "Zobrist-Polyglot hash and the notation. The cache holds on to at most\n"
+        "about max_bytes of memory, and evicts the least recently used results\n"
+        "first, with the CLOCK approximation. A size of 0 disables the cache,\n"
+        "which is the default. The cache and its statistics are cleared.\n"
+        "A cached result is shared, and so are the positions looked up in it."
+);
+
+static PyObject *
+chessmovesmodule_set_moves_cache(PyObject *self, PyObject *arg)
+{
+        Py_ssize_t maxSize = PyLong_AsSsize_t(arg);
+        if (maxSize == -1 && PyErr_Occurred())
+                return NULL;
+        if (maxSize < 0)
+                return PyErr_Format(PyExc_ValueError, "max_bytes must not be negative");
+
+        struct movesCache *cache = &moduleState(self)->movesCache;
+        clearCache(cache);
+        cache->maxSize = maxSize;
+
+        Py_RETURN_NONE;
+}
+
+/*----------------------------------------------------------------------+
+ |      moves_cache_info(...)                                           |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(moves_cache_info_doc,
+        "moves_cache_info() -> { statistic : value, ... }\n"
+        "\n"
+        "Return the statistics of the moves(...) cache: 'hits', 'misses',\n"
+        "'evictions', 'entries', 'bytes' and 'max_bytes'."
+);
+
+static PyObject *
+chessmovesmodule_moves_cache_info(PyObject *self, PyObject *unused)
+{
+        struct movesCache *cache = &moduleState(self)->movesCache;
+
+        return Py_BuildValue("{sKsKsKsnsnsn}",
+                "hits", cache->hits,
+                "misses", cache->misses,
+                "evictions", cache->evictions,
+                "entries", cache->count,
+                "bytes", cache->size,
+                "max_bytes", cache->maxSize);
+}
+
+/*----------------------------------------------------------------------+
+ |      position(...)                                                   |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(position_doc,
+        "position(inputFen, counters=False) -> standardFen\n"
+        "\n"
+        "Parse a FEN like string and convert it into a standardized FEN.\n"
+        "For example:\n"
+        " - Complete shortened ranks\n"
+        " - Order castling flags\n"
+        " - Remove en passant target square if there is no such legal capture\n"
+        " - Remove excess data beyond the FEN\n"
+        "\n"
+        "With counters=True, the FEN keeps the halfmove clock and the fullmove\n"
+        "number, which default to 0 and 1 when the input doesn't have them."
+);
+
+static PyObject *
+chessmovesmodule_position(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->fenKeyword, state->countersKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("position", args, nargs, kwnames, keywords, 2, 1, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        int withCounters = values[1] ? PyObject_IsTrue(values[1]) : 0;
+        if (withCounters < 0)
+                return NULL;
+
+        struct board board;
+        char newFen[maxFenSize];
+        int len;
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0) {
+                if (withCounters)
+                        boardToFullFen(&board, newFen);
+                else
+                        boardToFen(&board, newFen);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (len <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        return PyUnicode_FromString(newFen);
+}
+
+/*----------------------------------------------------------------------+
+ |      move(...)                                                       |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(move_doc,
+        "move(inputFen, inputMove, notation='san') -> (move, fen)\n"
+        "\n"
+        "Try to parse the input move and return it as a normalized string\n"
+        "if successful, legal and unambiguous. \n"
+        "\n"
+        "The parser accepts a wide variety of formats. The only restriction\n"
+        "is that piece identifiers, other than promotion pieces, must always\n"
+        "be in upper case, and file letters must always be in lower case.\n"
+        "Input capture signs, check marks, checkmate marks, annotations\n"
+        "(x, +, !, ?, etc) are all swallowed and ignored: these are not used\n"
+        "for disambiguation and also not checked for correctness.\n"
+        "When a promotion piece is missing, queening is assumed.\n"
+        "The output fen is the position after the move.\n"
+        "\n"
+        "The `notation' keyword controls the output move syntax. See moves(...)\n"
+        "for details.\n"
+);
+
+/*
+ *  Format a legal move and the position after it. Return the end of the
+ *  move string. The board is unchanged on return.
+ */
+static char *formatParsedMove(Board_t board, int notationIndex, int move, int moveList[maxMoves], int nrMoves,
+        char *s, char newFen[maxFenSize])
+{
+        const char *checkmark;
+
+        makeMove(board, move);
+        boardToFen(board, newFen);
+
+        switch (notationIndex) {
+        case uciNotation:
+                undoMove(board);
+                s = moveToUci(board, s, move);
+                break;
+        case sanNotation:
+                updateSideInfo(board);
+                checkmark = getCheckMark(board);
+                undoMove(board);
+                s = moveToStandardAlgebraic(board, s, move, moveList, nrMoves);
+                s = stringCopy(s, checkmark);
+                break;
+        case longNotation:
+                updateSideInfo(board);
+                checkmark = getCheckMark(board);
+                undoMove(board);
+                s = moveToLongAlgebraic(board, s, move);
+                s = stringCopy(s, checkmark);
+                break;
+        default:
+                assert(0);
+        }
+
+        return s;
+}
+
+static PyObject *
+chessmovesmodule_move(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->fenKeyword, state->moveKeyword, state->notationKeyword };
+        PyObject *values[3];
+
+        if (parseArguments("move", args, nargs, kwnames, keywords, 3, 2, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        const char *moveString = getString(values[1], "move");
+        if (!moveString)
+                return NULL;
+
+        int notationIndex = getNotation(state, values[2]);
+        if (notationIndex < 0)
+                return NULL;
+
+        struct board board;
+        char newFen[maxFenSize];
+        char newMoveString[maxMoveSize];
+        char *s = newMoveString;
+        bool isValidFen;
+        int len = 0;
+
+        Py_BEGIN_ALLOW_THREADS
+        isValidFen = setupBoard(&board, fen) > 0;
+        if (isValidFen) {
+                int moveList[maxMoves];
+                updateSideInfo(&board);
+                int nrMoves = generateMoves(&board, moveList);
+
+                int move;
+                len = parseMove(&board, moveString, moveList, nrMoves, &move);
+                if (len > 0)
+                        s = formatParsedMove(&board, notationIndex, move, moveList, nrMoves, s, newFen);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!isValidFen)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        if (len == 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid move syntax (%s)", moveString);
+        if (len == -1)
+                return PyErr_Format(PyExc_ValueError, "Illegal move (%s)", moveString);
+        if (len == -2)
+                return PyErr_Format(PyExc_ValueError, "Ambiguous move (%s)", moveString);
+
+        return Py_BuildValue("(s#s)", newMoveString, (Py_ssize_t)(s - newMoveString), newFen);
+}
+
+/*----------------------------------------------------------------------+
+ |      play(...)                                                       |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(play_doc,
+        "play(fen, moves, notation='san', output='moves', counters=False) -> ([result, ...], errorIndex)\n"
+        "\n"
+        "Play a sequence of moves from a position on one board. The moves are\n"
+        "given as a list of strings, or as one string with the moves separated\n"
+        "by white space. Moves are parsed as by move(...).\n"
+        "\n"
+        "The `output' keyword selects the result for each ply:\n"
+        "    'moves': the normalized move, in the syntax given by `notation'\n"
+        "    'fens': the position after the move\n"
+        "    'hashes': the Zobrist-Polyglot hash of that position\n"
+        "    'clocks': the halfmove clock after the move\n"
+        "    'repetitions': how often the position after the move occurred\n"
+        "        before, counting from the given position, so 2 means a threefold\n"
+        "        repetition\n"
+        "    'pawn_keys', 'material_keys': the pawn key or the material key of\n"
+        "        that position, as kept by the board while moves are made and\n"
+        "        undone. See hash_keys(...).\n"
+        "\n"
+        "With counters=True, the FENs have the halfmove clock and the fullmove\n"
+        "number, starting from those of the given position.\n"
+        "\n"
+        "errorIndex is the index of the first move that is invalid, illegal\n"
+        "or ambiguous, or None if all moves were played. The results are for\n"
+        "the moves before that."
+);
+
+// The result of one ply, before it becomes a Python object
+struct plyResult {
+        unsigned long long hash;
+        int length;              // of the string, or the clock or repetition count
+        char string[maxFenSize];
+};
+
+// Options of play(...)
+struct playOptions {
+        int outputIndex;
+        int notationIndex;
+        bool withCounters;
+        struct keyHistory history; // for repetitions
+};
+
+/*
+ *  Make the move and fill in the result for the ply.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+static int playPly(struct plyResult *result, Board_t board, struct playOptions *options,
+        int move, int moveList[maxMoves], int nrMoves)
+{
+        int outputIndex = options->outputIndex;
+        int notationIndex = options->notationIndex;
+        char *s = result->string;
+
+        if (outputIndex == movesOutput) {
+                switch (notationIndex) {
+                case uciNotation:
+                        s = moveToUci(board, s, move);
+                        break;
+                case sanNotation:
+                        s = moveToStandardAlgebraic(board, s, move, moveList, nrMoves);
+                        break;
+                case longNotation:
+                        s = moveToLongAlgebraic(board, s, move);
+                        break;
+                default:
+                        assert(0);
+                }
+        }
+
+        makeMove(board, move);
+
+        switch (outputIndex) {
+        case movesOutput:
+                if (notationIndex != uciNotation) {
+                        updateSideInfo(board);
+                        s = stringCopy(s, getCheckMark(board));
+                }
+                result->length = s - result->string;
+                break;
+        case fensOutput:
+                if (options->withCounters)
+                        boardToFullFen(board, result->string);
+                else
+                        boardToFen(board, result->string);
+                result->length = strlen(result->string);
+                break;
+        case hashesOutput:
+                result->hash = hash64(board);
+                break;
+        case pawnKeysOutput:
+                result->hash = board->pawnKey;
+                break;
+        case materialKeysOutput:
+                result->hash = board->materialKey;
+                break;
+        case clocksOutput:
+                result->length = halfmoveClock(board);
+                break;
+        case repetitionsOutput:
+                result->length = pushKey(&options->history, board);
+                if (result->length < 0)
+                        return -1;
+                break;
+        default:
+                assert(0);
+        }
+        return 0;
+}
+
+static PyObject *
+chessmovesmodule_play(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fenKeyword, state->movesKeyword, state->notationKeyword, state->outputKeyword,
+                state->countersKeyword
+        };
+        PyObject *values[5];
+
+        if (parseArguments("play", args, nargs, kwnames, keywords, 5, 2, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        struct playOptions options;
+
+        options.notationIndex = getNotation(state, values[2]);
+        if (options.notationIndex < 0)
+                return NULL;
+
+        options.outputIndex = getOutput(state, values[3], playOutputs);
+        if (options.outputIndex < 0)
+                return NULL;
+
+        int withCounters = values[4] ? PyObject_IsTrue(values[4]) : 0;
+        if (withCounters < 0)
+                return NULL;
+        options.withCounters = withCounters;
+
+        // Moves come as one string, or as a sequence of strings
+        const char *line = NULL;
+        PyObject *sequence = NULL;
+        const char **moveStrings = NULL;
+        Py_ssize_t nrPlies = 0;
+        PyObject *errorType = NULL, *errorValue = NULL, *errorTraceback = NULL;
+        if (PyUnicode_Check(values[1]) || PyBytes_Check(values[1])) {
+                line = getString(values[1], "moves");
+                if (!line)
+                        return NULL;
+                for (const char *s=line; *s; ) {
+                        while (isspace((unsigned char)*s))
+                                s++;
+                        nrPlies += (*s != '\0');
+                        while (*s != '\0' && !isspace((unsigned char)*s))
+                                s++;
+                }
+        } else {
+                if (!PySequence_Check(values[1]))
+                        return PyErr_Format(PyExc_TypeError, "moves must be a string or a sequence");
+
+                // A tuple keeps the strings alive while the GIL is released
+                sequence = PySequence_Tuple(values[1]);
+                if (!sequence)
+                        return NULL;
+                nrPlies = PyTuple_GET_SIZE(sequence);
+                moveStrings = PyMem_Malloc((nrPlies + 1) * sizeof *moveStrings);
+                if (!moveStrings) {
+                        Py_DECREF(sequence);
+                        return PyErr_NoMemory();
+                }
+                for (Py_ssize_t i=0; i<nrPlies; i++) {
+                        moveStrings[i] = getString(PyTuple_GET_ITEM(sequence, i), "move");
+                        if (!moveStrings[i]) {
+                                // Only raised if the moves before it can be played
+                                PyErr_Fetch(&errorType, &errorValue, &errorTraceback);
+                                nrPlies = i;
+                                break;
+                        }
+                }
+        }
+
+        struct plyResult *results = PyMem_Malloc((nrPlies + 1) * sizeof *results);
+        if (!results) {
+                PyMem_Free(moveStrings);
+                Py_XDECREF(sequence);
+                Py_XDECREF(errorType);
+                Py_XDECREF(errorValue);
+                Py_XDECREF(errorTraceback);
+                return PyErr_NoMemory();
+        }
+
+        // Play without holding the GIL
+        struct board board;
+        bool isValidFen;
+        Py_ssize_t nrPlayed = 0;
+        Py_ssize_t errorIndex = -1;
+        int saveErrno = 0;
+        initKeyHistory(&options.history);
+
+        Py_BEGIN_ALLOW_THREADS
+        isValidFen = setupBoard(&board, fen) > 0;
+        if (isValidFen && options.outputIndex == repetitionsOutput && pushKey(&options.history, &board) < 0)
+                saveErrno = errno;
+        for (Py_ssize_t i=0; isValidFen && !saveErrno && i<nrPlies; i++) {
+                const char *moveString;
+                if (line) {
+                        while (isspace((unsigned char)*line))
+                                line++;
+                        moveString = line;
+                } else
+                        moveString = moveStrings[i];
+
+                int moveList[maxMoves];
+                updateSideInfo(&board);
+                int nrMoves = generateMoves(&board, moveList);
+
+                int move;
+                int len = parseMove(&board, moveString, moveList, nrMoves, &move);
+                if (line) {
+                        // The move must be the whole word
+                        if (len > 0 && line[len] != '\0' && !isspace((unsigned char)line[len]))
+                                len = 0;
+                        while (*line != '\0' && !isspace((unsigned char)*line))
+                                line++;
+                }
+                if (len <= 0) {
+                        errorIndex = i;
+                        break;
+                }
+
+                if (playPly(&results[nrPlayed++], &board, &options, move, moveList, nrMoves) != 0)
+                        saveErrno = errno;
+        }
+        if (isValidFen)
+                freeBoard(&board);
+        freeKeyHistory(&options.history);
+        Py_END_ALLOW_THREADS
+
+        if (saveErrno) {
+                PyMem_Free(moveStrings);
+                Py_XDECREF(sequence);
+                Py_XDECREF(errorType);
+                Py_XDECREF(errorValue);
+                Py_XDECREF(errorTraceback);
+                PyMem_Free(results);
+                errno = saveErrno;
+                return PyErr_SetFromErrno(PyExc_OSError);
+        }
+
+        PyMem_Free(moveStrings);
+        Py_XDECREF(sequence);
+
+        if (errorType) {
+                if (isValidFen && errorIndex < 0) {
+                        PyErr_Restore(errorType, errorValue, errorTraceback);
+                        PyMem_Free(results);
+                        return NULL;
+                }
+                Py_DECREF(errorType);
+                Py_XDECREF(errorValue);
+                Py_XDECREF(errorTraceback);
+        }
+
+        if (!isValidFen) {
+                PyMem_Free(results);
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        }
+
+        PyObject *list = PyList_New(nrPlayed);
+        for (Py_ssize_t i=0; list && i<nrPlayed; i++) {
+                PyObject *item;
+                switch (options.outputIndex) {
+                case hashesOutput:
+                case pawnKeysOutput:
+                case materialKeysOutput:
+                        item = PyLong_FromUnsignedLongLong(results[i].hash);
+                        break;
+                case clocksOutput:
+                case repetitionsOutput:
+                        item = PyLong_FromLong(results[i].length);
+                        break;
+                default:
+                        item = PyUnicode_FromStringAndSize(results[i].string, results[i].length);
+                }
+                if (!item)
+                        Py_CLEAR(list);
+                else
+                        PyList_SET_ITEM(list, i, item);
+        }
+        PyMem_Free(results);
+
+        if (!list)
+                return NULL;
+
+        if (errorIndex < 0)
+                return Py_BuildValue("(NO)", list, Py_None);
+        else
+                return Py_BuildValue("(Nn)", list, errorIndex);
+}
+
+/*----------------------------------------------------------------------+
+ |      hash(...)                                                       |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(hash_doc,
+        "hash(fen) -> hash\n"
+        "\n"
+        "Compute the Zobrist-Polyglot hash for the position."
+);
+
+static PyObject *
+chessmovesmodule_hash(PyObject *self, PyObject *arg)
+{
+        const char *fen = getString(arg, "fen");
+        if (!fen)
+                return NULL;
+
+        struct board board;
+        unsigned long long hashkey = 0;
+        int len;
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0)
+                hashkey = hash64(&board);
+        Py_END_ALLOW_THREADS
+
+        if (len <= 0) {
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN");
+        }
+
+        return PyLong_FromUnsignedLongLong(hashkey);
+}
+
+/*----------------------------------------------------------------------+
+ |      canonical(...)                                                  |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(canonical_doc,
+        "canonical(fen) -> (canonicalFen, hash, transform)\n"
+        "\n"
+        "Map the position to its canonical representative under color flip\n"
+        "(swapping colors and side to move) and, when there are no castling\n"
+        "rights, left-right mirror. The representative is the one with the\n"
+        "lowest Zobrist-Polyglot hash. Return it with its hash and the transform\n"
+        "that was applied: a combination of flipColors and mirrorFiles. The same\n"
+        "transform maps back. See transform(...) and transform_move(...)."
+);
+
+static PyObject *
+chessmovesmodule_canonical(PyObject *self, PyObject *arg)
+{
+        const char *fen = getString(arg, "fen");
+        if (!fen)
+                return NULL;
+
+        struct board board;
+        int transform = 0;
+        unsigned long long key = 0;
+        char newFen[maxFenSize];
+        int len;
+
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0) {
+                transform = canonicalizeBoard(&board);
+                key = hash64(&board);
+                boardToFen(&board, newFen);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (len <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        return Py_BuildValue("(sKi)", newFen, key, transform);
+}
+
+/*
+ *  Get a transform argument, or return -1 with an exception set
+ */
+static int getTransform(PyObject *object)
+{
+        long transform = PyLong_AsLong(object);
+        if (transform == -1 && PyErr_Occurred())
+                return -1;
+
+        if (transform < 0 || transform >= nrTransforms) {
+                PyErr_Format(PyExc_ValueError, "Invalid transform (%ld)", transform);
+                return -1;
+        }
+        return transform;
+}
+
+/*----------------------------------------------------------------------+
+ |      transform(...)                                                  |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(transform_doc,
+        "transform(fen, transform) -> fen\n"
+        "\n"
+        "Apply a transform to the position: flipColors, mirrorFiles or both.\n"
+        "Files can't be mirrored while there are castling rights."
+);
+
+static PyObject *
+chessmovesmodule_transform(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->fenKeyword, state->transformKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("transform", args, nargs, kwnames, keywords, 2, 2, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        int transform = getTransform(values[1]);
+        if (transform < 0)
+                return NULL;
+
+        struct board board;
+        char newFen[maxFenSize];
+        int len, result = -1;
+
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0) {
+                result = transformBoard(&board, transform);
+                if (result == 0)
+                        boardToFen(&board, newFen);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (len <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        if (result != 0)
+                return PyErr_Format(PyExc_ValueError, "Can't mirror with castling rights (%s)", fen);
+
+        return PyUnicode_FromString(newFen);
+}
+
+/*----------------------------------------------------------------------+
+ |      transform_move(...)                                             |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(transform_move_doc,
+        "transform_move(move, transform) -> move\n"
+        "\n"
+        "Map a move in UCI notation (e.g. e2e4, d7e8q) to the transformed position."
+);
+
+static PyObject *
+chessmovesmodule_transform_move(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->moveKeyword, state->transformKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("transform_move", args, nargs, kwnames, keywords, 2, 2, values))
+                return NULL;
+
+        const char *moveString = getString(values[0], "move");
+        if (!moveString)
+                return NULL;
+
+        int transform = getTransform(values[1]);
+        if (transform < 0)
+                return NULL;
+
+        size_t len = strlen(moveString);
+        bool isValid = (len == 4 || (len == 5 && strchr("qrbn", moveString[4])));
+        for (size_t i=0; i<4 && isValid; i++)
+                isValid = (i % 2 == 0) ? ('a' <= moveString[i] && moveString[i] <= 'h')
+                                       : ('1' <= moveString[i] && moveString[i] <= '8');
+        if (!isValid)
+                return PyErr_Format(PyExc_ValueError, "Invalid move syntax (%s)", moveString);
+
+        char newMoveString[maxMoveSize];
+        memcpy(newMoveString, moveString, len);
+        for (size_t i=0; i<4; i++) {
+                if (i % 2 == 0 && (transform & transformMirrorFiles))
+                        newMoveString[i] = 'a' + 'h' - moveString[i];
+                if (i % 2 == 1 && (transform & transformFlipColors))
+                        newMoveString[i] = '1' + '8' - moveString[i];
+        }
+
+        return PyUnicode_FromStringAndSize(newMoveString, len);
+}
+
+/*----------------------------------------------------------------------+
+ |      Budget type                                                     |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(Budget_doc,
+        "Budget(max_nodes=0, timeout=0) -> budget\n"
+        "\n"
+        "Limits for a traversal: perft(...), mate_in(...), mate_in_batch(...)\n"
+        "or playouts(...). The traversal stops after about max_nodes nodes or\n"
+        "timeout seconds, or when cancel() is called, and returns what it has\n"
+        "found so far. A limit of 0 means no limit. The limits are checked\n"
+        "every 1024 nodes, so they are approximate.\n"
+        "\n"
+        "Every call that is given the budget starts counting anew, and after\n"
+        "the call `exhausted' tells if its result is partial. A budget can only\n"
+        "be used by one call at a time."
+);
+
+typedef struct {
+        PyObject_HEAD
+        struct budget budget;
+        bool isInitialized;
+        bool isBusy; // a call is using it
+} BudgetObject;
+
+static PyObject *
+Budget_new(PyTypeObject *type, PyObject *args, PyObject *keywords)
+{
+        unsigned long long maxNodes = 0;
+        double timeout = 0.0;
+
+        static char *keywordList[] = { "max_nodes", "timeout", NULL };
+
+        if (!PyArg_ParseTupleAndKeywords(args, keywords, "|Kd:Budget", keywordList, &maxNodes, &timeout))
+                return NULL;
+
+        if (timeout < 0.0)
+                return PyErr_Format(PyExc_ValueError, "timeout must not be negative");
+
+        BudgetObject *self = (BudgetObject *)type->tp_alloc(type, 0);
+        if (!self)
+                return NULL;
+
+        if (initBudget(&self->budget, maxNodes, timeout) != 0) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                Py_DECREF(self);
+                return NULL;
+        }
+        self->isInitialized = true;
+        self->isBusy = false;
+
+        return (PyObject *)self;
+}
+
+static void
+Budget_dealloc(BudgetObject *self)
+{
+        PyTypeObject *type = Py_TYPE(self);
+
+        if (self->isInitialized)
+                freeBudget(&self->budget);
+
+        type->tp_free(self);
+        Py_DECREF(type);
+}
+
+PyDoc_STRVAR(Budget_cancel_doc,
+        "cancel()\n"
+        "\n"
+        "Stop the running call as soon as possible, and all later ones.\n"
+        "Can be called from any thread."
+);
+
+static PyObject *
+Budget_cancel(BudgetObject *self, PyObject *unused)
+{
+        cancelBudget(&self->budget);
+        Py_RETURN_NONE;
+}
+
+static PyObject *
+Budget_exhausted(BudgetObject *self, void *closure)
+{
+        return PyBool_FromLong(getBudgetStop(&self->budget) != budgetRunning);
+}
+
+static PyObject *
+Budget_reason(BudgetObject *self, void *closure)
+{
+        switch (getBudgetStop(&self->budget)) {
+        case budgetNodesUsed:   return PyUnicode_FromString("nodes");
+        case budgetTimeUp:      return PyUnicode_FromString("time");
+        case budgetCancelled:   return PyUnicode_FromString("cancelled");
+        default:                Py_RETURN_NONE;
+        }
+}
+
+static PyObject *
+Budget_nodes(BudgetObject *self, void *closure)
+{
+        unsigned long long nodes;
+        pthread_mutex_lock(&self->budget.lock);
+        nodes = self->budget.nodes;
+        pthread_mutex_unlock(&self->budget.lock);
+        return PyLong_FromUnsignedLongLong(nodes);
+}
+
+static PyObject *
+Budget_cancelled(BudgetObject *self, void *closure)
+{
+        return PyBool_FromLong(isBudgetCancelled(&self->budget));
+}
+
+static PyMethodDef Budget_methods[] = {
+        { "cancel", (PyCFunction)Budget_cancel, METH_NOARGS, Budget_cancel_doc },
+        { NULL, }
+};
+
+static PyGetSetDef Budget_getset[] = {
+        { "exhausted", (getter)Budget_exhausted, NULL, "True if the last call stopped early", NULL },
+        { "reason",    (getter)Budget_reason,    NULL, "Why the last call stopped early: 'nodes', 'time', 'cancelled' or None", NULL },
+        { "nodes",     (getter)Budget_nodes,     NULL, "Nodes counted by the last call", NULL },
+        { "cancelled", (getter)Budget_cancelled, NULL, "True after cancel()", NULL },
+        { NULL, }
+};
+
+static PyType_Slot Budget_slots[] = {
+        { Py_tp_doc,        (void *)Budget_doc },
+        { Py_tp_new,        (void *)(uintptr_t)Budget_new },
+        { Py_tp_dealloc,    (void *)(uintptr_t)Budget_dealloc },
+        { Py_tp_methods,    Budget_methods },
+        { Py_tp_getset,     Budget_getset },
+        { 0, NULL }
+};
+
+static PyType_Spec Budget_spec = {
+        .name      = "chessmoves.Budget",
+        .basicsize = sizeof(BudgetObject),
+        .flags     = Py_TPFLAGS_DEFAULT,
+        .slots     = Budget_slots,
+};
+
+/*
+ *  Take the budget argument of a call, which can be absent or None, and
+ *  start it. Return 0 on success, or -1 with an exception set. The call
+ *  must give it back with putBudget() when it is done.
+ */
+static int getBudget(struct moduleState *state, PyObject *object, BudgetObject **budget)
+{
+        *budget = NULL;
+        if (!object || object == Py_None)
+                return 0;
+
+        if (!PyObject_TypeCheck(object, (PyTypeObject *)state->budgetType)) {
+                PyErr_Format(PyExc_TypeError, "budget must be a Budget, not %.200s", Py_TYPE(object)->tp_name);
+                return -1;
+        }
+
+        BudgetObject *self = (BudgetObject *)object;
+        if (self->isBusy) {
+                PyErr_Format(PyExc_RuntimeError, "budget is in use by another call");
+                return -1;
+        }
+
+        self->isBusy = true;
+        startBudget(&self->budget);
+        *budget = self;
+        return 0;
+}
+
+static void putBudget(BudgetObject *budget)
+{
+        if (budget)
+                budget->isBusy = false;
+}
+
+// The budget for the C functions
+#define budgetOf(budget) ((budget) ? &(budget)->budget : NULL)
+
+/*----------------------------------------------------------------------+
+ |      perft(...)                                                      |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(perft_doc,
+        "perft(fen, depth, budget=None) -> count\n"
+        "\n"
+        "Count the legal move paths of the given length from a position.\n"
+        "The depth is at most 13, as deeper counts overflow.\n"
+        "With a budget, the count is partial when the budget is exhausted.\n"
+        "Every move that is made counts as a node."
+);
+
+static PyObject *
+chessmovesmodule_perft(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->fenKeyword, state->depthKeyword, state->budgetKeyword };
+        PyObject *values[3];
+
+        if (parseArguments("perft", args, nargs, kwnames, keywords, 3, 2, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        long depth = PyLong_AsLong(values[1]);
+        if (depth == -1 && PyErr_Occurred())
+                return NULL;
+        if (depth < 0 || depth > maxPerftDepth)
+                return PyErr_Format(PyExc_ValueError, "depth must be between 0 and %d", maxPerftDepth);
+
+        struct board board;
+        if (setupBoard(&board, fen) <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        BudgetObject *budget;
+        if (getBudget(state, values[2], &budget))
+                return NULL;
+
+        unsigned long long count;
+        Py_BEGIN_ALLOW_THREADS
+        count = perftWithBudget(&board, depth, budgetOf(budget));
+        Py_END_ALLOW_THREADS
+
+        putBudget(budget);
+        freeBoard(&board); // deep counts can use the undo heap
+        return PyLong_FromUnsignedLongLong(count);
+}
+
+/*----------------------------------------------------------------------+
+ |      mate_in(...)                                                    |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(mate_in_doc,
+        "mate_in(fen, n, notation='san', budget=None) -> [move, ...] or None\n"
+        "\n"
+        "Search for a forced mate by the side to move in at most n moves.\n"
+        "Return the main line of the shortest mate, with the longest defence,\n"
+        "or None if there is no such mate. The mate is in (len(line)+1)//2 moves.\n"
+        "n can be at most 8.\n"
+        "\n"
+        "With a Budget, the search can stop early. It then returns None, and\n"
+        "the budget is exhausted.\n"
+        "\n"
+        "The `notation' keyword controls the output move syntax. See moves(...)\n"
+        "for details."
+);
+
+static PyObject *
+chessmovesmodule_mate_in(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fenKeyword, state->nKeyword, state->notationKeyword, state->budgetKeyword
+        };
+        PyObject *values[4];
+
+        if (parseArguments("mate_in", args, nargs, kwnames, keywords, 4, 2, values))
+                return NULL;
+
+        const char *fen = getString(values[0], "fen");
+        if (!fen)
+                return NULL;
+
+        int depth = getMateDepth(values[1]);
+        if (depth < 0)
+                return NULL;
+
+        int notationIndex = getNotation(state, values[2]);
+        if (notationIndex < 0)
+                return NULL;
+
+        struct board board;
+        int len = setupBoard(&board, fen);
+        if (len <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        struct mateSolver solver;
+        if (initMateSolver(&solver, defaultMateTableSize) != 0)
+                return PyErr_NoMemory();
+
+        BudgetObject *budget;
+        if (getBudget(state, values[3], &budget)) {
+                freeMateSolver(&solver);
+                return NULL;
+        }
+        solver.budget = budgetOf(budget);
+
+        int pv[maxMatePlies];
+        int mate;
+        Py_BEGIN_ALLOW_THREADS
+        mate = solveMate(&solver, &board, depth, pv);
+        Py_END_ALLOW_THREADS
+
+        putBudget(budget);
+        freeMateSolver(&solver);
+
+        if (mate <= 0)
+                Py_RETURN_NONE;
+
+        return variationToList(&board, notationIndex, pv, 2 * mate - 1);
+}
+
+/*----------------------------------------------------------------------+
+ |      mate_in_batch(...)                                              |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(mate_in_batch_doc,
+        "mate_in_batch(fens, n, notation='san', threads=0, budget=None) -> [result, ...]\n"
+        "\n"
+        "Run mate_in(...) for a sequence of positions and return the results\n"
+        "in the same order. The positions are solved in parallel on the given\n"
+        "number of threads, at most 1024, or on all processors if threads is 0.\n"
+        "\n"
+        "The threads share the budget. Positions that aren't solved when it is\n"
+        "exhausted get None."
+);
+
+static PyObject *
+chessmovesmodule_mate_in_batch(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fensKeyword, state->nKeyword, state->notationKeyword, state->threadsKeyword,
+                state->budgetKeyword
+        };
+        PyObject *values[5];
+
+        if (parseArguments("mate_in_batch", args, nargs, kwnames, keywords, 5, 2, values))
+                return NULL;
+
+        int depth = getMateDepth(values[1]);
+        if (depth < 0)
+                return NULL;
+
+        int notationIndex = getNotation(state, values[2]);
+        if (notationIndex < 0)
+                return NULL;
+
+        int nrThreads;
+        if (getThreads(values[3], &nrThreads))
+                return NULL;
+
+        PyObject *fens = PySequence_Fast(values[0], "fens must be a sequence");
+        if (!fens)
+                return NULL;
+
+        Py_ssize_t nrProblems = PySequence_Fast_GET_SIZE(fens);
+        if (nrProblems > INT_MAX) {
+                Py_DECREF(fens);
+                return PyErr_Format(PyExc_OverflowError, "Too many positions");
+        }
+
+        struct mateProblem *problems = PyMem_Malloc((nrProblems ? nrProblems : 1) * sizeof *problems);
+        if (!problems) {
+                Py_DECREF(fens);
+                return PyErr_NoMemory();
+        }
+
+        PyObject *list = NULL;
+
+        for (Py_ssize_t i=0; i<nrProblems; i++) {
+                const char *fen = getString(PySequence_Fast_GET_ITEM(fens, i), "fen");
+                if (!fen)
+                        goto cleanup;
+                if (setupBoard(&problems[i].board, fen) <= 0) {
+                        PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+                        goto cleanup;
+                }
+        }
+
+        BudgetObject *budget;
+        if (getBudget(state, values[4], &budget))
+                goto cleanup;
+
+        int result;
+        Py_BEGIN_ALLOW_THREADS
+        result = solveMates(problems, nrProblems, depth, nrThreads, defaultMateTableSize, budgetOf(budget));
+        Py_END_ALLOW_THREADS
+
+        putBudget(budget);
+
+        if (result != 0) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                goto cleanup;
+        }
+
+        list = PyList_New(nrProblems);
+        if (!list)
+                goto cleanup;
+
+        for (Py_ssize_t i=0; i<nrProblems; i++) {
+                struct mateProblem *problem = &problems[i];
+                PyObject *item;
+                if (problem->mate > 0)
+                        item = variationToList(&problem->board, notationIndex, problem->pv, 2 * problem->mate - 1);
+                else {
+                        item = Py_None;
+                        Py_INCREF(item);
+                }
+                if (!item) {
+                        Py_CLEAR(list);
+                        goto cleanup;
+                }
+                PyList_SET_ITEM(list, i, item);
+        }
+
+cleanup:
+        PyMem_Free(problems);
+        Py_DECREF(fens);
+        return list;
+}
+
+/*----------------------------------------------------------------------+
+ |      playouts(...)                                                   |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(playouts_doc,
+        "playouts(count, fen=startPosition, seed=0, max_plies=400, weights=None,\n"
+        "         output='moves', notation='san', threads=0, budget=None) -> [game, ...]\n"
+        "\n"
+        "Play random games of legal moves from a position, until checkmate,\n"
+        "stalemate, insufficient material or max_plies (at most 1024).\n"
+        "\n"
+        "Game i, counting from 1, only depends on the seed and i, so results\n"
+        "are reproducible for any number of threads. The games are played in\n"
+        "parallel on the given number of threads, at most 1024, or on all\n"
+        "processors if threads is 0.\n"
+        "\n"
+        "The `weights' keyword gives relative weights for choosing quiet moves,\n"
+        "captures, promotions and checks, as a sequence of 4 integers from 0\n"
+        "to 65535. A move is weighted by the last class it belongs to. The\n"
+        "default is a uniform choice.\n"
+        "\n"
+        "The `output' keyword selects what is returned for each game:\n"
+        "    'moves': a tuple of the list of moves and the result (e.g. '1-0' or '*')\n"
+        "    'fens': the list of positions, from the start to the end\n"
+        "    'hashes': the list of hashes of these positions\n"
+        "    'samples': one random position from the game\n"
+        "\n"
+        "The `notation' keyword controls the output move syntax. See moves(...)\n"
+        "for details.\n"
+        "\n"
+        "With a Budget, every played position counts as a node. When it is\n"
+        "exhausted no new games are started, and the list only has the first\n"
+        "games."
+);
+
+// Convert a game to the requested output object, playing it on a copy of the start position
+static PyObject *playGameToObject(Board_t board, Board_t start, const struct game *game, int outputIndex, int notationIndex)
+{
+        char fen[maxFenSize];
+        PyObject *list;
+
+        switch (outputIndex) {
+        case movesOutput:
+                list = PyList_New(game->nrPlies);
+                if (!list)
+                        return NULL;
+                for (int i=0; i<game->nrPlies; i++) {
+                        PyObject *item = moveToObject(board, notationIndex, game->moves[i]);
+                        if (!item) {
+                                Py_DECREF(list);
+                                return NULL;
+                        }
+                        PyList_SET_ITEM(list, i, item);
+                        makeMove(board, game->moves[i]);
+                }
+                return Py_BuildValue("(Ns)", list, gameResult(game, start));
+
+        case fensOutput:
+                list = PyList_New(game->nrPlies + 1);
+                if (!list)
+                        return NULL;
+                for (int i=0; i<=game->nrPlies; i++) {
+                        if (i > 0)
+                                makeMove(board, game->moves[i-1]);
+                        boardToFen(board, fen);
+                        PyObject *item = PyUnicode_FromString(fen);
+                        if (!item) {
+                                Py_DECREF(list);
+                                return NULL;
+                        }
+                        PyList_SET_ITEM(list, i, item);
+                }
+                return list;
+
+        case hashesOutput:
+                list = PyList_New(game->nrPlies + 1);
+                if (!list)
+                        return NULL;
+                for (int i=0; i<=game->nrPlies; i++) {
+                        if (i > 0)
+                                makeMove(board, game->moves[i-1]);
+                        PyObject *item = PyLong_FromUnsignedLongLong(hash64(board));
+                        if (!item) {
+                                Py_DECREF(list);
+                                return NULL;
+                        }
+                        PyList_SET_ITEM(list, i, item);
+                }
+                return list;
+
+        case samplesOutput:
+                for (int i=0; i<game->samplePly; i++)
+                        makeMove(board, game->moves[i]);
+                boardToFen(board, fen);
+                return PyUnicode_FromString(fen);
+
+        default:
+                assert(0);
+                return NULL;
+        }
+}
+
+static PyObject *gameToObject(Board_t start, const struct game *game, int outputIndex, int notationIndex)
+{
+        struct board board = *start;
+        PyObject *result = playGameToObject(&board, start, game, outputIndex, notationIndex);
+        freeBoard(&board);
+        return result;
+}
+
+static PyObject *
+chessmovesmodule_playouts(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->countKeyword, state->fenKeyword, state->seedKeyword, state->maxPliesKeyword,
+                state->weightsKeyword, state->outputKeyword, state->notationKeyword, state->threadsKeyword,
+                state->budgetKeyword
+        };
+        PyObject *values[9];
+
+        if (parseArguments("playouts", args, nargs, kwnames, keywords, 9, 1, values))
+                return NULL;
+
+        Py_ssize_t count = PyLong_AsSsize_t(values[0]);
+        if (count == -1 && PyErr_Occurred())
+                return NULL;
+        if (count < 0)
+                return PyErr_Format(PyExc_ValueError, "count must not be negative");
+
+        const char *fen = values[1] ? getString(values[1], "fen") : startpos;
+        if (!fen)
+                return NULL;
+
+        struct playoutOptions options = {
+                .seed = 0,
+                .maxPlies = 400,
+                .weights = { 1, 1, 1, 1 },
+                .perftDepth = 0,
+                .budget = NULL
+        };
+
+        if (values[2]) {
+                options.seed = PyLong_AsUnsignedLongLongMask(values[2]);
+                if (options.seed == (unsigned long long)-1 && PyErr_Occurred())
+                        return NULL;
+        }
+
+        if (values[3]) {
+                options.maxPlies = PyLong_AsLong(values[3]);
+                if (options.maxPlies == -1 && PyErr_Occurred())
+                        return NULL;
+                if (options.maxPlies < 0 || options.maxPlies > maxGamePlies)
+                        return PyErr_Format(PyExc_ValueError, "max_plies must be between 0 and %d", maxGamePlies);
+        }
+
+        if (values[4] && values[4] != Py_None) {
+                PyObject *weights = PySequence_Fast(values[4], "weights must be a sequence");
+                if (!weights)
+                        return NULL;
+                if (PySequence_Fast_GET_SIZE(weights) != nrMoveClasses) {
+                        Py_DECREF(weights);
+                        return PyErr_Format(PyExc_ValueError, "weights must have %d elements", nrMoveClasses);
+                }
+                for (int i=0; i<nrMoveClasses; i++) {
+                        long weight = PyLong_AsLong(PySequence_Fast_GET_ITEM(weights, i));
+                        if (weight == -1 && PyErr_Occurred()) {
+                                Py_DECREF(weights);
+                                return NULL;
+                        }
+                        if (weight < 0 || weight > maxMoveWeight) {
+                                Py_DECREF(weights);
+                                return PyErr_Format(PyExc_ValueError, "weights must be between 0 and %d", maxMoveWeight);
+                        }
+                        options.weights[i] = weight;
+                }
+                Py_DECREF(weights);
+        }
+
+        int outputIndex = getOutput(state, values[5], playoutOutputs);
+        if (outputIndex < 0)
+                return NULL;
+
+        int notationIndex = getNotation(state, values[6]);
+        if (notationIndex < 0)
+                return NULL;
+
+        int nrThreads;
+        if (getThreads(values[7], &nrThreads))
+                return NULL;
+
+        struct board start;
+        if (setupBoard(&start, fen) <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        enum { blockSize = 1024 };
+        struct game *games = PyMem_Malloc(blockSize * sizeof *games);
+        if (!games)
+                return PyErr_NoMemory();
+
+        PyObject *list = PyList_New(count);
+        if (!list) {
+                PyMem_Free(games);
+                return NULL;
+        }
+
+        BudgetObject *budget;
+        if (getBudget(state, values[8], &budget)) {
+                Py_DECREF(list);
+                PyMem_Free(games);
+                return NULL;
+        }
+        options.budget = budgetOf(budget);
+
+        // Play in blocks, and convert each block before playing the next
+        for (Py_ssize_t first=0; first<count; first+=blockSize) {
+                int nrGames = (count - first < blockSize) ? count - first : blockSize;
+
+                int result;
+                Py_BEGIN_ALLOW_THREADS
+                result = playouts(&start, &options, first + 1, games, nrGames, nrThreads);
+                Py_END_ALLOW_THREADS
+
+                if (result < 0) {
+                        PyErr_SetFromErrno(PyExc_OSError);
+                        Py_CLEAR(list);
+                        break;
+                }
+
+                for (int i=0; i<result; i++) {
+                        PyObject *item = gameToObject(&start, &games[i], outputIndex, notationIndex);
+                        if (!item) {
+                                Py_CLEAR(list);
+                                break;
+                        }
+                        PyList_SET_ITEM(list, first + i, item);
+                }
+                if (!list)
+                        break;
+
+                if (result < nrGames) {
+                        // The budget is exhausted: drop the games that weren't played
+                        if (PyList_SetSlice(list, first + result, count, NULL))
+                                Py_CLEAR(list);
+                        break;
+                }
+        }
+
+        putBudget(budget);
+        PyMem_Free(games);
+        return list;
+}
+
+/*----------------------------------------------------------------------+
+ |      encode_planes(...)                                              |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(encode_planes_doc,
+        "encode_planes(fens, out, flip=False, threads=0) -> count\n"
+        "\n"
+        "Encode positions as input planes for a neural network, and write them\n"
+        "into `out', a writable contiguous buffer of unsigned bytes ('B') or\n"
+        "floats ('f'), such as a bytearray, an array.array or a numpy array.\n"
+        "Each position takes planesPerPosition planes of 64 values, 0 or 1,\n"
+        "indexed by 8*rank+file from a1 to h8:\n"
+        "    0-5:   white king, queen, rook, bishop, knight, pawn\n"
+        "    6-11:  the same for black\n"
+        "    12:    white to move\n"
+        "    13-16: castling rights K, Q, k, q\n"
+        "    17:    the en passant target square, if there is a legal capture\n"
+        "\n"
+        "`fens' is a sequence of FENs, or a bytes-like object with one FEN per\n"
+        "line. Move counters are ignored. With flip=True, positions with black\n"
+        "to move are seen from black's side: the ranks are reversed and the\n"
+        "colors swapped, except in plane 12.\n"
+        "\n"
+        "The positions are encoded in parallel on the given number of threads,\n"
+        "at most 1024, or on all processors if threads is 0. Return the number\n"
+        "of positions.\n"
+        "Raise ValueError for the first invalid FEN, after encoding the others."
+);
+
+/*
+ *  Make a list of FENs from a sequence or from a bytes-like object of lines.
+ *  Return the number of FENs, or -1 with an exception set. On success the
+ *  caller frees *fens, and *lines and *strings if set.
+ */
+static Py_ssize_t getFens(PyObject *object, const char ***fens, char **lines, PyObject **strings)
+{
+        *fens = NULL;
+        *lines = NULL;
+        *strings = NULL;
+
+        if (!PyUnicode_Check(object) && PyObject_CheckBuffer(object)) {
+                Py_buffer buffer;
+                if (PyObject_GetBuffer(object, &buffer, PyBUF_SIMPLE) != 0)
+                        return -1;
+
+                // Copy and split into strings, so that the parser doesn't run into the next line
+                char *text = PyMem_Malloc(buffer.len + 1);
+                if (!text) {
+                        PyBuffer_Release(&buffer);
+                        PyErr_NoMemory();
+                        return -1;
+                }
+                memcpy(text, buffer.buf, buffer.len);
+                Py_ssize_t len = buffer.len;
+                PyBuffer_Release(&buffer);
+                if (len > 0 && text[len-1] == '\n')
+                        len--; // no empty line after the last newline
+                text[len] = '\0';
+
+                Py_ssize_t n = 1;
+                for (Py_ssize_t i=0; i<len; i++)
+                        if (text[i] == '\n')
+                                n++;
+                if (len == 0)
+                        n = 0;
+
+                const char **list = PyMem_Malloc((n ? n : 1) * sizeof *list);
+                if (!list) {
+                        PyMem_Free(text);
+                        PyErr_NoMemory();
+                        return -1;
+                }
+                if (n > 0) {
+                        Py_ssize_t j = 0;
+                        list[j++] = text;
+                        for (Py_ssize_t i=0; i<len; i++)
+                                if (text[i] == '\n') {
+                                        text[i] = '\0';
+                                        list[j++] = &text[i+1];
+                                }
+                }
+
+                *fens = list;
+                *lines = text;
+                return n;
+        }
+
+        // A tuple keeps the strings alive while the GIL is released
+        PyObject *tuple = PySequence_Tuple(object);
+        if (!tuple)
+                return -1;
+
+        Py_ssize_t n = PyTuple_GET_SIZE(tuple);
+        const char **list = PyMem_Malloc((n ? n : 1) * sizeof *list);
+        if (!list) {
+                Py_DECREF(tuple);
+                PyErr_NoMemory();
+                return -1;
+        }
+        for (Py_ssize_t i=0; i<n; i++) {
+                list[i] = getString(PyTuple_GET_ITEM(tuple, i), "fen");
+                if (!list[i]) {
+                        PyMem_Free(list);
+                        Py_DECREF(tuple);
+                        return -1;
+                }
+        }
+
+        *fens = list;
+        *strings = tuple;
+        return n;
+}
+
+/*
+ *  Get a writable output buffer whose format is one of the given struct
+ *  characters. Return the character, or -1 with an exception set.
+ */
+static int getOut(PyObject *object, Py_buffer *out, const char *formats, const char *what)
+{
+        if (PyObject_GetBuffer(object, out, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+                return -1;
+
+        const char *format = out->format ? out->format : "B";
+        if (*format == '@' || *format == '=')
+                format++;
+
+        int itemSizes[128] = {
+                ['B'] = 1, ['f'] = sizeof(float), ['h'] = sizeof(short),
+                ['L'] = sizeof(unsigned long), ['Q'] = sizeof(unsigned long long)
+        };
+        if (strlen(format) != 1 || !strchr(formats, *format) || out->itemsize != itemSizes[*format & 127]) {
+                PyErr_Format(PyExc_TypeError, "out must hold %s, not '%s'", what, out->format ? out->format : "B");
+                PyBuffer_Release(out);
+                return -1;
+        }
+        return *format;
+}
+
+// Encoder of many positions, such as encodePlanes()
+typedef long batchEncoder(const char *const fens[], long nrFens, void *out, int flags, int nrThreads);
+
+/*
+ *  Encode the FENs into the output buffer, which must have room for
+ *  positionSize bytes per position, without holding the GIL. Release
+ *  the buffer and return the number of positions, or NULL with an
+ *  exception set.
+ */
+static PyObject *encodeFens(PyObject *fensObject, Py_buffer *out, Py_ssize_t positionSize,
+                            batchEncoder *encoder, int flags, int nrThreads)
+{
+        const char **fens;
+        char *lines;
+        PyObject *strings;
+        Py_ssize_t nrFens = getFens(fensObject, &fens, &lines, &strings);
+        if (nrFens < 0) {
+                PyBuffer_Release(out);
+                return NULL;
+        }
+
+        PyObject *result = NULL;
+
+        if (out->len / positionSize < nrFens) {
+                PyErr_Format(PyExc_ValueError, "out is too small for %zd positions (%zd bytes, need %zd)",
+                             nrFens, out->len, nrFens * positionSize);
+                goto cleanup;
+        }
+
+        long firstInvalid;
+        Py_BEGIN_ALLOW_THREADS
+        firstInvalid = encoder(fens, nrFens, out->buf, flags, nrThreads);
+        Py_END_ALLOW_THREADS
+
+        if (firstInvalid < 0)
+                PyErr_SetFromErrno(PyExc_OSError);
+        else if (firstInvalid < nrFens)
+                PyErr_Format(PyExc_ValueError, "Invalid FEN (%s) at index %ld", fens[firstInvalid], firstInvalid);
+        else
+                result = PyLong_FromSsize_t(nrFens);
+
+cleanup:
+        PyMem_Free(fens);
+        PyMem_Free(lines);
+        Py_XDECREF(strings);
+        PyBuffer_Release(out);
+        return result;
+}
+
+// Get an optional flag argument. Return 0 or the flag, or -1 with an exception set.
+static int getFlag(PyObject *object, int flag)
+{
+        if (!object)
+                return 0;
+        int isTrue = PyObject_IsTrue(object);
+        return (isTrue < 0) ? -1 : isTrue ? flag : 0;
+}
+
+static PyObject *
+chessmovesmodule_encode_planes(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fensKeyword, state->outKeyword, state->flipKeyword, state->threadsKeyword
+        };
+        PyObject *values[4];
+
+        if (parseArguments("encode_planes", args, nargs, kwnames, keywords, 4, 2, values))
+                return NULL;
+
+        int flags = getFlag(values[2], planesFlip);
+        if (flags < 0)
+                return NULL;
+
+        int nrThreads;
+        if (getThreads(values[3], &nrThreads))
+                return NULL;
+
+        Py_buffer out;
+        int format = getOut(values[1], &out, "Bf", "unsigned bytes or floats");
+        if (format < 0)
+                return NULL;
+        if (format == 'f')
+                flags |= planesFloat;
+
+        return encodeFens(values[0], &out, planesSize * out.itemsize, encodePlanes, flags, nrThreads);
+}
+
+/*----------------------------------------------------------------------+
+ |      policy_index(...)                                               |
+ +----------------------------------------------------------------------*/
+
+#define fileToChar(file)        ('a' + (fileB - fileA) * ((file) - fileA))
+#define charToFile(c)           (fileA + (fileB - fileA) * ((c) - 'a'))
+#define rankToChar(rank)        ('1' + (rank2 - rank1) * ((rank) - rank1))
+#define charToRank(c)           (rank1 + (rank2 - rank1) * ((c) - '1'))
+
+PyDoc_STRVAR(policy_index_doc,
+        "policy_index(move, flip=False) -> index\n"
+        "\n"
+        "Map a move in UCI notation (e.g. e2e4, d7e8n) to its index in the\n"
+        "policySize outputs of a policy network. There are 73 planes of 64\n"
+        "origin squares, indexed 64*plane+square with squares as in\n"
+        "encode_planes(...):\n"
+        "    0-55:  queen moves: 8 directions clockwise from north, times\n"
+        "           distances 1 to 7\n"
+        "    56-63: knight moves, clockwise from north-north-east\n"
+        "    64-72: underpromotions to knight, bishop, rook, times the\n"
+        "           directions towards the a-file, straight, towards the h-file\n"
+        "\n"
+        "Queen promotions and castling (as the king's move) take the index\n"
+        "of the plain move. With flip=True the ranks are mirrored, for black's\n"
+        "moves in positions encoded with flip=True."
+);
+
+static PyObject *
+chessmovesmodule_policy_index(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->moveKeyword, state->flipKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("policy_index", args, nargs, kwnames, keywords, 2, 1, values))
+                return NULL;
+
+        const char *moveString = getString(values[0], "move");
+        if (!moveString)
+                return NULL;
+
+        int flip = getFlag(values[1], 1);
+        if (flip < 0)
+                return NULL;
+
+        size_t len = strlen(moveString);
+        bool isValid = (len == 4 || (len == 5 && strchr("qrbn", moveString[4])));
+        for (size_t i=0; i<4 && isValid; i++)
+                isValid = (i % 2 == 0) ? ('a' <= moveString[i] && moveString[i] <= 'h')
+                                       : ('1' <= moveString[i] && moveString[i] <= '8');
+        if (!isValid)
+                return PyErr_Format(PyExc_ValueError, "Invalid move syntax (%s)", moveString);
+
+        int move = move(square(charToFile(moveString[0]), charToRank(moveString[1])),
+                        square(charToFile(moveString[2]), charToRank(moveString[3])));
+        switch (moveString[4]) {
+        case 'q': move |= specialMoveFlag | queenPromotionFlags; break;
+        case 'r': move |= specialMoveFlag | rookPromotionFlags; break;
+        case 'b': move |= specialMoveFlag | bishopPromotionFlags; break;
+        case 'n': move |= specialMoveFlag | knightPromotionFlags; break;
+        }
+
+        int index = moveToPolicyIndex(move, flip);
+        if (index < 0)
+                return PyErr_Format(PyExc_ValueError, "Impossible move (%s)", moveString);
+
+        return PyLong_FromLong(index);
+}
+
+/*----------------------------------------------------------------------+
+ |      policy_move(...)                                                |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(policy_move_doc,
+        "policy_move(index, flip=False) -> move\n"
+        "\n"
+        "Map a policy index back to a move in UCI notation, or return None if\n"
+        "it leaves the board. Queen promotions come back without the suffix.\n"
+        "See policy_index(...) for details."
+);
+
+static PyObject *
+chessmovesmodule_policy_move(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->indexKeyword, state->flipKeyword };
+        PyObject *values[2];
+
+        if (parseArguments("policy_move", args, nargs, kwnames, keywords, 2, 1, values))
+                return NULL;
+
+        long index = PyLong_AsLong(values[0]);
+        if (index == -1 && PyErr_Occurred())
+                return NULL;
+        if (index < 0 || index >= policySize)
+                return PyErr_Format(PyExc_ValueError, "Policy index out of range (%ld)", index);
+
+        int flip = getFlag(values[1], 1);
+        if (flip < 0)
+                return NULL;
+
+        int move = policyIndexToMove(index, flip);
+        if (move < 0)
+                Py_RETURN_NONE;
+
+        int from = from(move), to = to(move);
+        char moveString[maxMoveSize] = {
+                fileToChar(file(from)), rankToChar(rank(from)),
+                fileToChar(file(to)), rankToChar(rank(to))
+        };
+        if (move & specialMoveFlag)
+                moveString[4] = "qrbn"[(move >> promotionBits) & 3];
+
+        return PyUnicode_FromString(moveString);
+}
+
+/*----------------------------------------------------------------------+
+ |      encode_policy(...)                                              |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(encode_policy_doc,
+        "encode_policy(fens, out, indices=False, flip=False, threads=0) -> count\n"
+        "\n"
+        "Write the legal moves of positions into `out', as masks over the\n"
+        "policySize indices of policy_index(...), for example to mask the\n"
+        "outputs of a policy network. A mask is a writable contiguous buffer of\n"
+        "unsigned bytes ('B') or floats ('f'), with 1 for the legal moves. With\n"
+        "indices=True, the buffer holds signed shorts ('h') instead: maxMoves\n"
+        "per position, the policy indices of the legal moves in generation\n"
+        "order followed by -1.\n"
+        "\n"
+        "The other arguments and the result are as for encode_planes(...).\n"
+        "With flip=True the moves of black are seen from black's side, as the\n"
+        "planes with flip=True are."
+);
+
+static PyObject *
+chessmovesmodule_encode_policy(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fensKeyword, state->outKeyword, state->indicesKeyword, state->flipKeyword,
+                state->threadsKeyword
+        };
+        PyObject *values[5];
+
+        if (parseArguments("encode_policy", args, nargs, kwnames, keywords, 5, 2, values))
+                return NULL;
+
+        int indices = getFlag(values[2], policyIndices);
+        int flip = getFlag(values[3], policyFlip);
+        if (indices < 0 || flip < 0)
+                return NULL;
+        int flags = indices | flip;
+
+        int nrThreads;
+        if (getThreads(values[4], &nrThreads))
+                return NULL;
+
+        Py_buffer out;
+        Py_ssize_t positionSize;
+        if (indices) {
+                if (getOut(values[1], &out, "h", "signed shorts") < 0)
+                        return NULL;
+                positionSize = maxMoves * out.itemsize;
+        } else {
+                int format = getOut(values[1], &out, "Bf", "unsigned bytes or floats");
+                if (format < 0)
+                        return NULL;
+                if (format == 'f')
+                        flags |= policyFloat;
+                positionSize = policySize * out.itemsize;
+        }
+
+        return encodeFens(values[0], &out, positionSize, encodePolicy, flags, nrThreads);
+}
+
+/*----------------------------------------------------------------------+
+ |      count_moves(...)                                                |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(count_moves_doc,
+        "count_moves(fens, out, threads=0) -> count\n"
+        "\n"
+        "Count the legal moves of positions, and write two unsigned bytes per\n"
+        "position into `out': the number of legal moves, and 1 if the side to\n"
+        "move is in check or 0 if not. Checkmate gives 0 and 1, stalemate 0\n"
+        "and 0. The moves aren't generated one by one, which makes this much\n"
+        "faster than len(moves(fen)) for large sets of positions.\n"
+        "\n"
+        "Invalid FENs get 255 and 255. The other arguments and the result are\n"
+        "as for encode_planes(...)."
+);
+
+// Helper to fit countMoves() to encodeFens()
+static long countMovesOfFens(const char *const fens[], long nrFens, void *out, int flags, int nrThreads)
+{
+        (void) flags;
+        return countMoves(fens, nrFens, out, nrThreads);
+}
+
+static PyObject *
+chessmovesmodule_count_moves(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fensKeyword, state->outKeyword, state->threadsKeyword
+        };
+        PyObject *values[3];
+
+        if (parseArguments("count_moves", args, nargs, kwnames, keywords, 3, 2, values))
+                return NULL;
+
+        int nrThreads;
+        if (getThreads(values[2], &nrThreads))
+                return NULL;
+
+        Py_buffer out;
+        if (getOut(values[1], &out, "B", "unsigned bytes") < 0)
+                return NULL;
+
+        return encodeFens(values[0], &out, moveCountSize, countMovesOfFens, 0, nrThreads);
+}
+
+/*----------------------------------------------------------------------+
+ |      hash_keys(...)                                                  |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(hash_keys_doc,
+        "hash_keys(fens, out, keys='hash', threads=0) -> count\n"
+        "\n"
+        "Compute hash keys of positions, and write them into `out', a writable\n"
+        "contiguous buffer of unsigned 64-bit integers ('Q', or 'L' where that\n"
+        "has 64 bits), such as an array.array('Q') or a numpy uint64 array.\n"
+        "`keys' names one key or a sequence of keys to compute. Each position\n"
+        "takes one value per key, in this order:\n"
+        "    'hash':     the Zobrist-Polyglot hash, as hash(...)\n"
+        "    'second':   an independent 64-bit key, that makes a 128-bit\n"
+        "                fingerprint together with 'hash'\n"
+        "    'pawns':    the part of 'hash' for the pawns only\n"
+        "    'material': a key of the number of pieces of each kind\n"
+        "\n"
+        "The other arguments and the result are as for encode_planes(...).\n"
+        "Invalid FENs get keys of 0."
+);
+
+static const char *const hashKeyNames[nrHashKeyKinds] = { "hash", "second", "pawns", "material" };
+
+// Helper to get the flag of one key name. Return -1 with an exception set on failure.
+static int getHashKey(PyObject *object)
+{
+        const char *name = getString(object, "key");
+        if (!name)
+                return -1;
+        for (int i=0; i<nrHashKeyKinds; i++)
+                if (strcmp(name, hashKeyNames[i]) == 0)
+                        return 1 << i;
+        PyErr_Format(PyExc_ValueError, "Invalid key '%s'", name);
+        return -1;
+}
+
+// Get the key flags from a name or a sequence of names. Return -1 with an exception set on failure.
+static int getHashKeys(PyObject *object)
+{
+        if (!object)
+                return hashKeyPolyglot;
+        if (PyUnicode_Check(object))
+                return getHashKey(object);
+
+        PyObject *tuple = PySequence_Tuple(object);
+        if (!tuple)
+                return -1;
+        int flags = 0;
+        for (Py_ssize_t i=0; i<PyTuple_GET_SIZE(tuple); i++) {
+                int flag = getHashKey(PyTuple_GET_ITEM(tuple, i));
+                if (flag < 0) {
+                        Py_DECREF(tuple);
+                        return -1;
+                }
+                flags |= flag;
+        }
+        Py_DECREF(tuple);
+
+        if (flags == 0) {
+                PyErr_SetString(PyExc_ValueError, "No keys");
+                return -1;
+        }
+        return flags;
+}
+
+static PyObject *
+chessmovesmodule_hash_keys(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->fensKeyword, state->outKeyword, state->keysKeyword, state->threadsKeyword
+        };
+        PyObject *values[4];
+
+        if (parseArguments("hash_keys", args, nargs, kwnames, keywords, 4, 2, values))
+                return NULL;
+
+        int flags = getHashKeys(values[2]);
+        if (flags < 0)
+                return NULL;
+
+        int nrThreads;
+        if (getThreads(values[3], &nrThreads))
+                return NULL;
+
+        int nrKeys = 0;
+        for (int i=0; i<nrHashKeyKinds; i++)
+                nrKeys += (flags >> i) & 1;
+
+        Py_buffer out;
+        if (getOut(values[1], &out, "QL", "unsigned 64-bit integers") < 0)
+                return NULL;
+
+        return encodeFens(values[0], &out, nrKeys * out.itemsize, hashPositions, flags, nrThreads);
+}
+
+/*----------------------------------------------------------------------+
+ |      encode_game(...)                                                |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(encode_game_doc,
+        "encode_game(moves, fen=startPosition, entropy=False) -> bytes\n"
+        "\n"
+        "Compress a game into a record that stores each ply as the index of\n"
+        "its move in a fixed order of the legal moves, with likely moves first.\n"
+        "The moves are given as for play(...). An index takes one byte, or with\n"
+        "entropy=True, a few bits on average from a static model that favors\n"
+        "the first moves of the order. Records can be concatenated, and read\n"
+        "back with decode_games(...) with the same fen and entropy.\n"
+        "\n"
+        "Raise ValueError for the first move that is invalid, illegal or\n"
+        "ambiguous."
+);
+
+static PyObject *
+chessmovesmodule_encode_game(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = { state->movesKeyword, state->fenKeyword, state->entropyKeyword };
+        PyObject *values[3];
+
+        if (parseArguments("encode_game", args, nargs, kwnames, keywords, 3, 1, values))
+                return NULL;
+
+        const char *fen = values[1] ? getString(values[1], "fen") : startpos;
+        if (!fen)
+                return NULL;
+
+        int flags = getFlag(values[2], gameCodecEntropy);
+        if (flags < 0)
+                return NULL;
+
+        PyObject *sequence;
+        if (PyUnicode_Check(values[0]) || PyBytes_Check(values[0]))
+                sequence = PyObject_CallMethod(values[0], "split", NULL);
+        else
+                sequence = PySequence_Fast(values[0], "moves must be a string or a sequence");
+        if (!sequence)
+                return NULL;
+
+        struct board board;
+        if (setupBoard(&board, fen) <= 0) {
+                Py_DECREF(sequence);
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        }
+
+        PyObject *result = NULL;
+        Py_ssize_t nrPlies = PySequence_Fast_GET_SIZE(sequence);
+        unsigned char *record = PyMem_Malloc(maxGameRecordSize(nrPlies));
+        if (!record) {
+                PyErr_NoMemory();
+                goto cleanup;
+        }
+
+        struct gameWriter writer;
+        startGameRecord(&writer, record, nrPlies, flags);
+
+        for (Py_ssize_t i=0; i<nrPlies; i++) {
+                const char *moveString = getString(PySequence_Fast_GET_ITEM(sequence, i), "move");
+                if (!moveString)
+                        goto cleanup;
+
+                int moveList[maxMoves];
+                updateSideInfo(&board);
+                int nrMoves = generateMoves(&board, moveList);
+
+                int move;
+                if (parseMove(&board, moveString, moveList, nrMoves, &move) <= 0
+                 || writeGameMove(&writer, &board, move) != 0) {
+                        PyErr_Format(PyExc_ValueError, "Invalid move (%s) at ply %zd", moveString, i);
+                        goto cleanup;
+                }
+                makeMove(&board, move);
+        }
+
+        result = PyBytes_FromStringAndSize((char *)record, finishGameRecord(&writer));
+
+cleanup:
+        PyMem_Free(record);
+        freeBoard(&board);
+        Py_DECREF(sequence);
+        return result;
+}
+
+/*----------------------------------------------------------------------+
+ |      decode_games(...)                                               |
+ +----------------------------------------------------------------------*/
+
+PyDoc_STRVAR(decode_games_doc,
+        "decode_games(data, fen=startPosition, entropy=False, notation='san') -> [[move, ...], ...]\n"
+        "\n"
+        "Decompress the game records in a bytes-like object, as written by\n"
+        "encode_game(...) with the same fen and entropy, and return the moves\n"
+        "of each game. The `notation' keyword controls the output move syntax.\n"
+        "See moves(...) for details.\n"
+        "\n"
+        "Raise ValueError if the data is corrupt or ends within a record."
+);
+
+// Decode one record into a list of moves and advance over it, or return NULL with an exception set
+static PyObject *decodeGame(Board_t start, const unsigned char **data, size_t *size, int flags, int notationIndex)
+{
+        struct board board = *start;
+        struct gameReader reader;
+
+        long nrPlies = startGameRead(&reader, *data, *size, flags);
+        if (nrPlies < 0)
+                return PyErr_Format(PyExc_ValueError, "Truncated game record");
+
+        PyObject *list = PyList_New(0);
+        for (long i=0; list && i<nrPlies; i++) {
+                int moveList[maxMoves];
+                int nrMoves;
+                int move = readGameMove(&reader, &board, moveList, &nrMoves);
+                if (move < 0) {
+                        PyErr_Format(PyExc_ValueError, "Corrupt game record at ply %ld", i);
+                        Py_CLEAR(list);
+                        break;
+                }
+
+                PyObject *item = moveToObject(&board, notationIndex, move);
+                if (!item || PyList_Append(list, item) != 0)
+                        Py_CLEAR(list);
+                Py_XDECREF(item);
+                makeMove(&board, move);
+        }
+        freeBoard(&board);
+
+        if (list) {
+                size_t length = finishGameRead(&reader);
+                *data += length;
+                *size -= length;
+        }
+        return list;
+}
 
-                PyObject *key = PyString_FromString(moveString);
-                if (!key) {
-                        Py_DECREF(dict);
-                        return NULL;
-                }
+static PyObject *
+chessmovesmodule_decode_games(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+        struct moduleState *state = moduleState(self);
+        PyObject *const keywords[] = {
+                state->dataKeyword, state->fenKeyword, state->entropyKeyword, state->notationKeyword
+        };
+        PyObject *values[4];
 
-                PyObject *value = PyString_FromString(newFen);
-                if (!value) {
-                        Py_DECREF(dict);
-                        Py_DECREF(key);
-                        return NULL;
-                }
+        if (parseArguments("decode_games", args, nargs, kwnames, keywords, 4, 1, values))
+                return NULL;
 
-                if (PyDict_SetItem(dict, key, value)) {
-                        Py_DECREF(dict);
-                        Py_DECREF(key);
-                        Py_DECREF(value);
-                        return NULL;
-                }
+        const char *fen = values[1] ? getString(values[1], "fen") : startpos;
+        if (!fen)
+                return NULL;
 
-                Py_DECREF(key);
-                Py_DECREF(value);
+        int flags = getFlag(values[2], gameCodecEntropy);
+        if (flags < 0)
+                return NULL;
+
+        int notationIndex = getNotation(state, values[3]);
+        if (notationIndex < 0)
+                return NULL;
+
+        struct board start;
+        if (setupBoard(&start, fen) <= 0)
+                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+
+        Py_buffer buffer;
+        if (PyObject_GetBuffer(values[0], &buffer, PyBUF_SIMPLE) != 0)
+                return NULL;
+
+        const unsigned char *data = buffer.buf;
+        size_t size = buffer.len;
+
+        PyObject *games = PyList_New(0);
+        while (games && size > 0) {
+                PyObject *game = decodeGame(&start, &data, &size, flags, notationIndex);
+                if (!game || PyList_Append(games, game) != 0)
+                        Py_CLEAR(games);
+                Py_XDECREF(game);
         }
 
-	return dict;
+        PyBuffer_Release(&buffer);
+        return games;
 }
 
 /*----------------------------------------------------------------------+
- |      position(...)                                                   |
+ |      Bitbase type                                                    |
  +----------------------------------------------------------------------*/
 
-PyDoc_STRVAR(position_doc,
-        "position(inputFen) -> standardFen\n"
+PyDoc_STRVAR(Bitbase_doc,
+        "Bitbase(path) -> bitbase\n"
         "\n"
-        "Parse a FEN like string and convert it into a standardized FEN.\n"
-        "For example:\n"
-        " - Complete shortened ranks\n"
-        " - Order castling flags\n"
-        " - Remove en passant target square if there is no such legal capture\n"
-        " - Remove excess data beyond the FEN"
+        "Map a bitbase file, as written by `chessmoves bitbase', into memory.\n"
+        "The mapping is shared with other processes through the page cache."
+);
+
+typedef struct {
+        PyObject_HEAD
+        struct bitbase bitbase;
+        bool isOpen;
+} BitbaseObject;
+
+static PyObject *
+Bitbase_new(PyTypeObject *type, PyObject *args, PyObject *keywords)
+{
+        PyObject *path;
+
+        static char *keywordList[] = { "path", NULL };
+
+        if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&:Bitbase", keywordList,
+                                         PyUnicode_FSConverter, &path))
+                return NULL;
+
+        BitbaseObject *self = (BitbaseObject *)type->tp_alloc(type, 0);
+        if (!self) {
+                Py_DECREF(path);
+                return NULL;
+        }
+
+        if (openBitbase(&self->bitbase, PyBytes_AS_STRING(path)) != 0) {
+                PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+                Py_DECREF(path);
+                Py_DECREF(self);
+                return NULL;
+        }
+        self->isOpen = true;
+
+        Py_DECREF(path);
+        return (PyObject *)self;
+}
+
+static void
+Bitbase_dealloc(BitbaseObject *self)
+{
+        PyTypeObject *type = Py_TYPE(self);
+
+        if (self->isOpen)
+                closeBitbase(&self->bitbase);
+
+        type->tp_free(self);
+        Py_DECREF(type);
+}
+
+PyDoc_STRVAR(Bitbase_probe_doc,
+        "probe(fen) -> result\n"
+        "\n"
+        "Look up the position. Return 1 if the side to move wins, 0 for\n"
+        "a draw and -1 for a loss. Positions with the colors reversed are\n"
+        "also found. Castling and en passant rights are ignored."
 );
 
 static PyObject *
-chessmovesmodule_position(PyObject *self, PyObject *args)
+Bitbase_probe(BitbaseObject *self, PyObject *arg)
 {
-        char *fen;
+        static const int results[] = {
+                [bitbaseWin] = 1, [bitbaseDraw] = 0, [bitbaseLoss] = -1
+        };
 
-        if (!PyArg_ParseTuple(args, "s", &fen))
+        const char *fen = getString(arg, "fen");
+        if (!fen)
                 return NULL;
 
         struct board board;
-        int len = setupBoard(&board, fen);
+        int len, result = -1;
+        Py_BEGIN_ALLOW_THREADS
+        len = setupBoard(&board, fen);
+        if (len > 0)
+                result = probeBitbase(&self->bitbase, &board);
+        Py_END_ALLOW_THREADS
+
         if (len <= 0)
                 return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        if (result < 0)
+                return PyErr_Format(PyExc_ValueError, "Material doesn't match bitbase (%s)", fen);
 
-        char newFen[maxFenSize];
-        boardToFen(&board, newFen);
+        return PyLong_FromLong(results[result]);
+}
 
-        return PyString_FromString(newFen);
+static PyObject *
+Bitbase_signature(BitbaseObject *self, void *closure)
+{
+        return PyUnicode_FromString(self->bitbase.signature);
 }
 
+static PyMethodDef Bitbase_methods[] = {
+        { "probe", (PyCFunction)Bitbase_probe, METH_O, Bitbase_probe_doc },
+        { NULL, }
+};
+
+static PyGetSetDef Bitbase_getset[] = {
+        { "signature", (getter)Bitbase_signature, NULL, "Material signature, white first", NULL },
+        { NULL, }
+};
+
+static PyType_Slot Bitbase_slots[] = {
+        { Py_tp_doc,     (void *)Bitbase_doc },
+        { Py_tp_new,     (void *)(uintptr_t)Bitbase_new },
+        { Py_tp_dealloc, (void *)(uintptr_t)Bitbase_dealloc },
+        { Py_tp_methods, Bitbase_methods },
+        { Py_tp_getset,  Bitbase_getset },
+        { 0, NULL }
+};
+
+static PyType_Spec Bitbase_spec = {
+        .name      = "chessmoves.Bitbase",
+        .basicsize = sizeof(BitbaseObject),
+        .flags     = Py_TPFLAGS_DEFAULT,
+        .slots     = Bitbase_slots,
+};
+
 /*----------------------------------------------------------------------+
- |      move(...)                                                       |
+ |      PositionDb type                                                 |
  +----------------------------------------------------------------------*/
 
-PyDoc_STRVAR(move_doc,
-        "move(inputFen, inputMove, notation='san') -> (move, fen)\n"
-        "\n"
-        "Try to parse the input move and return it as a normalized string\n"
-        "if successful, legal and unambiguous. \n"
+PyDoc_STRVAR(PositionDb_doc,
+        "PositionDb(path, value_size=0, write=False) -> db\n"
         "\n"
-        "The parser accepts a wide variety of formats. The only restriction\n"
-        "is that piece identifiers, other than promotion pieces, must always\n"
-        "be in upper case, and file letters must always be in lower case.\n"
-        "Input capture signs, check marks, checkmate marks, annotations\n"
-        "(x, +, !, ?, etc) are all swallowed and ignored: these are not used\n"
-        "for disambiguation and also not checked for correctness.\n"
-        "When a promotion piece is missing, queening is assumed.\n"
-        "The output fen is the position after the move.\n"
+        "Open a database of fixed-size values keyed by the Zobrist-Polyglot hash.\n"
+        "Readers map the file into memory and share it with other processes\n"
+        "through the page cache. With write=True, the database is opened for\n"
+        "the single writer, and created with value_size bytes per value if it\n"
+        "doesn't exist yet. Changes become visible to readers on commit().\n"
         "\n"
-        "The `notation' keyword controls the output move syntax. See moves(...)\n"
-        "for details.\n"
+        "Keys are given as FENs or as hashes."
 );
 
+typedef struct {
+        PyObject_HEAD
+        struct positionDb db;
+        bool isOpen;
+} PositionDbObject;
+
 static PyObject *
-chessmovesmodule_move(PyObject *self, PyObject *args, PyObject *keywords)
+PositionDb_new(PyTypeObject *type, PyObject *args, PyObject *keywords)
 {
-        char *fen;
-        char *moveString;
-        char *notation = "san"; // default
-        int len;
+        PyObject *path;
+        int valueSize = 0;
+        int writable = 0;
 
-        static char *keywordList[] = { "fen", "move", "notation", NULL };
+        static char *keywordList[] = { "path", "value_size", "write", NULL };
 
-        if (!PyArg_ParseTupleAndKeywords(args, keywords, "ss|s:move", keywordList,
-                                         &fen, &moveString, &notation))
+        if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&|ip:PositionDb", keywordList,
+                                         PyUnicode_FSConverter, &path, &valueSize, &writable))
                 return NULL;
 
+        PositionDbObject *self = (PositionDbObject *)type->tp_alloc(type, 0);
+        if (!self) {
+                Py_DECREF(path);
+                return NULL;
+        }
+
+        if (openPositionDb(&self->db, PyBytes_AS_STRING(path), valueSize, writable) != 0) {
+                PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+                Py_DECREF(path);
+                Py_DECREF(self);
+                return NULL;
+        }
+        self->isOpen = true;
+
+        Py_DECREF(path);
+        return (PyObject *)self;
+}
+
+static void
+PositionDb_dealloc(PositionDbObject *self)
+{
+        PyTypeObject *type = Py_TYPE(self);
+
+        if (self->isOpen)
+                closePositionDb(&self->db);
+
+        type->tp_free(self);
+        Py_DECREF(type);
+}
+
+/*
+ *  Convert a FEN or a hash to a key. Return 0 on success, or -1 with
+ *  an exception set.
+ */
+static int getKey(PyObject *object, unsigned long long *key)
+{
+        if (PyLong_Check(object)) {
+                *key = PyLong_AsUnsignedLongLong(object);
+                return (*key == (unsigned long long)-1 && PyErr_Occurred()) ? -1 : 0;
+        }
+
+        const char *fen = getString(object, "key");
+        if (!fen)
+                return -1;
+
         struct board board;
+        int len;
+        Py_BEGIN_ALLOW_THREADS
         len = setupBoard(&board, fen);
-        if (len <= 0)
-                return PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+        if (len > 0)
+                *key = hash64(&board);
+        Py_END_ALLOW_THREADS
 
-        int notationIndex;
-        for (notationIndex=0; notationIndex<nrNotations; notationIndex++)
-                if (0==strcmp(notations[notationIndex], notation))
-                        break; // found
+        if (len <= 0) {
+                PyErr_Format(PyExc_ValueError, "Invalid FEN (%s)", fen);
+                return -1;
+        }
+        return 0;
+}
 
-        if (notationIndex >= nrNotations) // not found
-                return PyErr_Format(PyExc_ValueError, "Invalid notation (%s)", notation);
+PyDoc_STRVAR(PositionDb_get_doc,
+        "get(key) -> value\n"
+        "\n"
+        "Return the value for a FEN or a hash as bytes, or None if it is not there."
+);
 
-        int moveList[maxMoves];
-        updateSideInfo(&board);
-        int nrMoves = generateMoves(&board, moveList);
+static PyObject *
+PositionDb_get(PositionDbObject *self, PyObject *arg)
+{
+        unsigned long long key;
+        if (getKey(arg, &key) != 0)
+                return NULL;
 
-        int move;
-        len = parseMove(&board, moveString, moveList, nrMoves, &move);
-        if (len == 0)
-                return PyErr_Format(PyExc_ValueError, "Invalid move syntax (%s)", moveString);
-        if (len == -1)
-                return PyErr_Format(PyExc_ValueError, "Illegal move (%s)", moveString);
-        if (len == -2)
-                return PyErr_Format(PyExc_ValueError, "Ambiguous move (%s)", moveString);
+        const void *value = lookupPositionDb(&self->db, key);
+        if (!value)
+                Py_RETURN_NONE;
 
-        char newFen[maxFenSize];
+        return PyBytes_FromStringAndSize(value, self->db.valueSize);
+}
 
-        char newMoveString[maxMoveSize];
-        char *s = newMoveString;
-        const char *checkmark;
+static int
+PositionDb_contains(PositionDbObject *self, PyObject *arg)
+{
+        unsigned long long key;
+        if (getKey(arg, &key) != 0)
+                return -1;
 
-        makeMove(&board, move);
-        boardToFen(&board, newFen);
+        return lookupPositionDb(&self->db, key) != NULL;
+}
 
-        switch (notationIndex) {
-        case uciNotation:
-                undoMove(&board);
-                s = moveToUci(&board, s, move);
-                break;
-        case sanNotation:
-                updateSideInfo(&board);
-                checkmark = getCheckMark(&board);
-                undoMove(&board);
-                s = moveToStandardAlgebraic(&board, s, move, moveList, nrMoves);
-                s = stringCopy(s, checkmark);
-                break;
-        case longNotation:
-                undoMove(&board);
-                checkmark = getCheckMark(&board);
-                undoMove(&board);
-                s = moveToLongAlgebraic(&board, s, move);
-                s = stringCopy(s, checkmark);
-                break;
-        default:
-                assert(0);
+static Py_ssize_t
+PositionDb_length(PositionDbObject *self)
+{
+        return self->db.count;
+}
+
+/*
+ *  Get a value argument of the right size. Return 0 on success, or -1
+ *  with an exception set and the buffer released.
+ */
+static int getValue(PyObject *object, Py_buffer *buffer, Py_ssize_t size)
+{
+        if (PyObject_GetBuffer(object, buffer, PyBUF_SIMPLE) != 0)
+                return -1;
+
+        if (buffer->len != size) {
+                PyErr_Format(PyExc_ValueError, "Expected %zd bytes, got %zd", size, buffer->len);
+                PyBuffer_Release(buffer);
+                return -1;
         }
+        return 0;
+}
 
-        PyObject *result = PyTuple_New(2);
-        if (!result)
+PyDoc_STRVAR(PositionDb_put_doc,
+        "put(key, value)\n"
+        "\n"
+        "Insert or replace the value for a FEN or a hash. The value is a bytes-like\n"
+        "object of value_size bytes. Hash 0 is reserved."
+);
+
+static PyObject *
+PositionDb_put(PositionDbObject *self, PyObject *args)
+{
+        PyObject *keyObject, *valueObject;
+        if (!PyArg_ParseTuple(args, "OO:put", &keyObject, &valueObject))
                 return NULL;
 
-        if (PyTuple_SetItem(result, 0, PyString_FromString(newMoveString))) {
-                Py_DECREF(result);
+        unsigned long long key;
+        if (getKey(keyObject, &key) != 0)
                 return NULL;
-        }
 
-        if (PyTuple_SetItem(result, 1, PyString_FromString(newFen))) {
-                Py_DECREF(result);
+        Py_buffer value;
+        if (getValue(valueObject, &value, self->db.valueSize) != 0)
                 return NULL;
-        }
 
-        return result;
-}
+        int result = putPositionDb(&self->db, key, value.buf);
+        PyBuffer_Release(&value);
+        if (result != 0)
+                return PyErr_SetFromErrno(PyExc_OSError);
 
-/*----------------------------------------------------------------------+
- |      hash(...)                                                       |
- +----------------------------------------------------------------------*/
+        Py_RETURN_NONE;
+}
 
-PyDoc_STRVAR(hash_doc,
-        "hash(fen) -> hash\n"
+PyDoc_STRVAR(PositionDb_load_doc,
+        "load(keys, values)\n"
         "\n"
-        "Compute the Zobrist-Polyglot hash for the position."
+        "Insert many values at once. keys is a sequence of FENs or hashes, and\n"
+        "values a bytes-like object with all values back to back. Keys in\n"
+        "ascending order fill the table front to back."
 );
 
 static PyObject *
-chessmovesmodule_hash(PyObject *self, PyObject *args)
+PositionDb_load(PositionDbObject *self, PyObject *args)
 {
-        char *fen;
+        PyObject *keysObject, *valuesObject;
+        if (!PyArg_ParseTuple(args, "OO:load", &keysObject, &valuesObject))
+                return NULL;
 
-        if (!PyArg_ParseTuple(args, "s", &fen)) {
+        if (!PySequence_Check(keysObject))
+                return PyErr_Format(PyExc_TypeError, "keys must be a sequence");
+
+        // A tuple keeps the strings alive while getKey() releases the GIL
+        PyObject *sequence = PySequence_Tuple(keysObject);
+        if (!sequence)
                 return NULL;
+
+        Py_ssize_t n = PyTuple_GET_SIZE(sequence);
+        unsigned long long *keys = PyMem_Malloc((n + 1) * sizeof *keys);
+        if (!keys) {
+                Py_DECREF(sequence);
+                return PyErr_NoMemory();
         }
 
-        struct board board;
-        int len = setupBoard(&board, fen);
-        if (len <= 0) {
-                return PyErr_Format(PyExc_ValueError, "Invalid FEN");
+        for (Py_ssize_t i=0; i<n; i++) {
+                if (getKey(PyTuple_GET_ITEM(sequence, i), &keys[i]) != 0) {
+                        PyMem_Free(keys);
+                        Py_DECREF(sequence);
+                        return NULL;
+                }
         }
+        Py_DECREF(sequence);
 
-        unsigned long long hashkey = hash64(&board);
+        Py_buffer values;
+        if (getValue(valuesObject, &values, n * self->db.valueSize) != 0) {
+                PyMem_Free(keys);
+                return NULL;
+        }
 
-        return PyLong_FromUnsignedLongLong(hashkey);
+        // Holding the GIL keeps other threads off the table meanwhile
+        int result = loadPositionDb(&self->db, keys, values.buf, n);
+
+        PyBuffer_Release(&values);
+        PyMem_Free(keys);
+        if (result != 0)
+                return PyErr_SetFromErrno(PyExc_OSError);
+
+        Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(PositionDb_commit_doc,
+        "commit()\n"
+        "\n"
+        "Replace the file with the current contents in one atomic step."
+);
+
+static PyObject *
+PositionDb_commit(PositionDbObject *self, PyObject *unused)
+{
+        if (commitPositionDb(&self->db) != 0)
+                return PyErr_SetFromErrno(PyExc_OSError);
+
+        Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(PositionDb_refresh_doc,
+        "refresh() -> changed\n"
+        "\n"
+        "Pick up the last commit of the writer. Return True if there was a new one."
+);
+
+static PyObject *
+PositionDb_refresh(PositionDbObject *self, PyObject *unused)
+{
+        int result = refreshPositionDb(&self->db);
+        if (result < 0)
+                return PyErr_SetFromErrno(PyExc_OSError);
+
+        return PyBool_FromLong(result);
+}
+
+static PyObject *
+PositionDb_valueSize(PositionDbObject *self, void *closure)
+{
+        return PyLong_FromLong(self->db.valueSize);
 }
 
+static PyMethodDef PositionDb_methods[] = {
+        { "get",     (PyCFunction)PositionDb_get,     METH_O,       PositionDb_get_doc },
+        { "put",     (PyCFunction)PositionDb_put,     METH_VARARGS, PositionDb_put_doc },
+        { "load",    (PyCFunction)PositionDb_load,    METH_VARARGS, PositionDb_load_doc },
+        { "commit",  (PyCFunction)PositionDb_commit,  METH_NOARGS,  PositionDb_commit_doc },
+        { "refresh", (PyCFunction)PositionDb_refresh, METH_NOARGS,  PositionDb_refresh_doc },
+        { NULL, }
+};
+
+static PyGetSetDef PositionDb_getset[] = {
+        { "value_size", (getter)PositionDb_valueSize, NULL, "Size of the values in bytes", NULL },
+        { NULL, }
+};
+
+static PyType_Slot PositionDb_slots[] = {
+        { Py_tp_doc,        (void *)PositionDb_doc },
+        { Py_tp_new,        (void *)(uintptr_t)PositionDb_new },
+        { Py_tp_dealloc,    (void *)(uintptr_t)PositionDb_dealloc },
+        { Py_tp_methods,    PositionDb_methods },
+        { Py_tp_getset,     PositionDb_getset },
+        { Py_sq_contains,   (void *)(uintptr_t)PositionDb_contains },
+        { Py_mp_length,     (void *)(uintptr_t)PositionDb_length },
+        { 0, NULL }
+};
+
+static PyType_Spec PositionDb_spec = {
+        .name      = "chessmoves.PositionDb",
+        .basicsize = sizeof(PositionDbObject),
+        .flags     = Py_TPFLAGS_DEFAULT,
+        .slots     = PositionDb_slots,
+};
+
 /*----------------------------------------------------------------------+
  |      Method table                                                    |
  +----------------------------------------------------------------------*/
 
 static PyMethodDef chessmovesMethods[] = {
-	{ "moves",    (PyCFunction)chessmovesmodule_moves, METH_VARARGS|METH_KEYWORDS, moves_doc },
-	{ "position", chessmovesmodule_position,           METH_VARARGS,               position_doc },
-	{ "hash",     chessmovesmodule_hash,               METH_VARARGS,               hash_doc },
-	{ "move",     (PyCFunction)chessmovesmodule_move,  METH_VARARGS|METH_KEYWORDS, move_doc },
-	{ NULL, }
+        { "moves",    (PyCFunction)(void(*)(void))chessmovesmodule_moves, METH_FASTCALL|METH_KEYWORDS, moves_doc },
+        { "position", (PyCFunction)(void(*)(void))chessmovesmodule_position, METH_FASTCALL|METH_KEYWORDS, position_doc },
+        { "set_moves_cache", chessmovesmodule_set_moves_cache,            METH_O,                      set_moves_cache_doc },
+        { "moves_cache_info", chessmovesmodule_moves_cache_info,          METH_NOARGS,                 moves_cache_info_doc },
+        { "hash",     chessmovesmodule_hash,                              METH_O,                      hash_doc },
+        { "canonical", chessmovesmodule_canonical,                        METH_O,                      canonical_doc },
+        { "transform", (PyCFunction)(void(*)(void))chessmovesmodule_transform, METH_FASTCALL|METH_KEYWORDS, transform_doc },
+        { "transform_move", (PyCFunction)(void(*)(void))chessmovesmodule_transform_move, METH_FASTCALL|METH_KEYWORDS, transform_move_doc },
+        { "move",     (PyCFunction)(void(*)(void))chessmovesmodule_move,  METH_FASTCALL|METH_KEYWORDS, move_doc },
+        { "perft",    (PyCFunction)(void(*)(void))chessmovesmodule_perft, METH_FASTCALL|METH_KEYWORDS, perft_doc },
+        { "mate_in",  (PyCFunction)(void(*)(void))chessmovesmodule_mate_in, METH_FASTCALL|METH_KEYWORDS, mate_in_doc },
+        { "mate_in_batch", (PyCFunction)(void(*)(void))chessmovesmodule_mate_in_batch, METH_FASTCALL|METH_KEYWORDS, mate_in_batch_doc },
+        { "play",     (PyCFunction)(void(*)(void))chessmovesmodule_play,  METH_FASTCALL|METH_KEYWORDS, play_doc },
+        { "playouts", (PyCFunction)(void(*)(void))chessmovesmodule_playouts, METH_FASTCALL|METH_KEYWORDS, playouts_doc },
+        { "encode_planes", (PyCFunction)(void(*)(void))chessmovesmodule_encode_planes, METH_FASTCALL|METH_KEYWORDS, encode_planes_doc },
+        { "policy_index", (PyCFunction)(void(*)(void))chessmovesmodule_policy_index, METH_FASTCALL|METH_KEYWORDS, policy_index_doc },
+        { "policy_move", (PyCFunction)(void(*)(void))chessmovesmodule_policy_move, METH_FASTCALL|METH_KEYWORDS, policy_move_doc },
+        { "encode_policy", (PyCFunction)(void(*)(void))chessmovesmodule_encode_policy, METH_FASTCALL|METH_KEYWORDS, encode_policy_doc },
+        { "count_moves", (PyCFunction)(void(*)(void))chessmovesmodule_count_moves, METH_FASTCALL|METH_KEYWORDS, count_moves_doc },
+        { "hash_keys", (PyCFunction)(void(*)(void))chessmovesmodule_hash_keys, METH_FASTCALL|METH_KEYWORDS, hash_keys_doc },
+        { "encode_game", (PyCFunction)(void(*)(void))chessmovesmodule_encode_game, METH_FASTCALL|METH_KEYWORDS, encode_game_doc },
+        { "decode_games", (PyCFunction)(void(*)(void))chessmovesmodule_decode_games, METH_FASTCALL|METH_KEYWORDS, decode_games_doc },
+        { NULL, }
 };
 
 /*----------------------------------------------------------------------+
- |      initchessmoves                                                  |
+ |      Module initialization                                           |
  +----------------------------------------------------------------------*/
 
-PyMODINIT_FUNC
-initchessmoves(void)
+static int chessmovesExec(PyObject *module)
 {
-	PyObject *module;
+        struct moduleState *state = moduleState(module);
+
+        // Intern the keywords and notations
+        state->budgetKeyword = PyUnicode_InternFromString("budget");
+        state->countKeyword = PyUnicode_InternFromString("count");
+        state->countersKeyword = PyUnicode_InternFromString("counters");
+        state->dataKeyword = PyUnicode_InternFromString("data");
+        state->depthKeyword = PyUnicode_InternFromString("depth");
+        state->entropyKeyword = PyUnicode_InternFromString("entropy");
+        state->fenKeyword = PyUnicode_InternFromString("fen");
+        state->fensKeyword = PyUnicode_InternFromString("fens");
+        state->flipKeyword = PyUnicode_InternFromString("flip");
+        state->indexKeyword = PyUnicode_InternFromString("index");
+        state->indicesKeyword = PyUnicode_InternFromString("indices");
+        state->keysKeyword = PyUnicode_InternFromString("keys");
+        state->maxPliesKeyword = PyUnicode_InternFromString("max_plies");
+        state->moveKeyword = PyUnicode_InternFromString("move");
+        state->movesKeyword = PyUnicode_InternFromString("moves");
+        state->nKeyword = PyUnicode_InternFromString("n");
+        state->notationKeyword = PyUnicode_InternFromString("notation");
+        state->outKeyword = PyUnicode_InternFromString("out");
+        state->outputKeyword = PyUnicode_InternFromString("output");
+        state->seedKeyword = PyUnicode_InternFromString("seed");
+        state->threadsKeyword = PyUnicode_InternFromString("threads");
+        state->transformKeyword = PyUnicode_InternFromString("transform");
+        state->weightsKeyword = PyUnicode_InternFromString("weights");
+        if (!state->budgetKeyword || !state->countKeyword || !state->countersKeyword || !state->depthKeyword
+         || !state->fenKeyword || !state->fensKeyword || !state->flipKeyword || !state->outKeyword
+         || !state->indexKeyword || !state->indicesKeyword || !state->keysKeyword
+         || !state->dataKeyword || !state->entropyKeyword
+         || !state->maxPliesKeyword || !state->moveKeyword || !state->movesKeyword || !state->nKeyword
+         || !state->notationKeyword || !state->outputKeyword || !state->seedKeyword
+         || !state->threadsKeyword || !state->transformKeyword || !state->weightsKeyword)
+                return -1;
 
-        // Create the module and add the functions
-        module = Py_InitModule3("chessmoves", chessmovesMethods, chessmoves_doc);
-        if (module == NULL) {
-                return;
+        for (int i=0; i<nrNotations; i++) {
+                state->notations[i] = PyUnicode_InternFromString(notations[i]);
+                if (!state->notations[i])
+                        return -1;
         }
 
-        // Add startPosition as a string constant
-        if (PyModule_AddStringConstant(module, "startPosition", startpos)) {
-                return;
+        for (int i=0; i<nrOutputs; i++) {
+                state->outputs[i] = PyUnicode_InternFromString(outputs[i]);
+                if (!state->outputs[i])
+                        return -1;
         }
 
+        // Add startPosition as a string constant
+        if (PyModule_AddStringConstant(module, "startPosition", startpos))
+                return -1;
+
+        // Add the transform bits
+        if (PyModule_AddIntConstant(module, "flipColors", transformFlipColors)
+         || PyModule_AddIntConstant(module, "mirrorFiles", transformMirrorFiles))
+                return -1;
+
+        // Add the sizes of the neural network encodings
+        if (PyModule_AddIntConstant(module, "planesPerPosition", nrPlanes)
+         || PyModule_AddIntConstant(module, "policySize", policySize)
+         || PyModule_AddIntConstant(module, "maxMoves", maxMoves))
+                return -1;
+
         /*
          *  Add a list of available move notations
          */
 
         PyObject *list = PyList_New(nrNotations);
-        if (!list) {
-                return;
-        }
+        if (!list)
+                return -1;
 
         for (int i=0; i<nrNotations; i++) {
-                if (PyList_SetItem(list, i, PyString_FromString(notations[i]))) {
-                        Py_DECREF(list);
-                        return;
-                }
+                Py_INCREF(state->notations[i]);
+                PyList_SET_ITEM(list, i, state->notations[i]);
         }
 
         if (PyModule_AddObject(module, "notations", list)) {
                 Py_DECREF(list);
-                return;
+                return -1;
         }
+
+        // Add the types
+        PyObject *bitbaseType = PyType_FromSpec(&Bitbase_spec);
+        if (!bitbaseType)
+                return -1;
+
+        if (PyModule_AddObject(module, "Bitbase", bitbaseType)) {
+                Py_DECREF(bitbaseType);
+                return -1;
+        }
+
+        PyObject *positionDbType = PyType_FromSpec(&PositionDb_spec);
+        if (!positionDbType)
+                return -1;
+
+        if (PyModule_AddObject(module, "PositionDb", positionDbType)) {
+                Py_DECREF(positionDbType);
+                return -1;
+        }
+
+        // Keep a reference for type checks of budget arguments
+        state->budgetType = PyType_FromSpec(&Budget_spec);
+        if (!state->budgetType)
+                return -1;
+
+        Py_INCREF(state->budgetType);
+        if (PyModule_AddObject(module, "Budget", state->budgetType)) {
+                Py_DECREF(state->budgetType);
+                return -1;
+        }
+
+        // The result type of moves(...) takes the rest of its methods from Mapping
+        state->movesType = PyType_FromSpec(&Moves_spec);
+        if (!state->movesType)
+                return -1;
+
+        PyObject *abc = PyImport_ImportModule("collections.abc");
+        if (!abc)
+                return -1;
+        PyObject *mapping = PyObject_GetAttrString(abc, "Mapping");
+        Py_DECREF(abc);
+        if (!mapping)
+                return -1;
+
+        static const char *const mixins[] = { "keys", "items", "values", "get", "__eq__", "__hash__" };
+        for (size_t i=0; i<sizeof mixins / sizeof mixins[0]; i++) {
+                PyObject *method = PyObject_GetAttrString(mapping, mixins[i]);
+                if (!method || PyObject_SetAttrString(state->movesType, mixins[i], method)) {
+                        Py_XDECREF(method);
+                        Py_DECREF(mapping);
+                        return -1;
+                }
+                Py_DECREF(method);
+        }
+
+        PyObject *result = PyObject_CallMethod(mapping, "register", "O", state->movesType);
+        Py_DECREF(mapping);
+        if (!result)
+                return -1;
+        Py_DECREF(result);
+
+        return 0;
+}
+
+static int chessmovesTraverse(PyObject *module, visitproc visit, void *arg)
+{
+        struct moduleState *state = moduleState(module);
+        for (Py_ssize_t i=0; i<state->movesCache.capacity; i++)
+                Py_VISIT(state->movesCache.entries[i].value);
+        for (int i=0; i<nrNotations; i++)
+                Py_VISIT(state->notations[i]);
+        for (int i=0; i<nrOutputs; i++)
+                Py_VISIT(state->outputs[i]);
+        Py_VISIT(state->budgetType);
+        Py_VISIT(state->movesType);
+        Py_VISIT(state->budgetKeyword);
+        Py_VISIT(state->countKeyword);
+        Py_VISIT(state->countersKeyword);
+        Py_VISIT(state->dataKeyword);
+        Py_VISIT(state->depthKeyword);
+        Py_VISIT(state->entropyKeyword);
+        Py_VISIT(state->fenKeyword);
+        Py_VISIT(state->fensKeyword);
+        Py_VISIT(state->flipKeyword);
+        Py_VISIT(state->indexKeyword);
+        Py_VISIT(state->indicesKeyword);
+        Py_VISIT(state->keysKeyword);
+        Py_VISIT(state->maxPliesKeyword);
+        Py_VISIT(state->moveKeyword);
+        Py_VISIT(state->movesKeyword);
+        Py_VISIT(state->nKeyword);
+        Py_VISIT(state->notationKeyword);
+        Py_VISIT(state->outKeyword);
+        Py_VISIT(state->outputKeyword);
+        Py_VISIT(state->seedKeyword);
+        Py_VISIT(state->threadsKeyword);
+        Py_VISIT(state->transformKeyword);
+        Py_VISIT(state->weightsKeyword);
+        return 0;
+}
+
+static int chessmovesClear(PyObject *module)
+{
+        struct moduleState *state = moduleState(module);
+        clearCache(&state->movesCache);
+        for (int i=0; i<nrNotations; i++)
+                Py_CLEAR(state->notations[i]);
+        for (int i=0; i<nrOutputs; i++)
+                Py_CLEAR(state->outputs[i]);
+        Py_CLEAR(state->budgetType);
+        Py_CLEAR(state->movesType);
+        Py_CLEAR(state->budgetKeyword);
+        Py_CLEAR(state->countKeyword);
+        Py_CLEAR(state->countersKeyword);
+        Py_CLEAR(state->dataKeyword);
+        Py_CLEAR(state->depthKeyword);
+        Py_CLEAR(state->entropyKeyword);
+        Py_CLEAR(state->fenKeyword);
+        Py_CLEAR(state->fensKeyword);
+        Py_CLEAR(state->flipKeyword);
+        Py_CLEAR(state->indexKeyword);
+        Py_CLEAR(state->indicesKeyword);
+        Py_CLEAR(state->keysKeyword);
+        Py_CLEAR(state->maxPliesKeyword);
+        Py_CLEAR(state->moveKeyword);
+        Py_CLEAR(state->movesKeyword);
+        Py_CLEAR(state->nKeyword);
+        Py_CLEAR(state->notationKeyword);
+        Py_CLEAR(state->outKeyword);
+        Py_CLEAR(state->outputKeyword);
+        Py_CLEAR(state->seedKeyword);
+        Py_CLEAR(state->threadsKeyword);
+        Py_CLEAR(state->transformKeyword);
+        Py_CLEAR(state->weightsKeyword);
+        return 0;
+}
+
+static void chessmovesFree(void *module)
+{
+        chessmovesClear((PyObject *)module);
+}
+
+static PyModuleDef_Slot chessmovesSlots[] = {
+        { Py_mod_exec, (void *)(uintptr_t)chessmovesExec }, // via integer: ISO C has no function to void * cast
+        { 0, NULL }
+};
+
+static struct PyModuleDef chessmovesModule = {
+        PyModuleDef_HEAD_INIT,
+        .m_name     = "chessmoves",
+        .m_doc      = chessmoves_doc,
+        .m_size     = sizeof(struct moduleState),
+        .m_methods  = chessmovesMethods,
+        .m_slots    = chessmovesSlots,
+        .m_traverse = chessmovesTraverse,
+        .m_clear    = chessmovesClear,
+        .m_free     = chessmovesFree,
+};
+
+PyMODINIT_FUNC
+PyInit_chessmoves(void)
+{
+        return PyModuleDef_Init(&chessmovesModule);
 }
 
 /*----------------------------------------------------------------------+
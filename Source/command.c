@@ -0,0 +1,1212 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      command.c -- chessmoves command line tool                       |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  Streaming front end for use in shell pipelines. Each command reads
+ *  positions from stdin, one FEN per line, and writes one result per
+ *  input line. Invalid lines are reported on stderr and give an empty
+ *  output line, so that input and output stay aligned.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// getline(), getopt()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Other module includes
+#include "Board.h"
+#include "bitbase.h"
+#include "divide.h"
+#include "mate.h"
+#include "perft.h"
+#include "playout.h"
+#include "stringCopy.h"
+#include "symmetry.h"
+#include "workers.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+enum {
+        uciNotation, sanNotation, longNotation,
+        nrNotations
+};
+
+static const char *notations[] = {
+        [uciNotation] = "uci",
+        [sanNotation] = "san",
+        [longNotation] = "long"
+};
+
+struct options {
+        int notation;
+        int depth;
+        int nrThreads;
+        const char *bitbasePath;
+        struct bitbase bitbase;
+        const char *startFen;
+        struct playoutOptions playout;
+};
+
+// A line command handles one input line and returns an error message or NULL
+typedef const char *command_t(Board_t board, char *line, const struct options *options);
+
+// Other commands get their remaining arguments and return an exit status
+typedef int run_t(const char *program, int argc, char *argv[], struct options *options);
+
+// Output function for random games
+typedef void write_t(Board_t start, const struct game *game, unsigned long long gameNumber,
+        const struct options *options);
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      formatMove                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Produce the move string and the new position for a move that has
+ *  already been made on the board. The move is retracted on return.
+ *  With the placement of the position before the move, only the
+ *  changed ranks of the new position are converted.
+ */
+static void formatMove(Board_t board, int notation, int move, int moveList[maxMoves], int nrMoves,
+        const struct fenPlacement *parent, char moveString[maxMoveSize], char newFen[maxFenSize])
+{
+        char *s = moveString;
+        const char *checkmark = "";
+
+        if (notation != uciNotation) {
+                updateSideInfo(board);
+                checkmark = getCheckMark(board);
+        }
+        if (parent)
+                childToFen(board, parent, move, newFen);
+        else
+                boardToFen(board, newFen);
+        undoMove(board);
+
+        switch (notation) {
+        case uciNotation:
+                s = moveToUci(board, s, move);
+                break;
+        case sanNotation:
+                s = moveToStandardAlgebraic(board, s, move, moveList, nrMoves);
+                break;
+        case longNotation:
+                s = moveToLongAlgebraic(board, s, move);
+                break;
+        }
+        stringCopy(s, checkmark);
+}
+
+/*----------------------------------------------------------------------+
+ |      printVariation                                                  |
+ +----------------------------------------------------------------------*/
+
+// Print the moves of a variation, each preceded by a space
+static void printVariation(Board_t board, int notation, const int variation[], int nrPlies)
+{
+        for (int i=0; i<nrPlies; i++) {
+                int moveList[maxMoves];
+                updateSideInfo(board);
+                int nrMoves = generateMoves(board, moveList);
+
+                char moveString[maxMoveSize];
+                char newFen[maxFenSize];
+                makeMove(board, variation[i]);
+                formatMove(board, notation, variation[i], moveList, nrMoves, NULL, moveString, newFen);
+                printf(" %s", moveString);
+                makeMove(board, variation[i]);
+        }
+
+        for (int i=0; i<nrPlies; i++)
+                undoMove(board);
+}
+
+/*----------------------------------------------------------------------+
+ |      Commands                                                        |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  moves: one line per legal move with the move and the new position,
+ *  followed by an empty line
+ */
+static const char *commandMoves(Board_t board, char *line, const struct options *options)
+{
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        int moveList[maxMoves];
+        updateSideInfo(board);
+        int nrMoves = generateMoves(board, moveList);
+
+        struct fenPlacement placement;
+        preparePlacement(board, &placement);
+
+        for (int i=0; i<nrMoves; i++) {
+                int move = moveList[i];
+                makeMove(board, move);
+                updateSideInfo(board);
+                bool isLegal = board->side->attacks[board->xside->king] == 0;
+                if (!isLegal) {
+                        undoMove(board);
+                        continue;
+                }
+
+                char moveString[maxMoveSize];
+                char newFen[maxFenSize];
+                formatMove(board, options->notation, move, moveList, nrMoves, &placement, moveString, newFen);
+                printf("%s %s\n", moveString, newFen);
+        }
+        putchar('\n');
+        return NULL;
+}
+
+/*
+ *  position: the standardized FEN
+ */
+static const char *commandPosition(Board_t board, char *line, const struct options *options)
+{
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        char newFen[maxFenSize];
+        boardToFen(board, newFen);
+        puts(newFen);
+        return NULL;
+}
+
+/*
+ *  move: input is a FEN followed by a move, output the normalized move
+ *  and the new position
+ */
+static const char *commandMove(Board_t board, char *line, const struct options *options)
+{
+        int len = setupBoard(board, line);
+        if (len <= 0)
+                return "Invalid FEN";
+
+        // The move is the last word on the line
+        int end = strlen(line);
+        while (end > len && isspace(line[end-1]))
+                end--;
+        int start = end;
+        while (start > len && !isspace(line[start-1]))
+                start--;
+        if (start == end || start == len)
+                return "Missing move";
+
+        int moveList[maxMoves];
+        updateSideInfo(board);
+        int nrMoves = generateMoves(board, moveList);
+
+        int move;
+        switch (parseMove(board, &line[start], moveList, nrMoves, &move)) {
+        case 0: return "Invalid move syntax";
+        case -1: return "Illegal move";
+        case -2: return "Ambiguous move";
+        }
+
+        char moveString[maxMoveSize];
+        char newFen[maxFenSize];
+        makeMove(board, move);
+        formatMove(board, options->notation, move, moveList, nrMoves, NULL, moveString, newFen);
+        printf("%s %s\n", moveString, newFen);
+        return NULL;
+}
+
+/*
+ *  hash: the Polyglot hash in hexadecimal
+ */
+static const char *commandHash(Board_t board, char *line, const struct options *options)
+{
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        printf("0x%016llx\n", hash64(board));
+        return NULL;
+}
+
+/*
+ *  canonical: the canonical position under color flip and mirror, its
+ *  hash and the transform that maps between them
+ */
+static const char *commandCanonical(Board_t board, char *line, const struct options *options)
+{
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        int transform = canonicalizeBoard(board);
+
+        char newFen[maxFenSize];
+        boardToFen(board, newFen);
+        printf("%s 0x%016llx %d\n", newFen, hash64(board), transform);
+        return NULL;
+}
+
+/*
+ *  perft: the number of legal move paths of the requested depth
+ */
+static const char *commandPerft(Board_t board, char *line, const struct options *options)
+{
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        printf("%llu\n", perft(board, options->depth));
+        return NULL;
+}
+
+/*
+ *  probe: the bitbase result for the side to move (win, draw or loss)
+ */
+static const char *commandProbe(Board_t board, char *line, const struct options *options)
+{
+        static const char *results[] = {
+                [bitbaseWin] = "win", [bitbaseDraw] = "draw", [bitbaseLoss] = "loss"
+        };
+
+        if (setupBoard(board, line) <= 0)
+                return "Invalid FEN";
+
+        int result = probeBitbase(&options->bitbase, board);
+        if (result < 0)
+                return "Material doesn't match bitbase";
+
+        puts(results[result]);
+        return NULL;
+}
+
+/*
+ *  bitbase: generate a bitbase file
+ */
+static int runBitbase(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 2)
+                return -1;
+
+        if (generateBitbase(argv[0], argv[1], options->nrThreads) != 0) {
+                fprintf(stderr, "%s: %s %s: %s\n", program, argv[0], argv[1], strerror(errno));
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/*
+ *  mate: the shortest forced mate within depth moves, as the number of
+ *  moves followed by the main line, or 0 if there is none. Lines are
+ *  read in blocks, and the positions of a block are solved in parallel.
+ */
+static int runMate(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 1)
+                return -1;
+        int depth = atoi(argv[0]);
+        if (depth < 1 || depth > maxMateDepth)
+                return -1;
+
+        enum { blockSize = 1024 };
+        struct mateProblem *problems = malloc(blockSize * sizeof *problems);
+        bool *isValid = malloc(blockSize * sizeof *isValid);
+        if (!problems || !isValid) {
+                perror(program);
+                free(problems);
+                free(isValid);
+                return EXIT_FAILURE;
+        }
+
+        int exitStatus = EXIT_SUCCESS;
+        char *line = NULL;
+        size_t size = 0;
+        unsigned long lineNumber = 0;
+        bool isEof = false;
+
+        while (!isEof) {
+                // Read a block
+                int nrLines = 0, nrProblems = 0;
+                while (nrLines < blockSize) {
+                        if (getline(&line, &size, stdin) == -1) {
+                                isEof = true;
+                                break;
+                        }
+                        lineNumber++;
+                        isValid[nrLines] = setupBoard(&problems[nrProblems].board, line) > 0;
+                        if (isValid[nrLines])
+                                nrProblems++;
+                        else {
+                                line[strcspn(line, "\n")] = '\0';
+                                fprintf(stderr, "%s: line %lu: Invalid FEN (%s)\n", program, lineNumber, line);
+                                exitStatus = EXIT_FAILURE;
+                        }
+                        nrLines++;
+                }
+
+                if (solveMates(problems, nrProblems, depth, options->nrThreads, defaultMateTableSize, NULL) != 0) {
+                        perror(program);
+                        exitStatus = EXIT_FAILURE;
+                        break;
+                }
+
+                // Write the results in input order
+                for (int i=0, j=0; i<nrLines; i++) {
+                        if (isValid[i]) {
+                                struct mateProblem *problem = &problems[j++];
+                                printf("%d", problem->mate);
+                                if (problem->mate > 0)
+                                        printVariation(&problem->board, options->notation,
+                                                       problem->pv, 2 * problem->mate - 1);
+                        }
+                        putchar('\n');
+                }
+        }
+        free(line);
+        free(problems);
+        free(isValid);
+
+        if (ferror(stdin) || fflush(stdout) != 0) {
+                perror(program);
+                exitStatus = EXIT_FAILURE;
+        }
+
+        return exitStatus;
+}
+
+/*
+ *  Play random games in blocks and write them in order
+ */
+static int runPlayouts(const char *program, const char *countString, write_t *write, struct options *options)
+{
+        char *end;
+        unsigned long long count = strtoull(countString, &end, 10);
+        if (*end != '\0' || count < 1)
+                return -1;
+
+        struct board start;
+        if (setupBoard(&start, options->startFen) <= 0) {
+                fprintf(stderr, "%s: Invalid FEN (%s)\n", program, options->startFen);
+                return EXIT_FAILURE;
+        }
+
+        enum { blockSize = 1024 };
+        struct game *games = malloc(blockSize * sizeof *games);
+        if (!games) {
+                perror(program);
+                return EXIT_FAILURE;
+        }
+
+        unsigned long long firstGame = 1;
+        while (firstGame <= count) {
+                int nrGames = (count - firstGame + 1 < blockSize) ? count - firstGame + 1 : blockSize;
+
+                if (playouts(&start, &options->playout, firstGame, games, nrGames, options->nrThreads) < 0) {
+                        perror(program);
+                        free(games);
+                        return EXIT_FAILURE;
+                }
+                for (int i=0; i<nrGames; i++)
+                        write(&start, &games[i], firstGame + i, options);
+
+                firstGame += nrGames;
+        }
+        free(games);
+
+        if (fflush(stdout) != 0) {
+                perror(program);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+// Replay the first nrPlies moves of a game on a copy of the start position. See freeBoard().
+static void replayGame(Board_t board, Board_t start, const struct game *game, int nrPlies)
+{
+        *board = *start;
+        for (int i=0; i<nrPlies; i++)
+                makeMove(board, game->moves[i]);
+}
+
+// Moves and result on one line
+static void writeGame(Board_t start, const struct game *game, unsigned long long gameNumber,
+        const struct options *options)
+{
+        struct board board = *start;
+        for (int i=0; i<game->nrPlies; i++) {
+                int move = game->moves[i];
+                int moveList[maxMoves];
+                updateSideInfo(&board);
+                int nrMoves = generateMoves(&board, moveList);
+
+                char moveString[maxMoveSize];
+                char newFen[maxFenSize];
+                makeMove(&board, move);
+                formatMove(&board, options->notation, move, moveList, nrMoves, NULL, moveString, newFen);
+                printf("%s ", moveString);
+                makeMove(&board, move);
+        }
+        freeBoard(&board);
+        puts(gameResult(game, start));
+}
+
+// The sampled position
+static void writeSample(Board_t start, const struct game *game, unsigned long long gameNumber,
+        const struct options *options)
+{
+        struct board board;
+        char fen[maxFenSize];
+        replayGame(&board, start, game, game->samplePly);
+        boardToFen(&board, fen);
+        freeBoard(&board);
+        puts(fen);
+}
+
+// The sampled position with its perft counts, one line per depth
+static void writeEpd(Board_t start, const struct game *game, unsigned long long gameNumber,
+        const struct options *options)
+{
+        struct board board;
+        char fen[maxFenSize];
+        replayGame(&board, start, game, game->samplePly);
+        boardToFen(&board, fen);
+        freeBoard(&board);
+        for (int depth=1; depth<=options->playout.perftDepth; depth++)
+                printf("%s id gentest-%llu; perft %d %llu;\n", fen, gameNumber, depth, game->perft[depth]);
+}
+
+/*
+ *  games: random games, one per line, with the moves and the result
+ */
+static int runGames(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 1)
+                return -1;
+        return runPlayouts(program, argv[0], writeGame, options);
+}
+
+/*
+ *  samples: a random position from each random game
+ */
+static int runSamples(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 1)
+                return -1;
+        return runPlayouts(program, argv[0], writeSample, options);
+}
+
+/*
+ *  epd: a random position from each random game, with perft counts up
+ *  to depth, in the format of Data/perft-random.epd
+ */
+static int runEpd(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 2)
+                return -1;
+        options->playout.perftDepth = atoi(argv[1]);
+        if (options->playout.perftDepth < 1 || options->playout.perftDepth > maxPlayoutPerftDepth)
+                return -1;
+        return runPlayouts(program, argv[0], writeEpd, options);
+}
+
+/*
+ *  divide: write a shard manifest for a deep perft from the start position
+ */
+static int runDivide(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 3)
+                return -1;
+        int depth = atoi(argv[0]);
+        int splitDepth = atoi(argv[1]);
+        if (splitDepth < 1 || splitDepth > maxDivideSplitDepth || depth < splitDepth || depth > maxPerftDepth)
+                return -1;
+
+        struct board board;
+        if (setupBoard(&board, options->startFen) <= 0) {
+                fprintf(stderr, "%s: Invalid FEN (%s)\n", program, options->startFen);
+                return EXIT_FAILURE;
+        }
+
+        long nrShards = writePerftManifest(&board, depth, splitDepth, argv[2]);
+        if (nrShards < 0) {
+                fprintf(stderr, "%s: %s: %s\n", program, argv[2], strerror(errno));
+                return EXIT_FAILURE;
+        }
+        printf("%ld\n", nrShards);
+        return EXIT_SUCCESS;
+}
+
+/*
+ *  shards: compute the unfinished shards of a manifest, then write the
+ *  count per root move and the total. Several processes can work on the
+ *  same manifest, and an interrupted run continues where it stopped.
+ */
+static int runShards(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc != 1)
+                return -1;
+
+        struct perftManifest manifest;
+        if (openPerftManifest(&manifest, argv[0]) != 0) {
+                fprintf(stderr, "%s: %s: %s\n", program, argv[0], strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        long nrUnfinished = runPerftShards(&manifest, options->nrThreads);
+        if (nrUnfinished != 0) {
+                if (nrUnfinished < 0)
+                        fprintf(stderr, "%s: %s: %s\n", program, argv[0], strerror(errno));
+                else
+                        fprintf(stderr, "%s: %s: %ld shards unfinished\n", program, argv[0], nrUnfinished);
+                closePerftManifest(&manifest);
+                return EXIT_FAILURE;
+        }
+
+        unsigned long long counts[maxMoves];
+        dividePerft(&manifest, counts);
+
+        struct board board;
+        setupBoard(&board, manifest.rootFen);
+        int moveList[maxMoves];
+        updateSideInfo(&board);
+        int nrMoves = generateMoves(&board, moveList);
+
+        unsigned long long total = 0;
+        for (int i=0; i<manifest.nrRootMoves; i++) {
+                char moveString[maxMoveSize];
+                char newFen[maxFenSize];
+                makeMove(&board, manifest.rootMoves[i]);
+                formatMove(&board, options->notation, manifest.rootMoves[i], moveList, nrMoves, NULL, moveString, newFen);
+                printf("%s %llu\n", moveString, counts[i]);
+                total += counts[i];
+        }
+        printf("%llu\n", total);
+        closePerftManifest(&manifest);
+
+        if (fflush(stdout) != 0) {
+                perror(program);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------+
+ |      normalize                                                       |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  The input is cut into chunks at line boundaries. Worker 0 reads chunks
+ *  and writes the results in input order, while the other workers
+ *  normalize the chunks that are queued. Worker 0 normalizes queued chunks
+ *  as well when it would otherwise wait. A ring of chunks is the reorder
+ *  buffer: a chunk can only be reused after it has been written.
+ */
+
+enum { chunkSize = 1 << 20, chunksPerThread = 4 };
+
+struct badLine {
+        unsigned long line;  // within the chunk
+        size_t offset;       // within the chunk
+};
+
+struct chunk {
+        char *input;
+        size_t inputLen, inputSize;
+        char *output;
+        size_t outputLen, outputSize;
+        struct badLine *badLines;
+        size_t nrBadLines, badLinesSize;
+        unsigned long nrLines;
+        int error;           // errno of a failed allocation
+        bool isDone;
+};
+
+struct normalizer {
+        pthread_mutex_t lock;
+        pthread_cond_t queued, done;
+        struct chunk *chunks;
+        int nrChunks;
+        long nrRead, nrTaken;
+        bool isFinished;
+        bool withHash;
+        const char *program;
+        int exitStatus;
+};
+
+// Make room for n more bytes, or return -1
+static int reserve(char **buffer, size_t *size, size_t len, size_t n)
+{
+        if (len + n <= *size)
+                return 0;
+        size_t newSize = *size ? *size : chunkSize;
+        while (len + n > newSize)
+                newSize *= 2;
+        char *newBuffer = realloc(*buffer, newSize);
+        if (!newBuffer)
+                return -1;
+        *buffer = newBuffer;
+        *size = newSize;
+        return 0;
+}
+
+/*
+ *  Normalize one line. The text after the FEN is kept, except for the
+ *  halfmove clock and move number of a full FEN.
+ */
+static bool normalizeLine(struct chunk *chunk, char *line, bool withHash)
+{
+        struct board board;
+        int len = setupBoard(&board, line);
+        if (len <= 0)
+                return false;
+
+        // The move counters are part of the FEN, keep EPD operations
+        char *rest = line + len;
+        while (isspace((unsigned char)*rest))
+                rest++;
+        size_t restLen = strlen(rest);
+        while (restLen > 0 && isspace((unsigned char)rest[restLen-1]))
+                restLen--;
+
+        if (reserve(&chunk->output, &chunk->outputSize, chunk->outputLen,
+                    maxFenSize + restLen + sizeof " 0x0123456789abcdef\n") != 0) {
+                chunk->error = errno;
+                return true;
+        }
+
+        char *out = chunk->output + chunk->outputLen;
+        boardToFen(&board, out);
+        out += strlen(out);
+        if (restLen > 0) {
+                *out++ = ' ';
+                memcpy(out, rest, restLen);
+                out += restLen;
+        }
+        if (withHash)
+                out += sprintf(out, " 0x%016llx", hash64(&board));
+        *out++ = '\n';
+        chunk->outputLen = out - chunk->output;
+        return true;
+}
+
+static void normalizeChunk(struct chunk *chunk, bool withHash)
+{
+        chunk->outputLen = 0;
+        chunk->nrBadLines = 0;
+        chunk->nrLines = 0;
+        chunk->error = 0;
+
+        char *line = chunk->input;
+        char *end = chunk->input + chunk->inputLen;
+        while (line < end && !chunk->error) {
+                char *next = memchr(line, '\n', end - line);
+                if (!next)
+                        next = end; // the last line has no newline, but there is room
+                *next = '\0';      // setupBoard must not look into the next line
+
+                if (!normalizeLine(chunk, line, withHash)) {
+                        if (chunk->nrBadLines == chunk->badLinesSize) {
+                                size_t size = chunk->badLinesSize ? 2 * chunk->badLinesSize : 64;
+                                void *badLines = realloc(chunk->badLines, size * sizeof *chunk->badLines);
+                                if (!badLines) {
+                                        chunk->error = errno;
+                                        break;
+                                }
+                                chunk->badLines = badLines;
+                                chunk->badLinesSize = size;
+                        }
+                        chunk->badLines[chunk->nrBadLines++] = (struct badLine) {
+                                .line = chunk->nrLines, .offset = line - chunk->input
+                        };
+                        if (reserve(&chunk->output, &chunk->outputSize, chunk->outputLen, 1) != 0)
+                                chunk->error = errno;
+                        else
+                                chunk->output[chunk->outputLen++] = '\n';
+                }
+                chunk->nrLines++;
+                line = next + 1;
+        }
+}
+
+/*
+ *  Normalize the next queued chunk, if there is one. Called with the lock
+ *  held, which is released meanwhile. Return false if none was queued.
+ */
+static bool normalizeNext(struct normalizer *self)
+{
+        if (self->nrTaken == self->nrRead)
+                return false;
+
+        struct chunk *chunk = &self->chunks[self->nrTaken++ % self->nrChunks];
+        pthread_mutex_unlock(&self->lock);
+
+        normalizeChunk(chunk, self->withHash);
+
+        pthread_mutex_lock(&self->lock);
+        chunk->isDone = true;
+        pthread_cond_broadcast(&self->done);
+        return true;
+}
+
+// Normalize queued chunks until the input is finished
+static void normalizeQueued(struct normalizer *self)
+{
+        pthread_mutex_lock(&self->lock);
+        for (;;) {
+                if (normalizeNext(self))
+                        continue;
+                if (self->isFinished)
+                        break;
+                pthread_cond_wait(&self->queued, &self->lock);
+        }
+        pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ *  Read the next chunk, starting with the carry, which is the incomplete
+ *  last line of the previous one. Return the length, 0 at the end of the
+ *  input, or -1 on failure.
+ */
+static long readChunk(struct chunk *chunk, char **carry, size_t *carryLen, size_t *carrySize)
+{
+        if (reserve(&chunk->input, &chunk->inputSize, 0, *carryLen + chunkSize + 1) != 0)
+                return -1;
+        memcpy(chunk->input, *carry, *carryLen);
+        chunk->inputLen = *carryLen;
+
+        // Fill the chunk, and more if it doesn't hold a complete line yet
+        size_t lastNewline = 0; // just after it
+        for (;;) {
+                if (chunk->inputLen + 1 == chunk->inputSize) {
+                        if (lastNewline > 0)
+                                break;
+                        if (reserve(&chunk->input, &chunk->inputSize, chunk->inputLen, chunkSize + 1) != 0)
+                                return -1;
+                }
+                size_t n = fread(chunk->input + chunk->inputLen, 1,
+                                 chunk->inputSize - chunk->inputLen - 1, stdin);
+                if (n == 0)
+                        break;
+                for (size_t i=chunk->inputLen+n; i>chunk->inputLen; i--)
+                        if (chunk->input[i-1] == '\n') {
+                                lastNewline = i;
+                                break;
+                        }
+                chunk->inputLen += n;
+        }
+        if (ferror(stdin))
+                return -1;
+
+        // Carry the incomplete last line over, unless this is the end
+        *carryLen = 0;
+        if (!feof(stdin)) {
+                size_t len = chunk->inputLen - lastNewline;
+                if (reserve(carry, carrySize, 0, len + 1) != 0)
+                        return -1;
+                memcpy(*carry, chunk->input + lastNewline, len);
+                *carryLen = len;
+                chunk->inputLen = lastNewline;
+        }
+        return chunk->inputLen;
+}
+
+static int writeChunk(const char *program, struct chunk *chunk, unsigned long firstLine, unsigned long long firstOffset)
+{
+        for (size_t i=0; i<chunk->nrBadLines; i++) {
+                const char *line = chunk->input + chunk->badLines[i].offset;
+                fprintf(stderr, "%s: line %lu, offset %llu: Invalid FEN (%s)\n", program,
+                        firstLine + chunk->badLines[i].line,
+                        firstOffset + chunk->badLines[i].offset, line);
+        }
+        fwrite(chunk->output, 1, chunk->outputLen, stdout);
+        return (chunk->nrBadLines > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Read the chunks and write their results in input order
+static void feedChunks(struct normalizer *self)
+{
+        char *carry = NULL;
+        size_t carryLen = 0, carrySize = 0;
+        long nrWritten = 0;
+        unsigned long nrLines = 0;
+        unsigned long long offset = 0;
+        bool isEof = false;
+
+        for (;;) {
+                // Read ahead while there is a free chunk
+                if (!isEof && self->nrRead - nrWritten < self->nrChunks) {
+                        struct chunk *chunk = &self->chunks[self->nrRead % self->nrChunks];
+                        long len = readChunk(chunk, &carry, &carryLen, &carrySize);
+                        if (len < 0) {
+                                perror(self->program);
+                                self->exitStatus = EXIT_FAILURE;
+                        }
+                        if (len <= 0) {
+                                isEof = true;
+                                continue;
+                        }
+                        chunk->isDone = false;
+                        pthread_mutex_lock(&self->lock);
+                        self->nrRead++;
+                        pthread_cond_signal(&self->queued);
+                        pthread_mutex_unlock(&self->lock);
+                        continue;
+                }
+                if (nrWritten == self->nrRead)
+                        break;
+
+                // Write the oldest chunk when it is done, and help out meanwhile
+                struct chunk *chunk = &self->chunks[nrWritten % self->nrChunks];
+                pthread_mutex_lock(&self->lock);
+                while (!chunk->isDone)
+                        if (!normalizeNext(self))
+                                pthread_cond_wait(&self->done, &self->lock);
+                pthread_mutex_unlock(&self->lock);
+
+                if (chunk->error) {
+                        fprintf(stderr, "%s: %s\n", self->program, strerror(chunk->error));
+                        self->exitStatus = EXIT_FAILURE;
+                        break;
+                }
+                if (writeChunk(self->program, chunk, nrLines + 1, offset) != EXIT_SUCCESS)
+                        self->exitStatus = EXIT_FAILURE;
+                nrLines += chunk->nrLines;
+                offset += chunk->inputLen;
+                nrWritten++;
+        }
+        free(carry);
+
+        pthread_mutex_lock(&self->lock);
+        self->isFinished = true;
+        self->nrTaken = self->nrRead; // drop what is left after an error
+        pthread_cond_broadcast(&self->queued);
+        pthread_mutex_unlock(&self->lock);
+}
+
+static void normalizeWork(void *argument, int index)
+{
+        if (index == 0)
+                feedChunks(argument);
+        else
+                normalizeQueued(argument);
+}
+
+/*
+ *  normalize: standardized FEN for each line, keeping EPD operations,
+ *  optionally followed by the hash
+ */
+static int runNormalize(const char *program, int argc, char *argv[], struct options *options)
+{
+        if (argc > 1 || (argc == 1 && strcmp(argv[0], "hash") != 0))
+                return -1;
+
+        int nrThreads = resolveThreads(options->nrThreads);
+
+        struct normalizer self = {
+                .nrChunks = chunksPerThread * nrThreads,
+                .nrRead = 0, .nrTaken = 0,
+                .isFinished = false,
+                .withHash = (argc == 1),
+                .program = program,
+                .exitStatus = EXIT_SUCCESS
+        };
+        self.chunks = calloc(self.nrChunks, sizeof self.chunks[0]);
+        if (!self.chunks) {
+                perror(program);
+                return EXIT_FAILURE;
+        }
+        pthread_mutex_init(&self.lock, NULL);
+        pthread_cond_init(&self.queued, NULL);
+        pthread_cond_init(&self.done, NULL);
+
+        runWorkers(normalizeWork, &self, 1 + nrThreads); // worker 0 reads and writes
+
+        pthread_mutex_destroy(&self.lock);
+        pthread_cond_destroy(&self.queued);
+        pthread_cond_destroy(&self.done);
+        for (int i=0; i<self.nrChunks; i++) {
+                free(self.chunks[i].input);
+                free(self.chunks[i].output);
+                free(self.chunks[i].badLines);
+        }
+        free(self.chunks);
+
+        int exitStatus = self.exitStatus;
+        if (fflush(stdout) != 0) {
+                perror(program);
+                exitStatus = EXIT_FAILURE;
+        }
+        return exitStatus;
+}
+
+/*----------------------------------------------------------------------+
+ |      Command table                                                   |
+ +----------------------------------------------------------------------*/
+
+static const struct {
+        const char *name;
+        command_t *function; // for line commands
+        run_t *run;          // for other commands
+        bool hasDepth;
+        bool needsBitbase;
+} commands[] = {
+        { "moves",     commandMoves,     NULL,       false, false },
+        { "position",  commandPosition,  NULL,       false, false },
+        { "move",      commandMove,      NULL,       false, false },
+        { "hash",      commandHash,      NULL,       false, false },
+        { "canonical", commandCanonical, NULL,       false, false },
+        { "perft",     commandPerft,     NULL,       true,  false },
+        { "probe",     commandProbe,     NULL,       false, true  },
+        { "mate",      NULL,             runMate,    false, false },
+        { "games",     NULL,             runGames,   false, false },
+        { "samples",   NULL,             runSamples, false, false },
+        { "epd",       NULL,             runEpd,     false, false },
+        { "bitbase",   NULL,             runBitbase, false, false },
+        { "normalize", NULL,             runNormalize, false, false },
+        { "divide",    NULL,             runDivide,  false, false },
+        { "shards",    NULL,             runShards,  false, false },
+};
+
+enum { nrCommands = sizeof commands / sizeof commands[0] };
+
+/*----------------------------------------------------------------------+
+ |      main                                                            |
+ +----------------------------------------------------------------------*/
+
+static void usage(const char *program)
+{
+        fprintf(stderr,
+                "usage: %s [options] command [arguments]\n"
+                "\n"
+                "Read positions from stdin, one FEN per line, and write a result per line.\n"
+                "\n"
+                "Commands:\n"
+                "    moves        all legal moves and new positions, then an empty line\n"
+                "    position     standardized FEN\n"
+                "    move         normalized move and new position (input: FEN move)\n"
+                "    hash         Zobrist-Polyglot hash\n"
+                "    canonical    canonical position under color flip and mirror, its hash,\n"
+                "                 and the transform: 1 flips colors, 2 mirrors files\n"
+                "    perft depth  number of legal move paths, up to depth 13\n"
+                "    probe        bitbase result for the side to move: win, draw or loss\n"
+                "    mate depth   shortest forced mate: number of moves and main line, or 0\n"
+                "    normalize [hash]\n"
+                "                 standardized FEN, keeping EPD operations, and the hash if\n"
+                "                 requested; lines are processed in parallel\n"
+                "\n"
+                "    bitbase signature file\n"
+                "                 generate a bitbase, for example for KRKP (no input)\n"
+                "    games count  random games, one per line: moves and result (no input)\n"
+                "    samples count\n"
+                "                 a random position from each random game (no input)\n"
+                "    epd count depth\n"
+                "                 sampled positions with perft counts up to depth (no input)\n"
+                "    divide depth split manifest\n"
+                "                 write the shards of a perft: the positions at the split depth\n"
+                "                 from the start position (no input)\n"
+                "    shards manifest\n"
+                "                 compute unfinished shards, then the count per root move\n"
+                "                 and the total (no input)\n"
+                "\n"
+                "Options:\n"
+                "    -b file      bitbase file to probe\n"
+                "    -j threads   number of threads, at most 1024 (default: one per processor)\n"
+                "    -l plies     maximum length of random games (default: 400)\n"
+                "    -n notation  move notation: san (default), long or uci\n"
+                "    -p fen       start position of random games and divide (default: standard)\n"
+                "    -s seed      seed for random games (default: 0)\n"
+                "    -w q,c,p,k   weights of quiet moves, captures, promotions and checks\n"
+                "                 in random games, from 0 to 65535 (default: 1,1,1,1)\n",
+                program);
+        exit(EXIT_FAILURE);
+}
+
+// Apply a line command to all lines from stdin
+static int processLines(const char *program, command_t *function, const struct options *options)
+{
+        int exitStatus = EXIT_SUCCESS;
+        char *line = NULL;
+        size_t size = 0;
+        unsigned long lineNumber = 0;
+
+        while (getline(&line, &size, stdin) != -1) {
+                lineNumber++;
+                struct board board;
+                const char *error = function(&board, line, options);
+                if (error) {
+                        line[strcspn(line, "\n")] = '\0';
+                        fprintf(stderr, "%s: line %lu: %s (%s)\n", program, lineNumber, error, line);
+                        putchar('\n');
+                        exitStatus = EXIT_FAILURE;
+                }
+        }
+        free(line);
+
+        if (ferror(stdin) || fflush(stdout) != 0) {
+                perror(program);
+                exitStatus = EXIT_FAILURE;
+        }
+
+        return exitStatus;
+}
+
+int main(int argc, char *argv[])
+{
+        struct options options = {
+                .notation = sanNotation,
+                .depth = 1,
+                .nrThreads = 0,
+                .bitbasePath = NULL,
+                .startFen = startpos,
+                .playout = {
+                        .seed = 0,
+                        .maxPlies = 400,
+                        .weights = { 1, 1, 1, 1 },
+                        .perftDepth = 0
+                }
+        };
+
+        int c;
+        while ((c = getopt(argc, argv, "b:j:l:n:p:s:w:")) != -1) {
+                switch (c) {
+                case 'b':
+                        options.bitbasePath = optarg;
+                        break;
+                case 'j':
+                        options.nrThreads = atoi(optarg);
+                        if (options.nrThreads < 1 || options.nrThreads > maxThreads)
+                                usage(argv[0]);
+                        break;
+                case 'l':
+                        options.playout.maxPlies = atoi(optarg);
+                        if (options.playout.maxPlies < 1 || options.playout.maxPlies > maxGamePlies)
+                                usage(argv[0]);
+                        break;
+                case 'p':
+                        options.startFen = optarg;
+                        break;
+                case 's':
+                        options.playout.seed = strtoull(optarg, NULL, 0);
+                        break;
+                case 'w':
+                        ;
+                        int *w = options.playout.weights;
+                        if (sscanf(optarg, "%d,%d,%d,%d", &w[0], &w[1], &w[2], &w[3]) != 4
+                         || w[0] < 0 || w[1] < 0 || w[2] < 0 || w[3] < 0
+                         || w[0] > maxMoveWeight || w[1] > maxMoveWeight
+                         || w[2] > maxMoveWeight || w[3] > maxMoveWeight)
+                                usage(argv[0]);
+                        break;
+                case 'n':
+                        for (options.notation=0; options.notation<nrNotations; options.notation++)
+                                if (0==strcmp(notations[options.notation], optarg))
+                                        break; // found
+                        if (options.notation >= nrNotations) {
+                                fprintf(stderr, "%s: Invalid notation (%s)\n", argv[0], optarg);
+                                exit(EXIT_FAILURE);
+                        }
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+
+        if (optind >= argc)
+                usage(argv[0]);
+
+        int commandIndex;
+        for (commandIndex=0; commandIndex<nrCommands; commandIndex++)
+                if (0==strcmp(commands[commandIndex].name, argv[optind]))
+                        break; // found
+        if (commandIndex >= nrCommands)
+                usage(argv[0]);
+        optind++;
+
+        if (commands[commandIndex].run) {
+                int exitStatus = commands[commandIndex].run(argv[0], argc - optind, &argv[optind], &options);
+                if (exitStatus < 0)
+                        usage(argv[0]);
+                return exitStatus;
+        }
+
+        if (commands[commandIndex].hasDepth) {
+                if (optind >= argc)
+                        usage(argv[0]);
+                options.depth = atoi(argv[optind++]);
+                if (options.depth < 1 || options.depth > maxPerftDepth)
+                        usage(argv[0]);
+        }
+        if (optind != argc)
+                usage(argv[0]);
+
+        if (commands[commandIndex].needsBitbase) {
+                if (!options.bitbasePath)
+                        usage(argv[0]);
+                if (openBitbase(&options.bitbase, options.bitbasePath) != 0) {
+                        fprintf(stderr, "%s: %s: %s\n", argv[0], options.bitbasePath, strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        int exitStatus = processLines(argv[0], commands[commandIndex].function, &options);
+
+        if (commands[commandIndex].needsBitbase)
+                closeBitbase(&options.bitbase);
+
+        return exitStatus;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
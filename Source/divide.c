@@ -0,0 +1,516 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      divide.c -- sharded and resumable perft divide                  |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  Manifest layout, one item per line:
+ *
+ *      chessmoves perft manifest
+ *      fen <root position>
+ *      depth <depth> split <split depth>
+ *      moves <legal root moves in UCI notation>
+ *      <root move index> <number of paths> <position>   (one line per shard)
+ *
+ *  Results are lines of `<shard index> <count>', appended in completion
+ *  order with a single write each. A process computing a shard holds a
+ *  lock on the byte at the shard index in the results file. The kernel
+ *  releases it when the process dies, so a crash never blocks a shard.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// pread(), fsync()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Other module includes
+#include "Board.h"
+#include "perft.h"
+#include "workers.h"
+
+// Own include
+#include "divide.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+static const char manifestMagic[] = "chessmoves perft manifest";
+
+struct fenList {
+        char (*fens)[maxFenSize];
+        long size, capacity;
+};
+
+struct runner {
+        struct perftManifest *manifest;
+        pthread_mutex_t lock;
+        long next;
+        long nrSkipped;
+        int error;
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      Manifest                                                        |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Collect the positions at the end of all paths of the given length
+ */
+static int collectPositions(Board_t board, int depth, struct fenList *list)
+{
+        if (depth == 0) {
+                if (list->size == list->capacity) {
+                        long capacity = list->capacity ? 2 * list->capacity : 1024;
+                        void *fens = realloc(list->fens, capacity * sizeof list->fens[0]);
+                        if (!fens)
+                                return -1;
+                        list->fens = fens;
+                        list->capacity = capacity;
+                }
+                boardToFen(board, list->fens[list->size++]);
+                return 0;
+        }
+
+        int moveList[maxMoves];
+        updateSideInfo(board);
+        int nrMoves = generateMoves(board, moveList);
+
+        for (int i=0; i<nrMoves; i++) {
+                makeMove(board, moveList[i]);
+                updateSideInfo(board);
+                int result = 0;
+                if (board->side->attacks[board->xside->king] == 0)
+                        result = collectPositions(board, depth - 1, list);
+                undoMove(board);
+                if (result != 0)
+                        return -1;
+        }
+        return 0;
+}
+
+static int compareFens(const void *a, const void *b)
+{
+        return strcmp(a, b);
+}
+
+static int writeManifest(FILE *fp, Board_t board, int depth, int splitDepth, long *nrShards)
+{
+        char fen[maxFenSize];
+        boardToFen(board, fen);
+        fprintf(fp, "%s\nfen %s\ndepth %d split %d\nmoves", manifestMagic, fen, depth, splitDepth);
+
+        int moveList[maxMoves];
+        updateSideInfo(board);
+        int nrMoves = generateMoves(board, moveList);
+
+        int legalMoves[maxMoves];
+        int nrLegalMoves = 0;
+        for (int i=0; i<nrMoves; i++) {
+                if (isLegalMove(board, moveList[i])) {
+                        char moveString[maxMoveSize];
+                        legalMoves[nrLegalMoves++] = moveList[i];
+                        moveToUci(board, moveString, moveList[i]);
+                        fprintf(fp, " %s", moveString);
+                }
+        }
+        putc('\n', fp);
+
+        // Distinct positions under each root move, with the number of paths to them
+        struct fenList list = { .fens = NULL, .size = 0, .capacity = 0 };
+        *nrShards = 0;
+        for (int i=0; i<nrLegalMoves; i++) {
+                list.size = 0;
+                makeMove(board, legalMoves[i]);
+                int result = collectPositions(board, splitDepth - 1, &list);
+                undoMove(board);
+                if (result != 0) {
+                        free(list.fens);
+                        return -1;
+                }
+
+                qsort(list.fens, list.size, sizeof list.fens[0], compareFens);
+                for (long j=0; j<list.size; ) {
+                        long k = j + 1;
+                        while (k < list.size && strcmp(list.fens[j], list.fens[k]) == 0)
+                                k++;
+                        fprintf(fp, "%d %ld %s\n", i, k - j, list.fens[j]);
+                        (*nrShards)++;
+                        j = k;
+                }
+        }
+        free(list.fens);
+        return 0;
+}
+
+static char *resultsPath(const char *path)
+{
+        char *s = malloc(strlen(path) + sizeof ".results");
+        if (s)
+                sprintf(s, "%s.results", path);
+        return s;
+}
+
+/*----------------------------------------------------------------------+
+ |      writePerftManifest                                              |
+ +----------------------------------------------------------------------*/
+
+extern long writePerftManifest(Board_t board, int depth, int splitDepth, const char *path)
+{
+        if (splitDepth < 1 || splitDepth > maxDivideSplitDepth || depth < splitDepth) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        char *tmpPath = malloc(strlen(path) + sizeof ".tmp");
+        char *oldResults = resultsPath(path);
+        if (!tmpPath || !oldResults) {
+                free(tmpPath);
+                free(oldResults);
+                return -1;
+        }
+        sprintf(tmpPath, "%s.tmp", path);
+
+        long nrShards = -1;
+        FILE *fp = fopen(tmpPath, "w");
+        bool ok = fp != NULL;
+        if (ok) {
+                ok = writeManifest(fp, board, depth, splitDepth, &nrShards) == 0;
+                ok = (fclose(fp) == 0) && ok;
+                ok = ok && (remove(oldResults) == 0 || errno == ENOENT)
+                        && rename(tmpPath, path) == 0;
+                if (!ok) {
+                        int saveErrno = errno;
+                        remove(tmpPath);
+                        errno = saveErrno;
+                }
+        }
+
+        free(tmpPath);
+        free(oldResults);
+        return ok ? nrShards : -1;
+}
+
+/*----------------------------------------------------------------------+
+ |      Results                                                         |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Read the results that were appended since the last call
+ */
+static int readResults(struct perftManifest *self)
+{
+        char buffer[1 << 16];
+        for (;;) {
+                ssize_t n = pread(self->resultsFd, buffer, sizeof buffer - 1, self->resultsOffset);
+                if (n < 0)
+                        return -1;
+
+                // Only complete lines
+                while (n > 0 && buffer[n-1] != '\n')
+                        n--;
+                if (n == 0)
+                        return 0;
+                buffer[n] = '\0';
+                self->resultsOffset += n;
+
+                for (char *line=buffer; *line; line=strchr(line, '\n')+1) {
+                        long index;
+                        long long count;
+                        char end;
+                        if (sscanf(line, "%ld %lld%c", &index, &count, &end) == 3 && end == '\n'
+                         && index >= 0 && index < self->nrShards && count >= 0)
+                                self->shards[index].count = count;
+                }
+        }
+}
+
+static int lockShard(struct perftManifest *self, long index, int type)
+{
+        struct flock lock = {
+                .l_type   = type,
+                .l_whence = SEEK_SET,
+                .l_start  = index,
+                .l_len    = 1
+        };
+        return fcntl(self->resultsFd, F_SETLK, &lock);
+}
+
+static int writeResult(struct perftManifest *self, long index, long long count)
+{
+        char line[64];
+        int len = sprintf(line, "%ld %lld\n", index, count);
+        if (write(self->resultsFd, line, len) != len)
+                return -1;
+        return fsync(self->resultsFd);
+}
+
+/*----------------------------------------------------------------------+
+ |      openPerftManifest / closePerftManifest                          |
+ +----------------------------------------------------------------------*/
+
+static int readManifest(struct perftManifest *self, FILE *fp)
+{
+        char *line = NULL;
+        size_t size = 0;
+        char moves[maxMoves * maxMoveSize + sizeof "moves "];
+        struct board board;
+
+        bool ok = getline(&line, &size, fp) > 0
+               && strncmp(line, manifestMagic, sizeof manifestMagic - 1) == 0
+               && getline(&line, &size, fp) > 0
+               && sscanf(line, "fen %127[^\n]", self->rootFen) == 1
+               && setupBoard(&board, self->rootFen) > 0
+               && getline(&line, &size, fp) > 0
+               && sscanf(line, "depth %d split %d", &self->depth, &self->splitDepth) == 2
+               && self->splitDepth >= 1 && self->splitDepth <= self->depth
+               && getline(&line, &size, fp) > 0
+               && strlen(line) < sizeof moves
+               && strncmp(line, "moves", 5) == 0;
+
+        // Root moves
+        if (ok) {
+                strcpy(moves, line + 5);
+                int moveList[maxMoves];
+                updateSideInfo(&board);
+                int nrMoves = generateMoves(&board, moveList);
+                for (char *s=strtok(moves, " \n"); s && ok; s=strtok(NULL, " \n")) {
+                        int move;
+                        ok = self->nrRootMoves < maxMoves
+                          && parseMove(&board, s, moveList, nrMoves, &move) > 0;
+                        if (ok)
+                                self->rootMoves[self->nrRootMoves++] = move;
+                }
+        }
+
+        // Shards
+        long capacity = 0;
+        while (ok && getline(&line, &size, fp) > 0) {
+                if (self->nrShards == capacity) {
+                        capacity = capacity ? 2 * capacity : 1024;
+                        void *shards = realloc(self->shards, capacity * sizeof self->shards[0]);
+                        if (!shards) {
+                                free(line);
+                                return -1;
+                        }
+                        self->shards = shards;
+                }
+                struct perftShard *shard = &self->shards[self->nrShards++];
+                shard->count = -1;
+                ok = sscanf(line, "%d %llu %127[^\n]", &shard->rootMove, &shard->nrPaths, shard->fen) == 3
+                  && shard->rootMove >= 0 && shard->rootMove < self->nrRootMoves;
+        }
+
+        free(line);
+        if (ferror(fp))
+                return -1;
+        if (!ok) {
+                errno = EINVAL;
+                return -1;
+        }
+        return 0;
+}
+
+extern int openPerftManifest(struct perftManifest *self, const char *path)
+{
+        *self = (struct perftManifest) { .shards = NULL, .resultsFd = -1 };
+
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+                return -1;
+        int result = readManifest(self, fp);
+        int saveErrno = errno;
+        fclose(fp);
+
+        char *results = (result == 0) ? resultsPath(path) : NULL;
+        if (results) {
+                self->resultsFd = open(results, O_RDWR | O_CREAT | O_APPEND, 0666);
+                result = (self->resultsFd >= 0) ? readResults(self) : -1;
+                saveErrno = errno;
+                free(results);
+        } else
+                result = -1;
+
+        if (result != 0) {
+                closePerftManifest(self);
+                errno = saveErrno;
+                return -1;
+        }
+        return 0;
+}
+
+extern void closePerftManifest(struct perftManifest *self)
+{
+        if (self->resultsFd >= 0)
+                close(self->resultsFd); // releases the shard locks
+        free(self->shards);
+        *self = (struct perftManifest) { .shards = NULL, .resultsFd = -1 };
+}
+
+/*----------------------------------------------------------------------+
+ |      runPerftShards                                                  |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Take the next shard that is unfinished and not locked by another
+ *  process, and return its index, or -1 when there are no more.
+ *  Called with the runner locked.
+ */
+static long takeShard(struct runner *runner)
+{
+        struct perftManifest *manifest = runner->manifest;
+
+        while (runner->next < manifest->nrShards && !runner->error) {
+                long index = runner->next++;
+                if (manifest->shards[index].count >= 0)
+                        continue;
+
+                if (lockShard(manifest, index, F_WRLCK) != 0) {
+                        if (errno == EACCES || errno == EAGAIN)
+                                runner->nrSkipped++;
+                        else
+                                runner->error = errno;
+                        continue;
+                }
+
+                // Another process may have finished it before we took the lock
+                if (readResults(manifest) != 0)
+                        runner->error = errno;
+                else if (manifest->shards[index].count < 0)
+                        return index;
+
+                lockShard(manifest, index, F_UNLCK);
+        }
+        return -1;
+}
+
+static void work(void *argument, int i)
+{
+        struct runner *runner = argument;
+        struct perftManifest *manifest = runner->manifest;
+        int depth = manifest->depth - manifest->splitDepth;
+
+        pthread_mutex_lock(&runner->lock);
+        for (;;) {
+                long index = takeShard(runner);
+                if (index < 0)
+                        break;
+                pthread_mutex_unlock(&runner->lock);
+
+                struct board board;
+                setupBoard(&board, manifest->shards[index].fen);
+                long long count = perft(&board, depth);
+
+                pthread_mutex_lock(&runner->lock);
+                if (writeResult(manifest, index, count) == 0)
+                        manifest->shards[index].count = count;
+                else if (!runner->error)
+                        runner->error = errno;
+                lockShard(manifest, index, F_UNLCK);
+        }
+        pthread_mutex_unlock(&runner->lock);
+}
+
+extern long runPerftShards(struct perftManifest *self, int nrThreads)
+{
+        for (long i=0; i<self->nrShards; i++) {
+                struct board board;
+                if (setupBoard(&board, self->shards[i].fen) <= 0) {
+                        errno = EINVAL;
+                        return -1;
+                }
+        }
+
+        struct runner runner = { .manifest = self, .next = 0, .nrSkipped = 0, .error = 0 };
+        pthread_mutex_init(&runner.lock, NULL);
+
+        runWorkers(work, &runner, resolveThreads(nrThreads));
+        pthread_mutex_destroy(&runner.lock);
+
+        // Pick up what other processes have finished meanwhile
+        if (runner.error == 0 && readResults(self) != 0)
+                runner.error = errno;
+        if (runner.error != 0) {
+                errno = runner.error;
+                return -1;
+        }
+
+        long nrUnfinished = 0;
+        for (long i=0; i<self->nrShards; i++)
+                nrUnfinished += (self->shards[i].count < 0);
+        return nrUnfinished;
+}
+
+/*----------------------------------------------------------------------+
+ |      dividePerft                                                     |
+ +----------------------------------------------------------------------*/
+
+extern int dividePerft(const struct perftManifest *self, unsigned long long counts[maxMoves])
+{
+        for (int i=0; i<self->nrRootMoves; i++)
+                counts[i] = 0;
+
+        for (long i=0; i<self->nrShards; i++) {
+                const struct perftShard *shard = &self->shards[i];
+                if (shard->count < 0)
+                        return -1;
+                counts[shard->rootMove] += shard->nrPaths * shard->count;
+        }
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,62 @@
+
+/*
+ *  Sharded perft divide: split a deep perft into independent shards that
+ *  can be computed by several processes, and resumed after a restart
+ *
+ *  The manifest lists the distinct positions at the split depth under each
+ *  root move, with the number of paths that reach them. Each shard result
+ *  is appended to `manifest.results' as soon as it is known. Processes
+ *  working on the same manifest skip the shards that others hold a lock on.
+ */
+
+enum { maxDivideSplitDepth = 5 }; // to keep the manifest in memory
+
+struct perftShard {
+        int rootMove;                // index into the root moves
+        unsigned long long nrPaths;  // from the root to this position
+        long long count;             // perft of the remaining depth, or -1 if unfinished
+        char fen[maxFenSize];
+};
+
+struct perftManifest {
+        char rootFen[maxFenSize];
+        int depth;
+        int splitDepth;
+        int nrRootMoves;
+        int rootMoves[maxMoves];     // the legal moves in generation order
+        long nrShards;
+        struct perftShard *shards;
+        int resultsFd;
+        long long resultsOffset;     // how far the results have been read
+};
+
+/*
+ *  Enumerate the shards for a perft of the given depth and write the
+ *  manifest. Previous results for the same path are removed.
+ *  Return the number of shards, or -1 with errno set on failure.
+ */
+long writePerftManifest(Board_t board, int depth, int splitDepth, const char *path);
+
+/*
+ *  Read a manifest and the results that are already known.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int openPerftManifest(struct perftManifest *self, const char *path);
+
+/*
+ *  Release the manifest and the locks on its shards
+ */
+void closePerftManifest(struct perftManifest *self);
+
+/*
+ *  Compute all unfinished shards that no other process is working on.
+ *  With nrThreads <= 0, use one thread per processor. Return the number
+ *  of shards that are still unfinished, or -1 with errno set on failure.
+ */
+long runPerftShards(struct perftManifest *self, int nrThreads);
+
+/*
+ *  Merge the shard results into a count per root move.
+ *  Return 0 on success, or -1 if some shards are unfinished.
+ */
+int dividePerft(const struct perftManifest *self, unsigned long long counts[maxMoves]);
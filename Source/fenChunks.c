@@ -0,0 +1,131 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      fenChunks.c -- run batches of FENs in parallel chunks           |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <errno.h>
+#include <pthread.h>
+
+// Other module includes
+#include "workers.h"
+
+// Own include
+#include "fenChunks.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+struct batch {
+        const char *const *fens;
+        long nrFens;
+        fenChunkFunction *function;
+        void *context;
+        long next;              // next position to take
+        long firstInvalid;      // lowest index of an invalid FEN so far
+        pthread_mutex_t lock;
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+// Thread body: take chunks of positions until none are left
+static void work(void *argument, int index)
+{
+        struct batch *batch = argument;
+
+        for (;;) {
+                pthread_mutex_lock(&batch->lock);
+                long first = batch->next;
+                batch->next += fenChunkSize;
+                pthread_mutex_unlock(&batch->lock);
+                if (first >= batch->nrFens)
+                        break;
+
+                long last = (first + fenChunkSize < batch->nrFens) ? first + fenChunkSize : batch->nrFens;
+                long firstInvalid = batch->function(batch->context, batch->fens, first, last);
+
+                if (firstInvalid < last) {
+                        pthread_mutex_lock(&batch->lock);
+                        if (firstInvalid < batch->firstInvalid)
+                                batch->firstInvalid = firstInvalid;
+                        pthread_mutex_unlock(&batch->lock);
+                }
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |      runFenChunks                                                    |
+ +----------------------------------------------------------------------*/
+
+extern long runFenChunks(const char *const fens[], long nrFens, int nrThreads, fenChunkFunction *function, void *context)
+{
+        if (nrFens <= 0)
+                return 0;
+
+        nrThreads = resolveThreads(nrThreads);
+        long nrChunks = (nrFens + fenChunkSize - 1) / fenChunkSize;
+        if (nrThreads > nrChunks)
+                nrThreads = nrChunks;
+
+        struct batch batch = {
+                .fens = fens,
+                .nrFens = nrFens,
+                .function = function,
+                .context = context,
+                .next = 0,
+                .firstInvalid = nrFens,
+        };
+        if ((errno = pthread_mutex_init(&batch.lock, NULL)) != 0)
+                return -1;
+
+        runWorkers(work, &batch, nrThreads);
+        pthread_mutex_destroy(&batch.lock);
+        return batch.firstInvalid;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,21 @@
+
+/*
+ *  Parallel processing of a batch of FENs, in chunks that threads take
+ *  one at a time, for the batch encoders
+ */
+
+enum { fenChunkSize = 256 }; // positions that a thread takes at a time
+
+/*
+ *  Process the positions from first up to last, at most fenChunkSize of
+ *  them. Different chunks can run at the same time on different threads.
+ *  Return the index of the first invalid FEN, or last if all are valid.
+ */
+typedef long fenChunkFunction(void *context, const char *const fens[], long first, long last);
+
+/*
+ *  Run the function over all chunks of the batch. With nrThreads <= 0, use
+ *  one thread per processor. Return the index of the first invalid FEN, or
+ *  nrFens if all are valid, or -1 with errno set on failure.
+ */
+long runFenChunks(const char *const fens[], long nrFens, int nrThreads, fenChunkFunction *function, void *context);
@@ -45,6 +45,8 @@
 // Standard includes
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Own include
@@ -93,6 +95,24 @@ static const char promotionPieceToChar[] = { 'Q', 'R', 'B', 'N' };
  |      setupBoard                                                      |
  +----------------------------------------------------------------------*/
 
+enum { maxCounterDigits = 6 };
+
+/*
+ *  Helper to parse a move counter: digits up to white space or the end.
+ *  Return its length, or 0 if there is none, so that a following move
+ *  such as 0-0 or an EPD operation isn't mistaken for one.
+ */
+static int parseCounter(const char *s, int *value)
+{
+        int len = 0;
+        *value = 0;
+        while (isdigit((unsigned char)s[len]) && len < maxCounterDigits)
+                *value = 10 * *value + s[len++] - '0';
+        if (s[len] != '\0' && !isspace((unsigned char)s[len]))
+                return 0;
+        return len;
+}
+
 extern int setupBoard(Board_t self, const char *fen)
 {
         int ix = 0;
@@ -144,7 +164,6 @@ extern int setupBoard(Board_t self, const char *fen)
          */
 
         self->plyNumber = 2 + (fen[ix+1] == 'b'); // 2 means full move number starts at 1
-        //self->lastZeroing = self->plyNumber;
         ix += 2;
 
         /*
@@ -186,16 +205,78 @@ extern int setupBoard(Board_t self, const char *fen)
                         ix++;
         }
 
+        /*
+         *  Halfmove clock and fullmove number, both or neither
+         */
+
+        int halfmoves = 0;
+        int end = ix;
+        while (isspace(fen[end])) end++;
+        int len = parseCounter(&fen[end], &halfmoves);
+        if (len > 0) {
+                end += len;
+                while (isspace(fen[end])) end++;
+                int fullmoves;
+                len = parseCounter(&fen[end], &fullmoves);
+                if (len > 0) {
+                        ix = end + len;
+                        if (fullmoves > 1)
+                                self->plyNumber += 2 * (fullmoves - 1);
+                } else
+                        halfmoves = 0;
+        }
+        self->lastZeroing = self->plyNumber - halfmoves;
+
+        updateKeys(self);
+
 #ifndef NDEBUG
         self->debugSideInfoPlyNumber = -1; // side info is invalid
 #endif
 
         // Reset the undo stack
         self->undoLen = 0;
+        self->undoHeap = NULL;
+        self->undoHeapSize = 0;
 
         return ix;
 }
 
+/*----------------------------------------------------------------------+
+ |      freeBoard                                                       |
+ +----------------------------------------------------------------------*/
+
+extern void freeBoard(Board_t self)
+{
+        free(self->undoHeap);
+        self->undoHeap = NULL;
+        self->undoHeapSize = 0;
+        self->undoLen = 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      clearBoard                                                      |
+ +----------------------------------------------------------------------*/
+
+extern void clearBoard(Board_t self, int sideToMove)
+{
+        memset(self->squares, empty, boardSize);
+        self->plyNumber = 2 + sideToMove;
+        self->lastZeroing = self->plyNumber;
+        self->castleFlags = 0;
+        self->enPassantPawn = 0;
+        self->pawnKey = 0;
+        self->materialKey = 0;
+
+#ifndef NDEBUG
+        self->debugSideInfoPlyNumber = -1; // side info is invalid
+#endif
+
+        // Reset the undo stack
+        self->undoLen = 0;
+        self->undoHeap = NULL;
+        self->undoHeapSize = 0;
+}
+
 /*----------------------------------------------------------------------+
  |      Convert a move to UCI output                                    |
  +----------------------------------------------------------------------*/
@@ -362,30 +443,33 @@ extern const char *getCheckMark(Board_t self)
  |      Convert board to FEN notation                                   |
  +----------------------------------------------------------------------*/
 
-extern void boardToFen(Board_t self, char *fen)
+/*
+ *  Helper to emit the pieces of one rank. The pattern of pieces and empty
+ *  squares is hard to predict, so there are no branches on it: each
+ *  character is written, and the pointer only advances if it counts.
+ */
+static char *rankToFen(Board_t self, int rank, char *fen)
 {
-        /*
-         *  Squares
-         */
-        for (int rank=rank8; rank!=rank1-rankStep; rank-=rankStep) {
-                int emptySquares = 0;
-                for (int file=fileA; file!=fileH+fileStep; file+=fileStep) {
-                        int square = square(file, rank);
-                        int piece = self->squares[square];
-
-                        if (piece == empty) {
-                                emptySquares++;
-                                continue;
-                        }
-
-                        if (emptySquares > 0) *fen++ = '0' + emptySquares;
-                        *fen++ = pieceToChar[piece];
-                        emptySquares = 0;
-                }
-                if (emptySquares > 0) *fen++ = '0' + emptySquares;
-                if (rank != rank1) *fen++ = '/';
+        int emptySquares = 0;
+        for (int file=fileA; file!=fileH+fileStep; file+=fileStep) {
+                int square = square(file, rank);
+                int piece = self->squares[square];
+                bool isPiece = (piece != empty);
+
+                *fen = '0' + emptySquares;
+                fen += isPiece & (emptySquares > 0);
+                *fen = pieceToChar[piece];
+                fen += isPiece;
+                emptySquares = (emptySquares + 1) & -!isPiece; // reset on a piece
         }
+        *fen = '0' + emptySquares;
+        fen += (emptySquares > 0);
+        return fen;
+}
 
+// Helper to emit the fields after the piece placement
+static void fieldsToFen(Board_t self, char *fen, bool withCounters)
+{
         /*
          *  Side to move
          */
@@ -416,16 +500,78 @@ extern void boardToFen(Board_t self, char *fen)
                 *fen++ = '-';
 
         /*
-         *  Move number (TODO)
-         */
-
-        /*
-         *  Halfmove clock (TODO)
+         *  Halfmove clock and fullmove number
          */
+        if (withCounters) {
+                sprintf(fen, " %d %d", halfmoveClock(self), fullmoveNumber(self));
+                return;
+        }
 
         *fen = '\0';
 }
 
+// Helper to emit the piece placement
+static char *placementToFen(Board_t self, char *fen)
+{
+        for (int rank=rank8; rank!=rank1-rankStep; rank-=rankStep) {
+                fen = rankToFen(self, rank, fen);
+                if (rank != rank1) *fen++ = '/';
+        }
+        return fen;
+}
+
+extern void boardToFen(Board_t self, char *fen)
+{
+        fieldsToFen(self, placementToFen(self, fen), false);
+}
+
+extern void boardToFullFen(Board_t self, char *fen)
+{
+        fieldsToFen(self, placementToFen(self, fen), true);
+}
+
+/*----------------------------------------------------------------------+
+ |      Child positions in FEN notation                                 |
+ +----------------------------------------------------------------------*/
+
+extern void preparePlacement(Board_t self, struct fenPlacement *placement)
+{
+        char *fen = placement->text;
+        for (int rank=rank8; rank!=rank1-rankStep; rank-=rankStep) {
+                placement->start[rank] = fen - placement->text;
+                fen = rankToFen(self, rank, fen);
+                placement->end[rank] = fen - placement->text;
+                if (rank != rank1) *fen++ = '/';
+        }
+        placement->length = fen - placement->text;
+}
+
+/*
+ *  A move only changes the ranks of its from and to squares: a castling
+ *  rook and a pawn captured en passant are on one of these as well.
+ *  The text between them is copied from the parent.
+ */
+extern void childToFen(Board_t self, const struct fenPlacement *parent, int move, char *fen)
+{
+        int ranks[2] = { rank(from(move)), rank(to(move)) };
+        if (rankStep * (ranks[0] - ranks[1]) < 0) { // FEN order: from rank 8 down
+                ranks[0] = ranks[1];
+                ranks[1] = rank(from(move));
+        }
+
+        int copied = 0; // parent text up to here is done
+        for (int i=0; i<2; i++) {
+                if (i == 1 && ranks[1] == ranks[0])
+                        break;
+                int start = parent->start[ranks[i]];
+                memcpy(fen, parent->text + copied, start - copied);
+                fen = rankToFen(self, ranks[i], fen + (start - copied));
+                copied = parent->end[ranks[i]];
+        }
+        memcpy(fen, parent->text + copied, parent->length - copied);
+        fieldsToFen(self, fen + (parent->length - copied), false);
+}
+
 /*----------------------------------------------------------------------+
  |      Move parser                                                     |
  +----------------------------------------------------------------------*/
@@ -0,0 +1,343 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      gameCodec.c -- games as indices into ordered legal moves        |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Other module includes
+#include "Board.h"
+
+// Own include
+#include "gameCodec.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+enum { rankStep = rank2 - rank1, fileStep = fileB - fileA };
+
+#define fileIndex(square) ((file(square) - fileA) * fileStep)
+#define rankIndex(square) ((rank(square) - rank1) * rankStep)
+
+// Twice the distance from the center of the board, counted along both axes
+#define centerDistance(square) (abs(2 * fileIndex(square) - 7) + abs(2 * rankIndex(square) - 7))
+
+// Carryless range coder, after Subbotin
+enum {
+        rangeTop = 1 << 24,
+        rangeBottom = 1 << 16  // the model total must not exceed this
+};
+
+// Weight of index i in the static model is modelScale / (i + 1)
+enum { modelScale = 1 << 12 };
+
+/*----------------------------------------------------------------------+
+ |      Data                                                            |
+ +----------------------------------------------------------------------*/
+
+static const signed char pieceValues[] = {
+        [empty] = 0,
+        [whiteKing] = 0, [whiteQueen] = 9, [whiteRook] = 5,
+        [whiteBishop] = 3, [whiteKnight] = 3, [whitePawn] = 1,
+        [blackKing] = 0, [blackQueen] = 9, [blackRook] = 5,
+        [blackBishop] = 3, [blackKnight] = 3, [blackPawn] = 1,
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      orderMoves                                                      |
+ +----------------------------------------------------------------------*/
+
+// Helper to score a move for the order, with valid side info. Higher comes first.
+static int moveScore(Board_t self, int move)
+{
+        int from = from(move), to = to(move);
+        int piece = self->squares[from];
+        int victim = self->squares[to];
+        bool isPawn = (piece == whitePawn || piece == blackPawn);
+        bool isAttacked = self->xside->attacks[to] != 0;
+
+        if (move & specialMoveFlag) {
+                if (isPawn && isPromotion(self, from, to)) {
+                        int promotion = (move >> promotionBits) & 3;
+                        if (promotion == 0)
+                                return 900 + 16 * pieceValues[victim];
+                        return -900 - promotion; // underpromotions last
+                }
+                if (!isPawn)
+                        return 400; // castling
+                if (file(from) != file(to))
+                        return 500 + 16 - 1; // en passant: pawn takes pawn
+        }
+
+        if (victim != empty) {
+                int gain = 16 * pieceValues[victim] - pieceValues[piece];
+                return (isAttacked && pieceValues[victim] < pieceValues[piece]) ? 100 + gain : 500 + gain;
+        }
+
+        int score = 200 + 4 * (centerDistance(from) - centerDistance(to));
+        if (isAttacked && !isPawn)
+                score -= 150; // probably hanging
+        return score;
+}
+
+extern int orderMoves(Board_t self, int moveList[maxMoves])
+{
+        int pseudoMoves[maxMoves];
+        int keys[maxMoves];
+        updateSideInfo(self);
+        int nrMoves = generateMoves(self, pseudoMoves);
+
+        // Score first, because the legality test invalidates the side info
+        for (int i=0; i<nrMoves; i++) {
+                int move = pseudoMoves[i];
+                int tieBreak = (((8 * rankIndex(from(move)) + fileIndex(from(move))) << 6)
+                             + 8 * rankIndex(to(move)) + fileIndex(to(move))) << 2
+                             | ((move >> promotionBits) & 3);
+                keys[i] = moveScore(self, move) * (1 << 14) - tieBreak;
+        }
+
+        // Insertion sort of the legal moves, highest key first
+        int nrLegalMoves = 0;
+        int sortedKeys[maxMoves];
+        for (int i=0; i<nrMoves; i++) {
+                if (!isLegalMove(self, pseudoMoves[i]))
+                        continue;
+                int j = nrLegalMoves++;
+                for (; j>0 && sortedKeys[j-1] < keys[i]; j--) {
+                        sortedKeys[j] = sortedKeys[j-1];
+                        moveList[j] = moveList[j-1];
+                }
+                sortedKeys[j] = keys[i];
+                moveList[j] = pseudoMoves[i];
+        }
+        return nrLegalMoves;
+}
+
+/*----------------------------------------------------------------------+
+ |      Static model                                                    |
+ +----------------------------------------------------------------------*/
+
+#define modelWeight(index) (modelScale / ((index) + 1))
+
+// Sum of the weights below index. The total for n moves is modelSum(n).
+static unsigned int modelSum(int index)
+{
+        unsigned int sum = 0;
+        for (int i=0; i<index; i++)
+                sum += modelWeight(i);
+        return sum;
+}
+
+/*----------------------------------------------------------------------+
+ |      Writing                                                         |
+ +----------------------------------------------------------------------*/
+
+extern void startGameRecord(struct gameWriter *self, unsigned char *record, long nrPlies, int flags)
+{
+        self->record = record;
+        self->length = 0;
+        self->nrPlies = nrPlies;
+        self->flags = flags;
+        self->low = 0;
+        self->range = ~0u;
+
+        unsigned long n = nrPlies;
+        while (n >= 0x80) {
+                self->record[self->length++] = (n & 0x7f) | 0x80;
+                n >>= 7;
+        }
+        self->record[self->length++] = n;
+}
+
+// Helper to encode a range of the total weight
+static void encodeRange(struct gameWriter *self, unsigned int cumulative, unsigned int weight, unsigned int total)
+{
+        self->range /= total;
+        self->low += cumulative * self->range;
+        self->range *= weight;
+
+        for (;;) {
+                if ((self->low ^ (self->low + self->range)) >= rangeTop) {
+                        if (self->range >= rangeBottom)
+                                break;
+                        self->range = -self->low & (rangeBottom - 1);
+                }
+                self->record[self->length++] = self->low >> 24;
+                self->low <<= 8;
+                self->range <<= 8;
+        }
+}
+
+extern int writeGameMove(struct gameWriter *self, Board_t board, int move)
+{
+        int moveList[maxMoves];
+        int nrMoves = orderMoves(board, moveList);
+
+        int index = 0;
+        while (index < nrMoves && moveList[index] != move)
+                index++;
+        if (index == nrMoves)
+                return -1;
+
+        if (self->flags & gameCodecEntropy) {
+                encodeRange(self, modelSum(index), modelWeight(index), modelSum(nrMoves));
+        } else
+                self->record[self->length++] = index;
+        return 0;
+}
+
+extern size_t finishGameRecord(struct gameWriter *self)
+{
+        if ((self->flags & gameCodecEntropy) && self->nrPlies > 0)
+                for (int i=0; i<4; i++) {
+                        self->record[self->length++] = self->low >> 24;
+                        self->low <<= 8;
+                }
+        return self->length;
+}
+
+/*----------------------------------------------------------------------+
+ |      Reading                                                         |
+ +----------------------------------------------------------------------*/
+
+// Helper to get the next byte, or 0 past the end of the record
+static unsigned int nextByte(struct gameReader *self)
+{
+        if (self->length < self->size)
+                return self->record[self->length++];
+        self->isTruncated = true;
+        return 0;
+}
+
+extern long startGameRead(struct gameReader *self, const unsigned char *record, size_t size, int flags)
+{
+        self->record = record;
+        self->size = size;
+        self->length = 0;
+        self->flags = flags;
+        self->isTruncated = false;
+
+        unsigned long n = 0;
+        for (int shift=0; ; shift+=7) {
+                if (shift >= 7 * maxVarintSize)
+                        return -1;
+                unsigned int byte = nextByte(self);
+                n |= (unsigned long) (byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                        break;
+        }
+        if (self->isTruncated || n > (unsigned long) LONG_MAX)
+                return -1;
+        self->nrPlies = n;
+
+        self->low = 0;
+        self->range = ~0u;
+        self->code = 0;
+        if ((flags & gameCodecEntropy) && n > 0)
+                for (int i=0; i<4; i++)
+                        self->code = (self->code << 8) | nextByte(self);
+
+        return self->isTruncated ? -1 : self->nrPlies;
+}
+
+// Helper to decode the index of a move
+static int decodeIndex(struct gameReader *self, int nrMoves)
+{
+        unsigned int total = modelSum(nrMoves);
+
+        self->range /= total;
+        unsigned int value = (self->code - self->low) / self->range;
+        if (value >= total)
+                return -1;
+
+        int index = 0;
+        unsigned int cumulative = 0;
+        while (cumulative + modelWeight(index) <= value) {
+                cumulative += modelWeight(index);
+                index++;
+        }
+
+        self->low += cumulative * self->range;
+        self->range *= modelWeight(index);
+
+        for (;;) {
+                if ((self->low ^ (self->low + self->range)) >= rangeTop) {
+                        if (self->range >= rangeBottom)
+                                break;
+                        self->range = -self->low & (rangeBottom - 1);
+                }
+                self->code = (self->code << 8) | nextByte(self);
+                self->low <<= 8;
+                self->range <<= 8;
+        }
+        return index;
+}
+
+extern int readGameMove(struct gameReader *self, Board_t board, int moveList[maxMoves], int *nrMoves)
+{
+        *nrMoves = orderMoves(board, moveList);
+        if (*nrMoves == 0)
+                return -1;
+
+        int index = (self->flags & gameCodecEntropy) ? decodeIndex(self, *nrMoves) : (int) nextByte(self);
+        if (self->isTruncated || index < 0 || index >= *nrMoves)
+                return -1;
+        return moveList[index];
+}
+
+extern size_t finishGameRead(struct gameReader *self)
+{
+        return self->isTruncated ? 0 : self->length;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,82 @@
+
+/*
+ *  Game compression: each ply as the index of its move in the legal moves
+ *
+ *  orderMoves() puts the legal moves in a fixed order, likely moves first:
+ *  promotions to queen and captures of more valuable pieces, then castling
+ *  and quiet moves by their gain in centralization, then hanging pieces and
+ *  underpromotions. Ties go by the origin and destination squares from a1
+ *  to h8, so the order doesn't depend on the board geometry or the move
+ *  generator. A game record is the number of plies as a base-128 varint,
+ *  followed by the indices: one byte each, or with gameCodecEntropy, range
+ *  coded with a static model in which index i has a weight of 1/(i+1).
+ *  The decoder reads exactly the bytes of a record, so records can be
+ *  concatenated into a stream.
+ */
+
+enum gameCodecFlags {
+        gameCodecEntropy = 1 << 0
+};
+
+enum { maxVarintSize = 10 };
+
+// Bound on the size of a record
+#define maxGameRecordSize(nrPlies) (maxVarintSize + 4 + 4 * (size_t)(nrPlies))
+
+struct gameWriter {
+        unsigned char *record;
+        size_t length;
+        long nrPlies;
+        int flags;
+        unsigned int low, range; // range coder state
+};
+
+struct gameReader {
+        const unsigned char *record;
+        size_t size;
+        size_t length;           // bytes read so far
+        long nrPlies;
+        int flags;
+        bool isTruncated;
+        unsigned int low, range, code;
+};
+
+/*
+ *  Generate the legal moves in the codec order. Can invalidate the side info.
+ *  Return the number of legal moves.
+ */
+int orderMoves(Board_t self, int moveList[maxMoves]);
+
+/*
+ *  Start a record of nrPlies moves into a buffer of maxGameRecordSize(nrPlies)
+ */
+void startGameRecord(struct gameWriter *self, unsigned char *record, long nrPlies, int flags);
+
+/*
+ *  Add the next move, before it is made on the board. Return 0 on success,
+ *  or -1 if it isn't legal.
+ */
+int writeGameMove(struct gameWriter *self, Board_t board, int move);
+
+/*
+ *  Complete the record after writing all moves and return its size
+ */
+size_t finishGameRecord(struct gameWriter *self);
+
+/*
+ *  Start reading a record from at most size bytes. Return the number of
+ *  plies, or -1 if the record is cut short.
+ */
+long startGameRead(struct gameReader *self, const unsigned char *record, size_t size, int flags);
+
+/*
+ *  Read the next move and the legal moves in codec order. The move isn't
+ *  made on the board. Return the move, or -1 if the record is corrupt.
+ */
+int readGameMove(struct gameReader *self, Board_t board, int moveList[maxMoves], int *nrMoves);
+
+/*
+ *  After reading all moves, return the size of the record, or 0 if it was
+ *  corrupt
+ */
+size_t finishGameRead(struct gameReader *self);
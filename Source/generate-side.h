@@ -0,0 +1,234 @@
+
+/*
+ *  Move generator for one side to move. moves.c includes this file once
+ *  with sideIsWhite defined as 1 and once as 0, so that the color tests,
+ *  pawn directions, promotion rank and castling squares become constants.
+ */
+
+#if sideIsWhite
+ #define forSide(name)          name##White
+ #define ourSide                whiteSide
+ #define theirSide              blackSide
+ #define ourKing                whiteKing
+ #define ourQueen               whiteQueen
+ #define ourRook                whiteRook
+ #define ourBishop              whiteBishop
+ #define ourKnight              whiteKnight
+ #define ourPawn                whitePawn
+ #define isOurs(piece)          ((piece) != empty && (piece) < blackKing)
+ #define isTheirs(piece)        ((piece) >= blackKing)
+ #define pawnStep               stepN
+ #define homeRank               rank1
+ #define pawnRank               rank2
+ #define promotionRank          rank8
+ #define ourKside               castleFlagWhiteKside
+ #define ourQside               castleFlagWhiteQside
+#else
+ #define forSide(name)          name##Black
+ #define ourSide                blackSide
+ #define theirSide              whiteSide
+ #define ourKing                blackKing
+ #define ourQueen               blackQueen
+ #define ourRook                blackRook
+ #define ourBishop              blackBishop
+ #define ourKnight              blackKnight
+ #define ourPawn                blackPawn
+ #define isOurs(piece)          ((piece) >= blackKing)
+ #define isTheirs(piece)        ((piece) != empty && (piece) < blackKing)
+ #define pawnStep               stepS
+ #define homeRank               rank8
+ #define pawnRank               rank7
+ #define promotionRank          rank1
+ #define ourKside               castleFlagBlackKside
+ #define ourQside               castleFlagBlackQside
+#endif
+
+#define home(file) square(file, homeRank)
+
+// Helper to emit a pawn move. Promotions count as captures.
+static void forSide(pushPawnMove)(Board_t self, int from, int to, int kind, int kinds)
+{
+        if (rank(to) == promotionRank) {
+                if (!(kinds & captureMoves))
+                        return;
+                pushSpecialMove(self, from, to);
+                self->movePtr[-1] += queenPromotionFlags;
+
+                pushSpecialMove(self, from, to);
+                self->movePtr[-1] += rookPromotionFlags;
+
+                pushSpecialMove(self, from, to);
+                self->movePtr[-1] += bishopPromotionFlags;
+
+                pushSpecialMove(self, from, to);
+                self->movePtr[-1] += knightPromotionFlags;
+        } else if (kinds & kind)
+                pushMove(self, from, to); // normal pawn move
+}
+
+// Helper to generate slider moves
+static void forSide(generateSlides)(Board_t self, int from, int dirs, int kinds)
+{
+        dirs &= kingDirections[from];
+        int dir = 0;
+        do {
+                dir -= dirs; // pick next
+                dir &= dirs;
+                int vector = kingStep[dir];
+                int to = from;
+                do {
+                        to += vector;
+                        if (self->squares[to] != empty) {
+                                if (isTheirs(self->squares[to]) && (kinds & captureMoves))
+                                        pushMove(self, from, to);
+                                break;
+                        }
+                        if (kinds & quietMoves)
+                                pushMove(self, from, to);
+                } while (dir & kingDirections[to]);
+        } while (dirs -= dir); // remove and go to next
+}
+
+static int forSide(generateMoves)(Board_t self, int moveList[maxMoves], int kinds)
+{
+        self->movePtr = moveList;
+
+        for (int from=0; from<boardSize; from++) {
+                int piece = self->squares[from];
+                if (!isOurs(piece)) continue;
+
+                int to;
+
+                /*
+                 *  Generate moves for this piece
+                 */
+                switch (piece) {
+                        int dir, dirs;
+
+                case ourKing:
+                        dirs = kingDirections[from];
+                        dir = 0;
+                        do {
+                                dir -= dirs; // pick next
+                                dir &= dirs;
+                                to = from + kingStep[dir];
+                                if (isOurs(self->squares[to])) continue;
+                                if (self->theirSide.attacks[to] != 0) continue;
+                                if (kinds & (self->squares[to] != empty ? captureMoves : quietMoves))
+                                        pushMove(self, from, to);
+                        } while (dirs -= dir); // remove and go to next
+                        break;
+
+                case ourQueen:
+                        forSide(generateSlides)(self, from, dirsQueen, kinds);
+                        break;
+
+                case ourRook:
+                        forSide(generateSlides)(self, from, dirsRook, kinds);
+                        break;
+
+                case ourBishop:
+                        forSide(generateSlides)(self, from, dirsBishop, kinds);
+                        break;
+
+                case ourKnight:
+                        dirs = knightDirections[from];
+                        dir = 0;
+                        do {
+                                dir -= dirs; // pick next
+                                dir &= dirs;
+                                to = from + knightJump[dir];
+                                if (isOurs(self->squares[to])) continue;
+                                if (kinds & (self->squares[to] != empty ? captureMoves : quietMoves))
+                                        pushMove(self, from, to);
+                        } while (dirs -= dir); // remove and go to next
+                        break;
+
+                case ourPawn:
+                        if (file(from) != fileH) {
+                                to = from + pawnStep + stepE;
+                                if (isTheirs(self->squares[to]))
+                                        forSide(pushPawnMove)(self, from, to, captureMoves, kinds);
+                        }
+                        if (file(from) != fileA) {
+                                to = from + pawnStep + stepW;
+                                if (isTheirs(self->squares[to]))
+                                        forSide(pushPawnMove)(self, from, to, captureMoves, kinds);
+                        }
+                        to = from + pawnStep;
+                        if (self->squares[to] != empty)
+                                break;
+
+                        forSide(pushPawnMove)(self, from, to, quietMoves, kinds);
+                        if (rank(from) == pawnRank && (kinds & quietMoves)) {
+                                to += pawnStep;
+                                if (self->squares[to] == empty) {
+                                        pushMove(self, from, to);
+                                        if (self->theirSide.attacks[to-pawnStep])
+                                                self->movePtr[-1] |= specialMoveFlag;
+                                }
+                        }
+                        break;
+                }
+        }
+
+        /*
+         *  Generate castling moves
+         */
+        if ((self->castleFlags & (ourKside | ourQside))
+         && (kinds & quietMoves)
+         && self->theirSide.attacks[self->ourSide.king] == 0
+        ) {
+                if ((self->castleFlags & ourKside)
+                 && self->squares[home(fileF)] == empty
+                 && self->squares[home(fileG)] == empty
+                 && self->theirSide.attacks[home(fileF)] == 0
+                 && self->theirSide.attacks[home(fileG)] == 0
+                ) {
+                        pushSpecialMove(self, home(fileE), home(fileG));
+                }
+                if ((self->castleFlags & ourQside)
+                 && self->squares[home(fileD)] == empty
+                 && self->squares[home(fileC)] == empty
+                 && self->squares[home(fileB)] == empty
+                 && self->theirSide.attacks[home(fileD)] == 0
+                 && self->theirSide.attacks[home(fileC)] == 0
+                ) {
+                        pushSpecialMove(self, home(fileE), home(fileC));
+                }
+        }
+
+        /*
+         *  Generate en-passant captures
+         */
+        if (self->enPassantPawn && (kinds & captureMoves)) {
+                int ep = self->enPassantPawn;
+
+                if (file(ep) != fileA && self->squares[ep+stepW] == ourPawn)
+                        pushSpecialMove(self, ep + stepW, ep + pawnStep);
+                if (file(ep) != fileH && self->squares[ep+stepE] == ourPawn)
+                        pushSpecialMove(self, ep + stepE, ep + pawnStep);
+        }
+
+        return self->movePtr - moveList; // nrMoves
+}
+
+#undef forSide
+#undef ourSide
+#undef theirSide
+#undef ourKing
+#undef ourQueen
+#undef ourRook
+#undef ourBishop
+#undef ourKnight
+#undef ourPawn
+#undef isOurs
+#undef isTheirs
+#undef pawnStep
+#undef homeRank
+#undef pawnRank
+#undef promotionRank
+#undef ourKside
+#undef ourQside
+#undef home
+#undef sideIsWhite
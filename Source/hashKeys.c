@@ -0,0 +1,120 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      hashKeys.c -- hash keys of many positions                       |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <stdbool.h>
+
+// Other module includes
+#include "Board.h"
+#include "fenChunks.h"
+
+// Own include
+#include "hashKeys.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+struct batch {
+        unsigned long long *keys;
+        int flags;
+        int nrKeys;             // per position
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+// Helper to write the selected keys of a position, or zeros if the FEN is invalid
+static bool hashPosition(const char *fen, unsigned long long *keys, int flags)
+{
+        struct board board;
+        bool isValid = setupBoard(&board, fen) > 0;
+
+        if (flags & hashKeyPolyglot)
+                *keys++ = isValid ? hash64(&board) : 0;
+        if (flags & hashKeySecond)
+                *keys++ = isValid ? secondHash64(&board) : 0;
+        if (flags & hashKeyPawns)
+                *keys++ = isValid ? board.pawnKey : 0;
+        if (flags & hashKeyMaterial)
+                *keys++ = isValid ? board.materialKey : 0;
+
+        return isValid;
+}
+
+// Helper to hash a chunk of positions of a batch
+static long hashChunk(void *context, const char *const fens[], long first, long last)
+{
+        struct batch *batch = context;
+        long firstInvalid = last;
+
+        for (long i=first; i<last; i++)
+                if (!hashPosition(fens[i], &batch->keys[i * batch->nrKeys], batch->flags)
+                 && i < firstInvalid)
+                        firstInvalid = i;
+        return firstInvalid;
+}
+
+/*----------------------------------------------------------------------+
+ |      hashPositions                                                   |
+ +----------------------------------------------------------------------*/
+
+extern long hashPositions(const char *const fens[], long nrFens, void *keys, int flags, int nrThreads)
+{
+        struct batch batch = {
+                .keys = keys,
+                .flags = flags,
+                .nrKeys = 0,
+        };
+        for (int i=0; i<nrHashKeyKinds; i++)
+                batch.nrKeys += (flags >> i) & 1;
+
+        return runFenChunks(fens, nrFens, nrThreads, hashChunk, &batch);
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
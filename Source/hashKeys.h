@@ -0,0 +1,24 @@
+
+/*
+ *  Hash keys of many positions: the Polyglot key of hash64(), the second
+ *  key of secondHash64() that makes a 128-bit fingerprint with it, and the
+ *  pawn and material keys of the board, for grouping positions by their
+ *  pawn structure or by their material
+ */
+
+enum hashKeyFlags {
+        hashKeyPolyglot = 1 << 0,
+        hashKeySecond   = 1 << 1,
+        hashKeyPawns    = 1 << 2,
+        hashKeyMaterial = 1 << 3,
+        nrHashKeyKinds  = 4
+};
+
+/*
+ *  Parse positions and compute their keys in parallel. Each position gets
+ *  the keys selected by the flags, in the order of the flags, as consecutive
+ *  unsigned long longs. With nrThreads <= 0, use one thread per processor.
+ *  Invalid FENs get keys of 0. Return the index of the first invalid FEN,
+ *  or nrFens if all are valid, or -1 with errno set on failure.
+ */
+long hashPositions(const char *const fens[], long nrFens, void *keys, int flags, int nrThreads);
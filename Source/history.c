@@ -0,0 +1,116 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      history.c -- position keys for repetition detection             |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Other module includes
+#include "Board.h"
+
+// Own include
+#include "history.h"
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      initKeyHistory / freeKeyHistory                                 |
+ +----------------------------------------------------------------------*/
+
+extern void initKeyHistory(struct keyHistory *self)
+{
+        self->entries = NULL;
+        self->length = 0;
+        self->size = 0;
+}
+
+extern void freeKeyHistory(struct keyHistory *self)
+{
+        free(self->entries);
+        initKeyHistory(self);
+}
+
+/*----------------------------------------------------------------------+
+ |      pushKey / popKey                                                |
+ +----------------------------------------------------------------------*/
+
+extern int pushKey(struct keyHistory *self, Board_t board)
+{
+        if (self->length == self->size) {
+                int newSize = self->size ? 2 * self->size : 64;
+                struct keyEntry *entries = realloc(self->entries, newSize * sizeof *entries);
+                if (!entries)
+                        return -1;
+                self->entries = entries;
+                self->size = newSize;
+        }
+
+        unsigned long long key = hash64(board);
+        int repetitions = 0;
+
+        // Same side to move, and no irreversible move in between
+        int oldest = self->length - halfmoveClock(board);
+        for (int i=self->length-2; i>=0 && i>=oldest; i-=2) {
+                if (self->entries[i].key == key) {
+                        repetitions = self->entries[i].repetitions + 1;
+                        break;
+                }
+        }
+
+        self->entries[self->length++] = (struct keyEntry) { .key = key, .repetitions = repetitions };
+        return repetitions;
+}
+
+extern void popKey(struct keyHistory *self)
+{
+        if (self->length > 0)
+                self->length--;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,43 @@
+
+/*
+ *  Position keys along a game, to detect repeated positions
+ *
+ *  Each entry remembers how often its position occurred before. Only
+ *  positions since the last capture or pawn move can be the same, so
+ *  pushKey() looks back at most the halfmove clock, at every other ply,
+ *  and can stop at the first match: that entry has the count so far.
+ */
+
+struct keyEntry {
+        unsigned long long key;  // from hash64()
+        int repetitions;         // earlier occurrences of the position
+};
+
+struct keyHistory {
+        struct keyEntry *entries;
+        int length;
+        int size;
+};
+
+/*
+ *  Start an empty history
+ */
+void initKeyHistory(struct keyHistory *self);
+
+/*
+ *  Release the entries
+ */
+void freeKeyHistory(struct keyHistory *self);
+
+/*
+ *  Add the current position, normally after each makeMove. This computes
+ *  its key, which can invalidate the side info. Return how often the
+ *  position occurred before, so 2 for a threefold repetition, or -1 with
+ *  errno set on failure.
+ */
+int pushKey(struct keyHistory *self, Board_t board);
+
+/*
+ *  Remove the last position, normally after undoMove
+ */
+void popKey(struct keyHistory *self);
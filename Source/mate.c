@@ -0,0 +1,462 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      mate.c -- search for forced mates                               |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  The search is a boolean proof search. attack() tells if the side to
+ *  move can mate within a given number of moves, and defend() if the
+ *  side to move can't escape from that. The attacker tries checks
+ *  first, then captures, then the other moves. When only one move is
+ *  left, only checks are generated.
+ *
+ *  Transposition table entries hold bounds that are true regardless of
+ *  how the position was reached: a number of moves the attacker surely
+ *  mates in, and a number of moves the attacker surely doesn't mate in.
+ *  Iterative deepening at the root then finds the shortest mate.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Other module includes
+#include "Board.h"
+#include "budget.h"
+#include "workers.h"
+
+// Own include
+#include "mate.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+struct mateEntry {
+        unsigned long long key;
+        unsigned short move;    // mating move, or refutation
+        unsigned char mateIn;   // attacker mates within this many moves, 0 if unknown
+        unsigned char noMateIn; // attacker doesn't mate within this many moves
+};
+
+struct batch {
+        struct mateProblem *problems;
+        int nrProblems;
+        int depth;
+        struct budget *budget;
+        struct mateSolver *solvers; // one per worker
+        int next; // next problem to take
+        pthread_mutex_t lock;
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static bool defend(struct mateSolver *self, Board_t board, int depth);
+
+/*----------------------------------------------------------------------+
+ |      initMateSolver / freeMateSolver                                 |
+ +----------------------------------------------------------------------*/
+
+extern int initMateSolver(struct mateSolver *self, size_t tableSize)
+{
+        unsigned long nrEntries = 1;
+        while (2 * nrEntries * sizeof(struct mateEntry) <= tableSize)
+                nrEntries *= 2;
+
+        self->table = calloc(nrEntries, sizeof(struct mateEntry));
+        if (!self->table)
+                return -1;
+
+        self->tableMask = nrEntries - 1;
+        self->nodes = 0;
+        self->budget = NULL;
+        self->pending = 0;
+        self->isStopped = false;
+        return 0;
+}
+
+extern void freeMateSolver(struct mateSolver *self)
+{
+        free(self->table);
+        self->table = NULL;
+}
+
+/*----------------------------------------------------------------------+
+ |      Transposition table                                             |
+ +----------------------------------------------------------------------*/
+
+static struct mateEntry *probe(struct mateSolver *self, unsigned long long key)
+{
+        struct mateEntry *entry = &self->table[key & self->tableMask];
+        return (entry->key == key) ? entry : NULL;
+}
+
+static void store(struct mateSolver *self, unsigned long long key, int depth, bool isMate, int move)
+{
+        struct mateEntry *entry = &self->table[key & self->tableMask];
+        if (entry->key != key)
+                *entry = (struct mateEntry) { .key = key };
+
+        if (isMate) {
+                if (entry->mateIn == 0 || depth < entry->mateIn)
+                        entry->mateIn = depth;
+        } else {
+                if (depth > entry->noMateIn)
+                        entry->noMateIn = depth;
+        }
+        if (move)
+                entry->move = move;
+}
+
+/*----------------------------------------------------------------------+
+ |      Move generation                                                 |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Generate the legal moves of the given kinds, checks first, then
+ *  captures, then the rest. The hash move goes in front of its group.
+ *  Expects the side info to be valid, which it no longer is on return.
+ */
+static int generateLegalMoves(Board_t board, int moveList[maxMoves], int kinds, int hashMove, int *nrChecks)
+{
+        int pseudoMoves[maxMoves];
+        int nrPseudoMoves = generateMovesOfKind(board, pseudoMoves, kinds);
+
+        int checks[maxMoves], captures[maxMoves], others[maxMoves];
+        int nrCaptures = 0, nrOthers = 0;
+        *nrChecks = 0;
+
+        for (int i=0; i<nrPseudoMoves; i++) {
+                int move = pseudoMoves[i];
+                bool isCapture = board->squares[to(move)] != empty;
+
+                makeMove(board, move);
+                updateSideInfo(board);
+                bool isLegal = board->side->attacks[board->xside->king] == 0;
+                bool isCheck = board->xside->attacks[board->side->king] != 0;
+                undoMove(board);
+
+                if (!isLegal)
+                        continue;
+
+                int *group = isCheck ? &checks[(*nrChecks)++]
+                           : isCapture ? &captures[nrCaptures++]
+                           : &others[nrOthers++];
+                *group = move;
+
+                if (move == hashMove) {
+                        int *first = isCheck ? checks : isCapture ? captures : others;
+                        *group = *first;
+                        *first = move;
+                }
+        }
+
+        int nrMoves = 0;
+        for (int i=0; i<*nrChecks; i++)
+                moveList[nrMoves++] = checks[i];
+        for (int i=0; i<nrCaptures; i++)
+                moveList[nrMoves++] = captures[i];
+        for (int i=0; i<nrOthers; i++)
+                moveList[nrMoves++] = others[i];
+
+        return nrMoves;
+}
+
+// Is there any legal move? Expects the side info to be valid.
+static bool hasLegalMove(Board_t board)
+{
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(board, moveList);
+        for (int i=0; i<nrMoves; i++)
+                if (isLegalMove(board, moveList[i]))
+                        return true;
+        return false;
+}
+
+/*----------------------------------------------------------------------+
+ |      Search                                                          |
+ +----------------------------------------------------------------------*/
+
+// Can the side to move mate within depth moves?
+static bool attack(struct mateSolver *self, Board_t board, int depth)
+{
+        unsigned long long key = hash64(board);
+        int hashMove = 0;
+
+        struct mateEntry *entry = probe(self, key);
+        if (entry) {
+                if (entry->mateIn > 0 && entry->mateIn <= depth)
+                        return true;
+                if (entry->noMateIn >= depth)
+                        return false;
+                hashMove = entry->move;
+        }
+
+        int moveList[maxMoves];
+        int nrChecks;
+        updateSideInfo(board);
+        int kinds = (depth == 1) ? checkingMoves : allMoves; // only a check can mate at once
+        int nrMoves = generateLegalMoves(board, moveList, kinds, hashMove, &nrChecks);
+
+        int mateMove = 0;
+        for (int i=0; i<nrMoves && !mateMove && !self->isStopped; i++) {
+                makeMove(board, moveList[i]);
+                self->nodes++;
+                self->isStopped = countNode(self->budget, &self->pending);
+                if (defend(self, board, depth - 1))
+                        mateMove = moveList[i];
+                undoMove(board);
+        }
+
+        if (self->isStopped)
+                return false; // unfinished, so neither a result nor an entry
+
+        store(self, key, depth, mateMove != 0, mateMove);
+        return mateMove != 0;
+}
+
+// Can the side to move not escape from mate within depth moves of the opponent?
+static bool defend(struct mateSolver *self, Board_t board, int depth)
+{
+        if (depth == 0) {
+                updateSideInfo(board);
+                return inCheck(board) && !hasLegalMove(board);
+        }
+
+        // Keep apart from the entry for when the side to move is the attacker
+        unsigned long long key = ~hash64(board);
+        int hashMove = 0;
+
+        struct mateEntry *entry = probe(self, key);
+        if (entry) {
+                if (entry->mateIn > 0 && entry->mateIn <= depth)
+                        return true;
+                if (entry->noMateIn >= depth)
+                        return false;
+                hashMove = entry->move;
+        }
+
+        updateSideInfo(board); // after hash64(), which can invalidate it
+        bool isCheck = inCheck(board);
+
+        int moveList[maxMoves];
+        int nrChecks;
+        int nrMoves = generateLegalMoves(board, moveList, allMoves, hashMove, &nrChecks);
+        if (nrMoves == 0)
+                return isCheck; // checkmate or stalemate
+
+        int refutation = 0;
+        for (int i=0; i<nrMoves && !refutation && !self->isStopped; i++) {
+                makeMove(board, moveList[i]);
+                self->nodes++;
+                self->isStopped = countNode(self->budget, &self->pending);
+                if (!attack(self, board, depth))
+                        refutation = moveList[i];
+                undoMove(board);
+        }
+
+        if (self->isStopped)
+                return false;
+
+        store(self, key, depth, refutation == 0, refutation);
+        return refutation == 0;
+}
+
+// Shortest mate for the side to move, or 0 if there is none within depth moves
+static int mateDistance(struct mateSolver *self, Board_t board, int depth)
+{
+        for (int n=1; n<=depth && !self->isStopped; n++)
+                if (attack(self, board, n))
+                        return n;
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      solveMate                                                       |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Follow a shortest mate: the attacker keeps the mate distance and
+ *  the defender takes the reply that postpones the mate the longest.
+ */
+static void principalVariation(struct mateSolver *self, Board_t board, int mate, int pv[maxMatePlies])
+{
+        int moveList[maxMoves];
+        int nrChecks;
+        int nrPlies = 0;
+
+        for (;;) {
+                updateSideInfo(board);
+                int nrMoves = generateLegalMoves(board, moveList, allMoves, 0, &nrChecks);
+                int i;
+                for (i=0; i<nrMoves; i++) {
+                        makeMove(board, moveList[i]);
+                        if (defend(self, board, mate - 1))
+                                break; // keep the move on the board
+                        undoMove(board);
+                }
+                assert(i < nrMoves);
+                pv[nrPlies++] = moveList[i];
+
+                if (--mate == 0)
+                        break;
+
+                updateSideInfo(board);
+                nrMoves = generateLegalMoves(board, moveList, allMoves, 0, &nrChecks);
+                int longest = 0, reply = 0;
+                for (i=0; i<nrMoves; i++) {
+                        makeMove(board, moveList[i]);
+                        int distance = mateDistance(self, board, mate);
+                        undoMove(board);
+                        if (distance > longest) {
+                                longest = distance;
+                                reply = moveList[i];
+                        }
+                }
+                assert(longest == mate);
+                makeMove(board, reply);
+                pv[nrPlies++] = reply;
+        }
+
+        while (nrPlies-- > 0)
+                undoMove(board);
+}
+
+extern int solveMate(struct mateSolver *self, Board_t board, int depth, int pv[maxMatePlies])
+{
+        if (depth > maxMateDepth)
+                depth = maxMateDepth;
+
+        self->isStopped = false;
+        int mate = mateDistance(self, board, depth);
+        flushNodes(self->budget, &self->pending);
+        if (self->isStopped)
+                return -1;
+
+        if (mate > 0) {
+                // The table has the answers, and a partial variation is of no use
+                struct budget *budget = self->budget;
+                self->budget = NULL;
+                principalVariation(self, board, mate, pv);
+                self->budget = budget;
+        }
+        return mate;
+}
+
+/*----------------------------------------------------------------------+
+ |      solveMates                                                      |
+ +----------------------------------------------------------------------*/
+
+// Thread body: take problems from the batch until none are left
+static void work(void *argument, int index)
+{
+        struct batch *batch = argument;
+        struct mateSolver *solver = &batch->solvers[index];
+
+        for (;;) {
+                pthread_mutex_lock(&batch->lock);
+                int i = batch->next++;
+                pthread_mutex_unlock(&batch->lock);
+                if (i >= batch->nrProblems)
+                        break;
+
+                struct mateProblem *problem = &batch->problems[i];
+                if (batch->budget && getBudgetStop(batch->budget) != budgetRunning)
+                        problem->mate = -1; // don't search anymore
+                else
+                        problem->mate = solveMate(solver, &problem->board, batch->depth, problem->pv);
+        }
+}
+
+extern int solveMates(struct mateProblem problems[], int nrProblems, int depth, int nrThreads, size_t tableSize,
+                      struct budget *budget)
+{
+        if (nrProblems <= 0)
+                return 0;
+
+        nrThreads = resolveThreads(nrThreads);
+        if (nrThreads > nrProblems)
+                nrThreads = nrProblems;
+
+        struct mateSolver solvers[nrThreads];
+        struct batch batch = {
+                .problems = problems,
+                .nrProblems = nrProblems,
+                .depth = depth,
+                .budget = budget,
+                .solvers = solvers,
+                .next = 0,
+        };
+        if ((errno = pthread_mutex_init(&batch.lock, NULL)) != 0)
+                return -1;
+
+        int nrSolvers;
+        for (nrSolvers=0; nrSolvers<nrThreads; nrSolvers++) {
+                if (initMateSolver(&solvers[nrSolvers], tableSize) != 0)
+                        break;
+                solvers[nrSolvers].budget = budget;
+        }
+
+        int result = -1;
+        if (nrSolvers == nrThreads) {
+                runWorkers(work, &batch, nrThreads);
+                result = 0;
+        }
+
+        int saveErrno = errno;
+        for (int i=0; i<nrSolvers; i++)
+                freeMateSolver(&solvers[i]);
+        pthread_mutex_destroy(&batch.lock);
+        errno = saveErrno;
+
+        return result;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,71 @@
+
+/*
+ *  Mate solver: find the shortest forced mate for the side to move
+ */
+
+/*
+ *  The search cost grows exponentially with the depth, and deeper mates
+ *  are out of reach without a budget. The limit also sizes the principal
+ *  variation buffers, such as the one in each struct mateProblem.
+ */
+enum {
+        maxMateDepth = 8, // in moves
+        maxMatePlies = 2 * maxMateDepth - 1
+};
+
+#define defaultMateTableSize (16 << 20) // bytes
+
+struct mateEntry;
+struct budget;
+
+/*
+ *  A solver has a transposition table that is kept between searches,
+ *  because entries don't depend on the root position. One solver can
+ *  be used by one thread at a time.
+ */
+struct mateSolver {
+        struct mateEntry *table;
+        unsigned long tableMask;
+        unsigned long long nodes; // moves made since initialization
+        struct budget *budget;    // started by the caller, or NULL for no limit
+        int pending;              // nodes not charged to the budget yet
+        bool isStopped;           // the budget ran out during the search
+};
+
+/*
+ *  A position to solve in a batch, and the result
+ */
+struct mateProblem {
+        struct board board;
+        int mate;              // moves to mate, 0 if there is none, or -1 if the budget ran out
+        int pv[maxMatePlies];  // principal variation, 2*mate-1 plies long
+};
+
+/*
+ *  Allocate the transposition table, rounding tableSize down to a power of two.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int initMateSolver(struct mateSolver *self, size_t tableSize);
+
+/*
+ *  Release the transposition table
+ */
+void freeMateSolver(struct mateSolver *self);
+
+/*
+ *  Search for a forced mate in at most depth moves, with iterative deepening.
+ *  Return the number of moves of the shortest mate, or 0 if there is none.
+ *  The principal variation goes into pv, with the longest defence at every
+ *  ply. The position is unchanged on return. Return -1 if the solver's
+ *  budget runs out before the search completes.
+ */
+int solveMate(struct mateSolver *self, Board_t board, int depth, int pv[maxMatePlies]);
+
+/*
+ *  Solve many positions in parallel, each thread with its own solver.
+ *  With nrThreads <= 0, use one thread per processor. The threads share
+ *  the budget, which can be NULL. Once it is exhausted, the remaining
+ *  problems get mate -1. Return 0 on success, or -1 with errno set on failure.
+ */
+int solveMates(struct mateProblem problems[], int nrProblems, int depth, int nrThreads, size_t tableSize,
+               struct budget *budget);
@@ -0,0 +1,124 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      moveCount.c -- legal move counts of many positions              |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <stdbool.h>
+#include <string.h>
+
+// Other module includes
+#include "Board.h"
+#include "fenChunks.h"
+
+// Own include
+#include "moveCount.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+// Positions that are parsed and counted at a time
+enum { groupSize = 64 };
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+// Helper to count a group of positions. Return the index of the first invalid FEN, or last.
+static long countGroup(const char *const fens[], unsigned char *out, long first, long last)
+{
+        struct board boards[groupSize];
+        Board_t valid[groupSize];
+        long index[groupSize];
+        int nrValid = 0;
+        long firstInvalid = last;
+
+        for (long i=first; i<last; i++) {
+                Board_t board = &boards[nrValid];
+                if (setupBoard(board, fens[i]) > 0) {
+                        valid[nrValid] = board;
+                        index[nrValid++] = i;
+                } else {
+                        memset(&out[i * moveCountSize], 0xff, moveCountSize);
+                        if (i < firstInvalid)
+                                firstInvalid = i;
+                }
+        }
+
+        int counts[groupSize];
+        bool isInCheck[groupSize];
+        countLegalMoves(valid, nrValid, counts, isInCheck);
+
+        for (int j=0; j<nrValid; j++) {
+                out[index[j] * moveCountSize + 0] = counts[j];
+                out[index[j] * moveCountSize + 1] = isInCheck[j];
+        }
+        return firstInvalid;
+}
+
+// Helper to count a chunk of positions, a group at a time
+static long countChunk(void *context, const char *const fens[], long first, long last)
+{
+        long firstInvalid = last;
+        for (long i=first; i<last; i+=groupSize) {
+                long end = (i + groupSize < last) ? i + groupSize : last;
+                long invalid = countGroup(fens, context, i, end);
+                if (invalid < end && invalid < firstInvalid)
+                        firstInvalid = invalid;
+        }
+        return firstInvalid;
+}
+
+/*----------------------------------------------------------------------+
+ |      countMoves                                                      |
+ +----------------------------------------------------------------------*/
+
+extern long countMoves(const char *const fens[], long nrFens, unsigned char *out, int nrThreads)
+{
+        return runFenChunks(fens, nrFens, nrThreads, countChunk, out);
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
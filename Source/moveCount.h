@@ -0,0 +1,19 @@
+
+/*
+ *  Legal move counts of many positions, for bulk queries such as finding
+ *  the checkmates and stalemates in a large set of positions
+ *
+ *  Each position gives two bytes: the number of legal moves, and 1 if the
+ *  side to move is in check or 0 if not. Checkmate is 0 moves and 1, and
+ *  stalemate is 0 and 0.
+ */
+
+enum { moveCountSize = 2 }; // bytes per position
+
+/*
+ *  Parse and count positions in parallel, into consecutive moveCountSize
+ *  bytes. With nrThreads <= 0, use one thread per processor. Invalid FENs
+ *  get 255 in both bytes. Return the index of the first invalid FEN, or
+ *  nrFens if all are valid, or -1 with errno set on failure.
+ */
+long countMoves(const char *const fens[], long nrFens, unsigned char *out, int nrThreads);
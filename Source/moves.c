@@ -46,6 +46,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Own include
@@ -55,6 +56,15 @@
 #include "polyglot.h"
 #include "stringCopy.h"
 
+// Vector intrinsics, for the attack maps
+#if defined(__GNUC__) && defined(__x86_64__)
+ #define haveAvx2 1
+ #define avx2 __attribute__((target("avx2")))
+ #include <immintrin.h>
+#else
+ #define haveAvx2 0
+#endif
+
 /*----------------------------------------------------------------------+
  |      Definitions                                                     |
  +----------------------------------------------------------------------*/
@@ -86,11 +96,44 @@ enum {
 // Off-board offsets for use in the undo stack
 #define offsetof_castleFlags   offsetof(struct board, castleFlags)
 #define offsetof_enPassantPawn offsetof(struct board, enPassantPawn)
+#define offsetof_lastZeroing   offsetof(struct board, lastZeroing)
+
+// Polyglot numbering of the squares, from a1 to h8
+#define polyglotSquare(square) \
+        (8 * (rank(square) - rank1) * (rank2 - rank1) + (file(square) - fileA) * (fileB - fileA))
+
+// Undo stack space that makeMove may need (a promotion that captures a rook with castling rights takes 21)
+enum { maxUndoPerMove = 24 };
 
 /*----------------------------------------------------------------------+
  |      Data                                                            |
  +----------------------------------------------------------------------*/
 
+/*
+ *  Polyglot numbering of the pieces, in RandomPiece[]
+ */
+static const int polyglotOffsets[] = {
+        [blackPawn]   = 0 * 64, [whitePawn]   = 1 * 64,
+        [blackKnight] = 2 * 64, [whiteKnight] = 3 * 64,
+        [blackBishop] = 4 * 64, [whiteBishop] = 5 * 64,
+        [blackRook]   = 6 * 64, [whiteRook]   = 7 * 64,
+        [blackQueen]  = 8 * 64, [whiteQueen]  = 9 * 64,
+        [blackKing]   = 10 * 64, [whiteKing]  = 11 * 64,
+};
+
+/*
+ *  Random values for the material key, in which each piece adds its own
+ */
+static const unsigned long long materialKeys[] = {
+        [empty]       = 0,
+        [whiteKing]   = 0x582600e9111f4efdULL, [whiteQueen]  = 0xeeee318369ca47e7ULL,
+        [whiteRook]   = 0x52d095151c4a09caULL, [whiteBishop] = 0x8dea3aa4c08a6073ULL,
+        [whiteKnight] = 0xcec8129282e394bdULL, [whitePawn]   = 0xae0b65170cb76f5aULL,
+        [blackKing]   = 0xc2232d710b7880d7ULL, [blackQueen]  = 0x46a32f42bc66323aULL,
+        [blackRook]   = 0x746f25d427837704ULL, [blackBishop] = 0x0b9f15ecbbd6b49eULL,
+        [blackKnight] = 0x8bcd1acba164c267ULL, [blackPawn]   = 0x381b78fe81187003ULL,
+};
+
 /*
  *  Which castle bits to clear for a move's from and to
  */
@@ -125,7 +168,7 @@ static const signed char knightJump[] = { // Offsets for knight jumps
 #define x88u(square) ((square) + ((square) & ~7))
 
 // Sign-extended 0x88 for vectors:
-#define x88s(vector) (x88u(vector) + (((vector) << 1) & 8))
+#define x88s(vector) (x88u(vector) + (((vector) * 2) & 8))
 
 // Move stays inside board?
 #define onBoard(square, vector) (((x88u(square) + x88s(vector)) & 0x88) == 0)
@@ -133,6 +176,16 @@ static const signed char knightJump[] = { // Offsets for knight jumps
 // If so, turn it into a flag for in the directions table
 #define dir(square, vector, bit) (onBoard(square, vector) << (bit))
 
+// Or into a bitboard of the squares where it stays inside
+#define sourceBit(sq, vector) ((unsigned long long) onBoard(sq, vector) << (sq))
+#define sourceRow(sq, vector) (\
+        sourceBit((sq)+0, vector) | sourceBit((sq)+1, vector) | sourceBit((sq)+2, vector) |\
+        sourceBit((sq)+3, vector) | sourceBit((sq)+4, vector) | sourceBit((sq)+5, vector) |\
+        sourceBit((sq)+6, vector) | sourceBit((sq)+7, vector))
+#define sourceMask(vector) (\
+        sourceRow( 0, vector) | sourceRow( 8, vector) | sourceRow(16, vector) | sourceRow(24, vector) |\
+        sourceRow(32, vector) | sourceRow(40, vector) | sourceRow(48, vector) | sourceRow(56, vector))
+
 // Collect king step flags
 #define K(sq) [sq]=(\
         dir(sq,stepNW,bitNW)+  dir(sq,stepN,bitN)+  dir(sq,stepNE,bitNE)+\
@@ -177,6 +230,43 @@ static const unsigned char knightDirections[] = {
         N(h1), N(h2), N(h3), N(h4), N(h5), N(h6), N(h7), N(h8),
 };
 
+/*
+ *  Bitboards for the vectorized attack maps. A bitboard has bit `square'
+ *  set for each square in the set. Every line of squares is a pair of
+ *  opposite steps, one forward (a positive offset) and one backward.
+ *  The four vector lanes take the four pairs.
+ */
+
+#define forward(vector) ((vector) > 0 ? (vector) : -(vector))
+
+#if haveAvx2
+static const long long lineShifts[4] = {
+        forward(stepN), forward(stepE), forward(stepNE), forward(stepNW)
+};
+
+// Squares where the forward and backward steps stay on the board
+static const long long lineForwardSources[4] = {
+        sourceMask(forward(stepN)), sourceMask(forward(stepE)),
+        sourceMask(forward(stepNE)), sourceMask(forward(stepNW))
+};
+static const long long lineBackwardSources[4] = {
+        sourceMask(-forward(stepN)), sourceMask(-forward(stepE)),
+        sourceMask(-forward(stepNE)), sourceMask(-forward(stepNW))
+};
+
+static const long long jumpShifts[4] = {
+        forward(jumpNNE), forward(jumpENE), forward(jumpESE), forward(jumpSSE)
+};
+static const long long jumpForwardSources[4] = {
+        sourceMask(forward(jumpNNE)), sourceMask(forward(jumpENE)),
+        sourceMask(forward(jumpESE)), sourceMask(forward(jumpSSE))
+};
+static const long long jumpBackwardSources[4] = {
+        sourceMask(-forward(jumpNNE)), sourceMask(-forward(jumpENE)),
+        sourceMask(-forward(jumpESE)), sourceMask(-forward(jumpSSE))
+};
+#endif
+
 /*----------------------------------------------------------------------+
  |      Functions                                                       |
  +----------------------------------------------------------------------*/
@@ -197,27 +287,183 @@ static void pushSpecialMove(Board_t self, int from, int to)
         *self->movePtr++ = specialMove(from, to);
 }
 
-// Helper to emit a pawn move
-static void pushPawnMove(Board_t self, int from, int to)
+/*
+ *  Check detection for generateMovesOfKind, from the position of the
+ *  opponent's king and the slider rays through it
+ */
+
+// Files and ranks between two squares, counted eastward and northward
+#define fileDistance(from, to) ((file(to) - file(from)) * (fileB - fileA))
+#define rankDistance(from, to) ((rank(to) - rank(from)) * (rank2 - rank1))
+
+// Step from one square towards another on the same line, or 0 if there is no such line
+static int lineStep(int from, int to)
+{
+        int df = fileDistance(from, to);
+        int dr = rankDistance(from, to);
+        if (df != 0 && dr != 0 && df != dr && df != -dr)
+                return 0;
+        return ((df > 0) - (df < 0)) * stepE + ((dr > 0) - (dr < 0)) * stepN;
+}
+
+// Can the piece slide along lines with this step?
+static bool slidesAlong(int piece, int step)
+{
+        bool isStraight = (step == stepN || step == stepE || step == stepS || step == stepW);
+
+        switch (piece) {
+        case whiteQueen: case blackQueen:
+                return true;
+        case whiteRook: case blackRook:
+                return isStraight;
+        case whiteBishop: case blackBishop:
+                return !isStraight;
+        default:
+                return false;
+        }
+}
+
+// Does the piece on square attack the king? The square `vacated' counts as empty.
+static bool attacksKing(Board_t self, int piece, int square, int king, int vacated)
+{
+        int df = fileDistance(square, king);
+        int dr = rankDistance(square, king);
+
+        switch (piece) {
+        case whiteKing: case blackKing:
+                return false;
+        case whitePawn:
+                return dr == 1 && (df == 1 || df == -1);
+        case blackPawn:
+                return dr == -1 && (df == 1 || df == -1);
+        case whiteKnight: case blackKnight:
+                return df * df + dr * dr == 5;
+        }
+
+        int step = lineStep(square, king);
+        if (step == 0 || !slidesAlong(piece, step))
+                return false;
+        for (int to=square+step; to!=king; to+=step)
+                if (self->squares[to] != empty && to != vacated)
+                        return false;
+        return true;
+}
+
+/*
+ *  Mark the pieces of the side to move that stand between the opponent's
+ *  king and a slider of their own side. Moving them off that line gives
+ *  a discovered check. The mark is the step from the king to the piece.
+ */
+static void findDiscoverers(Board_t self, int king, signed char discover[boardSize])
+{
+        memset(discover, 0, boardSize);
+
+        int dirs = kingDirections[king];
+        int dir = 0;
+        do {
+                dir -= dirs; // pick next
+                dir &= dirs;
+                int step = kingStep[dir];
+                int square = king;
+                int blocker = -1;
+                do {
+                        square += step;
+                        int piece = self->squares[square];
+                        if (piece == empty)
+                                continue;
+                        if (pieceColor(piece) != sideToMove(self))
+                                break;
+                        if (blocker >= 0) {
+                                if (slidesAlong(piece, step))
+                                        discover[blocker] = step;
+                                break;
+                        }
+                        blocker = square;
+                } while (dir & kingDirections[square]);
+        } while (dirs -= dir); // remove and go to next
+}
+
+// Does the move give check? Castling and en passant are made on the board to see.
+static bool givesCheck(Board_t self, int move, int king, const signed char discover[boardSize])
+{
+        int from = from(move), to = to(move);
+        int piece = self->squares[from];
+
+        if (move & specialMoveFlag) {
+                bool isPawn = (piece == whitePawn || piece == blackPawn);
+
+                if (isPawn && isPromotion(self, from, to))
+                        piece = ((piece == whitePawn) ? whiteQueen : blackQueen)
+                              + ((move >> promotionBits) & 3);
+                else if (!isPawn || (file(from) != file(to) && self->squares[to] == empty)) {
+                        makeMove(self, move); // castling or en passant
+                        bool isCheck = false;
+                        for (int square=0; square<boardSize && !isCheck; square++) {
+                                int other = self->squares[square];
+                                if (other != empty && pieceColor(other) != sideToMove(self))
+                                        isCheck = attacksKing(self, other, square, king, -1);
+                        }
+                        undoMove(self);
+                        return isCheck;
+                }
+        }
+
+        if (discover[from] != 0 && lineStep(king, to) != discover[from])
+                return true;
+
+        return attacksKing(self, piece, to, king, from);
+}
+
+// Keep only the moves that give check
+static int filterChecks(Board_t self, int moveList[maxMoves], int nrMoves)
+{
+        int king = self->xside->king;
+        signed char discover[boardSize];
+        findDiscoverers(self, king, discover);
+
+        int nrChecks = 0;
+        for (int i=0; i<nrMoves; i++)
+                if (givesCheck(self, moveList[i], king, discover))
+                        moveList[nrChecks++] = moveList[i];
+        return nrChecks;
+}
+
+/*
+ *  Pseudo-legal move generator, instantiated for each side to move
+ */
+#define sideIsWhite 1
+#include "generate-side.h"
+#define sideIsWhite 0
+#include "generate-side.h"
+
+extern int generateMoves(Board_t self, int moveList[maxMoves])
+{
+        return generateMovesOfKind(self, moveList, allMoves);
+}
+
+extern int generateMovesOfKind(Board_t self, int moveList[maxMoves], int kinds)
 {
-        if (rank(to) == rank8 || rank(to) == rank1) {
-                pushSpecialMove(self, from, to);
-                self->movePtr[-1] += queenPromotionFlags;
+        assert(self->debugSideInfoPlyNumber == self->plyNumber);
 
-                pushSpecialMove(self, from, to);
-                self->movePtr[-1] += rookPromotionFlags;
+        int nrMoves = (sideToMove(self) == white)
+                ? generateMovesWhite(self, moveList, kinds)
+                : generateMovesBlack(self, moveList, kinds);
 
-                pushSpecialMove(self, from, to);
-                self->movePtr[-1] += bishopPromotionFlags;
+        /*
+         *  Filter checks
+         */
+        if (kinds & onlyChecks)
+                nrMoves = filterChecks(self, moveList, nrMoves);
 
-                pushSpecialMove(self, from, to);
-                self->movePtr[-1] += knightPromotionFlags;
-        } else
-                pushMove(self, from, to); // normal pawn move
+        return nrMoves;
 }
 
-// Helper to generate slider moves
-static void generateSlides(Board_t self, int from, int dirs)
+/*----------------------------------------------------------------------+
+ |      generateUnmoves                                                 |
+ +----------------------------------------------------------------------*/
+
+// Helper to emit slider retractions
+static void generateSlideUnmoves(Board_t self, int from, int dirs)
 {
         dirs &= kingDirections[from];
         int dir = 0;
@@ -228,33 +474,28 @@ static void generateSlides(Board_t self, int from, int dirs)
                 int to = from;
                 do {
                         to += vector;
-                        if (self->squares[to] != empty) {
-                                if (pieceColor(self->squares[to]) != sideToMove(self))
-                                        pushMove(self, from, to);
+                        if (self->squares[to] != empty)
                                 break;
-                        }
-                        pushMove(self, from, to);
+                        pushMove(self, to, from);
                 } while (dir & kingDirections[to]);
         } while (dirs -= dir); // remove and go to next
 }
 
 /*
- *  Pseudo-legal move generator
+ *  Retraction generator for retrograde analysis
  */
-extern int generateMoves(Board_t self, int moveList[maxMoves])
+extern int generateUnmoves(Board_t self, int moveList[maxMoves])
 {
-        assert(self->debugSideInfoPlyNumber == self->plyNumber);
-
         self->movePtr = moveList;
 
         for (int from=0; from<boardSize; from++) {
                 int piece = self->squares[from];
-                if (piece == empty || pieceColor(piece) != sideToMove(self)) continue;
+                if (piece == empty || pieceColor(piece) == sideToMove(self)) continue;
 
                 int to;
 
                 /*
-                 *  Generate moves for this piece
+                 *  Generate retractions for this piece
                  */
                 switch (piece) {
                         int dir, dirs;
@@ -267,26 +508,24 @@ extern int generateMoves(Board_t self, int moveList[maxMoves])
                                 dir -= dirs; // pick next
                                 dir &= dirs;
                                 to = from + kingStep[dir];
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == sideToMove(self)) continue;
-                                if (self->xside->attacks[to] != 0) continue;
-                                pushMove(self, from, to);
+                                if (self->squares[to] == empty)
+                                        pushMove(self, to, from);
                         } while (dirs -= dir); // remove and go to next
                         break;
 
                 case whiteQueen:
                 case blackQueen:
-                        generateSlides(self, from, dirsQueen);
+                        generateSlideUnmoves(self, from, dirsQueen);
                         break;
 
                 case whiteRook:
                 case blackRook:
-                        generateSlides(self, from, dirsRook);
+                        generateSlideUnmoves(self, from, dirsRook);
                         break;
 
                 case whiteBishop:
                 case blackBishop:
-                        generateSlides(self, from, dirsBishop);
+                        generateSlideUnmoves(self, from, dirsBishop);
                         break;
 
                 case whiteKnight:
@@ -297,149 +536,86 @@ extern int generateMoves(Board_t self, int moveList[maxMoves])
                                 dir -= dirs; // pick next
                                 dir &= dirs;
                                 to = from + knightJump[dir];
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == sideToMove(self))
-                                        continue;
-                                pushMove(self, from, to);
+                                if (self->squares[to] == empty)
+                                        pushMove(self, to, from);
                         } while (dirs -= dir); // remove and go to next
                         break;
 
                 case whitePawn:
-                        if (file(from) != fileH) {
-                                to = from + stepNE;
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == black)
-                                        pushPawnMove(self, from, to);
-                        }
-                        if (file(from) != fileA) {
-                                to = from + stepNW;
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == black)
-                                        pushPawnMove(self, from, to);
-                        }
-                        to = from + stepN;
+                        if (rank(from) == rank2)
+                                break;
+                        to = from + stepS;
                         if (self->squares[to] != empty)
                                 break;
-
-                        pushPawnMove(self, from, to);
-                        if (rank(from) == rank2) {
-                                to += stepN;
-                                if (self->squares[to] == empty) {
-                                        pushMove(self, from, to);
-                                        if (self->blackSide.attacks[to+stepS])
-                                                self->movePtr[-1] |= specialMoveFlag;
-                                }
-                        }
+                        pushMove(self, to, from);
+                        if (rank(from) == rank4 && self->squares[to+stepS] == empty)
+                                pushMove(self, to + stepS, from);
                         break;
 
                 case blackPawn:
-                        if (file(from) != fileH) {
-                                to = from + stepSE;
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == white)
-                                        pushPawnMove(self, from, to);
-                        }
-                        if (file(from) != fileA) {
-                                to = from + stepSW;
-                                if (self->squares[to] != empty
-                                 && pieceColor(self->squares[to]) == white)
-                                        pushPawnMove(self, from, to);
-                        }
-                        to = from + stepS;
+                        if (rank(from) == rank7)
+                                break;
+                        to = from + stepN;
                         if (self->squares[to] != empty)
                                 break;
-
-                        pushPawnMove(self, from, to);
-                        if (rank(from) == rank7) {
-                                to += stepS;
-                                if (self->squares[to] == empty) {
-                                        pushMove(self, from, to);
-                                        if (self->whiteSide.attacks[to+stepN])
-                                                self->movePtr[-1] |= specialMoveFlag;
-                                }
-                        }
+                        pushMove(self, to, from);
+                        if (rank(from) == rank5 && self->squares[to+stepN] == empty)
+                                pushMove(self, to + stepN, from);
                         break;
                 }
         }
 
-        /*
-         *  Generate castling moves
-         */
-        if (self->castleFlags && !inCheck(self)) {
-                if (sideToMove(self) == white) {
-                        if ((self->castleFlags & castleFlagWhiteKside)
-                         && self->squares[f1] == empty
-                         && self->squares[g1] == empty
-                         && self->xside->attacks[f1] == 0
-                         && self->xside->attacks[g1] == 0
-                        ) {
-                                pushSpecialMove(self, e1, g1);
-                        }
-                        if ((self->castleFlags & castleFlagWhiteQside)
-                         && self->squares[d1] == empty
-                         && self->squares[c1] == empty
-                         && self->squares[b1] == empty
-                         && self->xside->attacks[d1] == 0
-                         && self->xside->attacks[c1] == 0
-                        ) {
-                                pushSpecialMove(self, e1, c1);
-                        }
-                } else {
-                        if ((self->castleFlags & castleFlagBlackKside)
-                         && self->squares[f8] == empty
-                         && self->squares[g8] == empty
-                         && self->xside->attacks[f8] == 0
-                         && self->xside->attacks[g8] == 0
-                        ) {
-                                pushSpecialMove(self, e8, g8);
-                        }
-                        if ((self->castleFlags & castleFlagBlackQside)
-                         && self->squares[d8] == empty
-                         && self->squares[c8] == empty
-                         && self->squares[b8] == empty
-                         && self->xside->attacks[d8] == 0
-                         && self->xside->attacks[c8] == 0
-                        ) {
-                                pushSpecialMove(self, e8, c8);
-                        }
-                }
-        }
-
-        /*
-         *  Generate en-passant captures
-         */
-        if (self->enPassantPawn) {
-                int ep = self->enPassantPawn;
-
-                if (sideToMove(self) == white) {
-                        if (file(ep) != fileA && self->squares[ep+stepW] == whitePawn)
-                                pushSpecialMove(self, ep + stepW, ep + stepN);
-                        if (file(ep) != fileH && self->squares[ep+stepE] == whitePawn)
-                                pushSpecialMove(self, ep + stepE, ep + stepN);
-                } else {
-                        if (file(ep) != fileA && self->squares[ep+stepW] == blackPawn)
-                                pushSpecialMove(self, ep + stepW, ep + stepS);
-                        if (file(ep) != fileH && self->squares[ep+stepE] == blackPawn)
-                                pushSpecialMove(self, ep + stepE, ep + stepS);
-                }
-        }
-
-        return self->movePtr - moveList; // nrMoves
+        return self->movePtr - moveList; // nrUnmoves
 }
 
 /*----------------------------------------------------------------------+
  |      make/unmake move                                                |
  +----------------------------------------------------------------------*/
 
+// Move the history to the heap, or double its size there
+static signed char *growHistory(Board_t self)
+{
+        int newSize = self->undoHeap ? 2 * self->undoHeapSize : 2 * (int)sizeof self->undoStack;
+        signed char *heap = realloc(self->undoHeap, newSize);
+        if (!heap)
+                abort(); // makeMove has no way to fail
+
+        if (!self->undoHeap)
+                memcpy(heap, self->undoStack, self->undoLen);
+        self->undoHeap = heap;
+        self->undoHeapSize = newSize;
+        return heap;
+}
+
+// Helper for the pawn key
+static inline unsigned long long pawnKeyOf(int piece, int square)
+{
+        if (piece != whitePawn && piece != blackPawn)
+                return 0;
+        return RandomPiece[polyglotOffsets[piece] + polyglotSquare(square)];
+}
+
+// Helper to update the keys for a new piece on a square, before it is put there
+static inline void changeKeys(Board_t self, int square, int piece)
+{
+        int oldPiece = self->squares[square];
+        self->pawnKey ^= pawnKeyOf(oldPiece, square) ^ pawnKeyOf(piece, square);
+        self->materialKey += materialKeys[piece] - materialKeys[oldPiece];
+}
+
 extern void undoMove(Board_t self)
 {
         signed char *bytes = (signed char *)self;
+        signed char *stack = self->undoHeap ? self->undoHeap : self->undoStack;
         int len = self->undoLen;
         assert(len > 0);
         for (;;) {
-                int offset = self->undoStack[--len];
+                int offset = stack[--len];
                 if (offset < 0) break; // Found sentinel
-                bytes[offset] = self->undoStack[--len];
+                int value = stack[--len];
+                if (offset < boardSize)
+                        changeKeys(self, offset, value);
+                bytes[offset] = value;
         }
         self->undoLen = len;
         self->plyNumber--;
@@ -453,7 +629,11 @@ extern void undoMove(Board_t self)
 
 extern void makeMove(Board_t self, int move)
 {
-        signed char *sp = &self->undoStack[self->undoLen];
+        signed char *stack = self->undoHeap ? self->undoHeap : self->undoStack;
+        int size = self->undoHeap ? self->undoHeapSize : (int)sizeof self->undoStack;
+        if (self->undoLen > size - maxUndoPerMove)
+                stack = growHistory(self);
+        signed char *sp = &stack[self->undoLen];
 
         #define push(offset, value) do{                         \
                 *sp++ = (value);                                \
@@ -463,6 +643,8 @@ extern void makeMove(Board_t self, int move)
         #define makeSimpleMove(from, to) do{                    \
                 push(to, self->squares[to]);                    \
                 push(from, self->squares[from]);                \
+                changeKeys(self, to, self->squares[from]);      \
+                changeKeys(self, from, empty);                  \
                 self->squares[to] = self->squares[from];        \
                 self->squares[from] = empty;                    \
         }while(0)
@@ -477,6 +659,10 @@ extern void makeMove(Board_t self, int move)
         int to   = to(move);
         int from = from(move);
 
+        bool isZeroing = self->squares[to] != empty // before a promotion replaces the pawn
+                      || self->squares[from] == whitePawn
+                      || self->squares[from] == blackPawn;
+
         if (move & specialMoveFlag) {           // Handle specials first
                 switch (rank(from)) {
                 case rank8:
@@ -494,6 +680,7 @@ extern void makeMove(Board_t self, int move)
                         } else {
                                 // White promotes
                                 push(from, self->squares[from]);
+                                changeKeys(self, from, whiteQueen + (move >> promotionBits));
                                 self->squares[from] = whiteQueen + (move >> promotionBits);
                         }
                         break;
@@ -503,6 +690,7 @@ extern void makeMove(Board_t self, int move)
                         ;
                         int square = square(file(to), rank(from));
                         push(square, self->squares[square]);
+                        changeKeys(self, square, empty);
                         self->squares[square] = empty;
                         break;
 
@@ -513,6 +701,7 @@ extern void makeMove(Board_t self, int move)
                         } else {
                                 // Black promotes
                                 push(from, self->squares[from]);
+                                changeKeys(self, from, blackQueen + (move >> promotionBits));
                                 self->squares[from] = blackQueen + (move >> promotionBits);
                         }
                         break;
@@ -532,15 +721,15 @@ extern void makeMove(Board_t self, int move)
 
         self->plyNumber++;
 
-#if 0 // lastZeroing
-        if (self->squares[to] != empty
-         || self->squares[from] == whitePawn
-         || self->squares[from] == blackPawn
-        ) {
-                push(offsetof_lastZeroing, self->lastZeroing);
-                self->lastZeroing = self->plyNumber;
+        if (isZeroing) {                        // Reset the halfmove clock
+                int lastZeroing = self->plyNumber;
+                signed char *oldBytes = (signed char *)&self->lastZeroing;
+                signed char *newBytes = (signed char *)&lastZeroing;
+                for (int i=0; i<(int)sizeof lastZeroing; i++)
+                        if (oldBytes[i] != newBytes[i]) // normally only the low byte
+                                push(offsetof_lastZeroing + i, oldBytes[i]);
+                self->lastZeroing = lastZeroing;
         }
-#endif
 
         makeSimpleMove(from, to);
 
@@ -550,7 +739,7 @@ extern void makeMove(Board_t self, int move)
                 self->castleFlags &= ~flagsToClear;
         }
 
-        self->undoLen = sp - self->undoStack;
+        self->undoLen = sp - stack;
 }
 
 /*----------------------------------------------------------------------+
@@ -574,14 +763,12 @@ static void updateSliderAttacks(Board_t self, int from, int dirs, struct side *s
         } while (dirs -= dir); // remove and go to next
 }
 
-extern void updateSideInfo(Board_t self)
+// Helper to compute the attack maps piece by piece, stepping along the rays
+static void updateAttacks(Board_t self)
 {
         memset(&self->whiteSide, 0, sizeof self->whiteSide);
         memset(&self->blackSide, 0, sizeof self->blackSide);
 
-        self->side  = (sideToMove(self) == white) ? &self->whiteSide : &self->blackSide;
-        self->xside = (sideToMove(self) == white) ? &self->blackSide : &self->whiteSide;
-
         for (int from=0; from<boardSize; from++) {
                 int piece = self->squares[from];
                 if (piece == empty) continue;
@@ -674,6 +861,153 @@ extern void updateSideInfo(Board_t self)
                         break;
                 }
         }
+}
+
+#if haveAvx2
+
+// Set once before any thread can run, and then only read
+static bool isAvx2Supported;
+
+__attribute__((constructor))
+static void checkAvx2(void)
+{
+        __builtin_cpu_init(); // this can run before the constructor of libgcc
+        isAvx2Supported = __builtin_cpu_supports("avx2");
+}
+
+// Shift a bitboard by a step, in either direction
+#define shiftBitboard(bits, vector) \
+        ((vector) > 0 ? (bits) << ((vector) & 63) : (bits) >> (-(vector) & 63))
+
+// Helper to find the squares holding the piece, from the squares in two halves
+static inline avx2 unsigned long long pieceBitboard(__m256i low, __m256i high, int piece)
+{
+        __m256i pieces = _mm256_set1_epi8(piece);
+        unsigned int lowBits  = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, pieces));
+        unsigned int highBits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, pieces));
+        return lowBits | (unsigned long long) highBits << 32;
+}
+
+/*
+ *  Helper to fill the lines from the sliders in all lanes until and including
+ *  the first occupied square, by parallel prefix (Kogge-Stone). Shifts go
+ *  forward, or backward if not. `inside' has the squares a step can reach.
+ */
+static inline avx2 __m256i slide(__m256i sliders, __m256i emptyLanes, __m256i inside, bool isForward)
+{
+        __m256i shift1 = _mm256_loadu_si256((const __m256i *) lineShifts);
+        __m256i shift2 = _mm256_slli_epi64(shift1, 1);
+        __m256i shift4 = _mm256_slli_epi64(shift1, 2);
+        #define step(bits, shifts) \
+                (isForward ? _mm256_sllv_epi64(bits, shifts) : _mm256_srlv_epi64(bits, shifts))
+
+        __m256i open = _mm256_and_si256(emptyLanes, inside);
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, step(sliders, shift1)));
+        open = _mm256_and_si256(open, step(open, shift1));
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, step(sliders, shift2)));
+        open = _mm256_and_si256(open, step(open, shift2));
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, step(sliders, shift4)));
+
+        return _mm256_and_si256(step(sliders, shift1), inside);
+        #undef step
+}
+
+// Helper to compute the squares attacked by one side, except by pawns
+static inline avx2 unsigned long long sideAttacks(unsigned long long straight, unsigned long long diagonal,
+        unsigned long long knights, unsigned long long kings, unsigned long long emptySquares)
+{
+        __m256i lineShift = _mm256_loadu_si256((const __m256i *) lineShifts);
+        __m256i lineForward = _mm256_loadu_si256((const __m256i *) lineForwardSources);
+        __m256i lineBackward = _mm256_loadu_si256((const __m256i *) lineBackwardSources);
+        __m256i jumpShift = _mm256_loadu_si256((const __m256i *) jumpShifts);
+        __m256i jumpForward = _mm256_loadu_si256((const __m256i *) jumpForwardSources);
+        __m256i jumpBackward = _mm256_loadu_si256((const __m256i *) jumpBackwardSources);
+
+        // Lanes 0 and 1 are straight lines, lanes 2 and 3 diagonals
+        __m256i sliders = _mm256_set_epi64x(diagonal, diagonal, straight, straight);
+        __m256i emptyLanes = _mm256_set1_epi64x(emptySquares);
+
+        // A forward step reaches the squares where a backward step starts, and vice versa
+        __m256i attacks = _mm256_or_si256(
+                slide(sliders, emptyLanes, lineBackward, true),
+                slide(sliders, emptyLanes, lineForward, false));
+
+        __m256i kingLanes = _mm256_set1_epi64x(kings);
+        attacks = _mm256_or_si256(attacks, _mm256_sllv_epi64(_mm256_and_si256(kingLanes, lineForward), lineShift));
+        attacks = _mm256_or_si256(attacks, _mm256_srlv_epi64(_mm256_and_si256(kingLanes, lineBackward), lineShift));
+
+        __m256i knightLanes = _mm256_set1_epi64x(knights);
+        attacks = _mm256_or_si256(attacks, _mm256_sllv_epi64(_mm256_and_si256(knightLanes, jumpForward), jumpShift));
+        attacks = _mm256_or_si256(attacks, _mm256_srlv_epi64(_mm256_and_si256(knightLanes, jumpBackward), jumpShift));
+
+        __m128i halves = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+        return _mm_cvtsi128_si64(halves) | _mm_extract_epi64(halves, 1);
+}
+
+// Helper to store a bitboard as one byte per square, 0 or 1
+static inline avx2 void storeBitboard(signed char bytes[boardSize], unsigned long long bits)
+{
+        // Spread each byte of the bits over 8 bytes, and keep one bit in each
+        __m256i spread = _mm256_setr_epi8(
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+        __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+        __m256i ones = _mm256_set1_epi8(1);
+
+        for (int half=0; half<2; half++) {
+                __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int) (bits >> (32 * half))), spread);
+                v = _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select);
+                _mm256_storeu_si256((__m256i *) &bytes[32 * half], _mm256_and_si256(v, ones));
+        }
+}
+
+// Helper to compute the attack maps with bitboards, four directions at a time
+static avx2 void updateAttacksAvx2(Board_t self)
+{
+        __m256i low  = _mm256_loadu_si256((const __m256i *) &self->squares[0]);
+        __m256i high = _mm256_loadu_si256((const __m256i *) &self->squares[32]);
+
+        unsigned long long pieces[blackPawn+1];
+        for (int piece=empty; piece<=blackPawn; piece++)
+                pieces[piece] = pieceBitboard(low, high, piece);
+
+        unsigned long long emptySquares = pieces[empty];
+
+        unsigned long long whitePawns = pieces[whitePawn];
+        unsigned long long white = sideAttacks(
+                pieces[whiteQueen] | pieces[whiteRook], pieces[whiteQueen] | pieces[whiteBishop],
+                pieces[whiteKnight], pieces[whiteKing], emptySquares)
+                | shiftBitboard(whitePawns & sourceMask(stepNE), stepNE)
+                | shiftBitboard(whitePawns & sourceMask(stepNW), stepNW);
+
+        unsigned long long blackPawns = pieces[blackPawn];
+        unsigned long long black = sideAttacks(
+                pieces[blackQueen] | pieces[blackRook], pieces[blackQueen] | pieces[blackBishop],
+                pieces[blackKnight], pieces[blackKing], emptySquares)
+                | shiftBitboard(blackPawns & sourceMask(stepSE), stepSE)
+                | shiftBitboard(blackPawns & sourceMask(stepSW), stepSW);
+
+        storeBitboard(self->whiteSide.attacks, white);
+        storeBitboard(self->blackSide.attacks, black);
+
+        // The last king on the board, as when stepping through the squares
+        self->whiteSide.king = pieces[whiteKing] ? 63 - __builtin_clzll(pieces[whiteKing]) : 0;
+        self->blackSide.king = pieces[blackKing] ? 63 - __builtin_clzll(pieces[blackKing]) : 0;
+}
+
+#endif
+
+extern void updateSideInfo(Board_t self)
+{
+        self->side  = (sideToMove(self) == white) ? &self->whiteSide : &self->blackSide;
+        self->xside = (sideToMove(self) == white) ? &self->blackSide : &self->whiteSide;
+
+#if haveAvx2
+        if (isAvx2Supported)
+                updateAttacksAvx2(self);
+        else
+#endif
+                updateAttacks(self);
 
 #ifndef NDEBUG
         self->debugSideInfoPlyNumber = self->plyNumber;
@@ -688,23 +1022,11 @@ unsigned long long hash64(Board_t self)
 {
         unsigned long long key = 0ULL;
 
-        static const int offsets[] = {
-                [blackPawn]   = 0 * 64, [whitePawn]   = 1 * 64,
-                [blackKnight] = 2 * 64, [whiteKnight] = 3 * 64,
-                [blackBishop] = 4 * 64, [whiteBishop] = 5 * 64,
-                [blackRook]   = 6 * 64, [whiteRook]   = 7 * 64,
-                [blackQueen]  = 8 * 64, [whiteQueen]  = 9 * 64,
-                [blackKing]   = 10 * 64, [whiteKing]  = 11 * 64,
-        };
-
         // piece
-        for (int i=0; i<64; i++) {
-                int file = i & 7;
-                int rank = i >> 3;
-                int square = square(file, rank);
+        for (int square=0; square<boardSize; square++) {
                 int piece = self->squares[square];
                 if (piece == empty) continue;
-                key ^= RandomPiece[offsets[piece] + i];
+                key ^= RandomPiece[polyglotOffsets[piece] + polyglotSquare(square)];
         }
 
         // castle
@@ -731,6 +1053,66 @@ unsigned long long hash64(Board_t self)
         return key;
 }
 
+/*----------------------------------------------------------------------+
+ |      secondHash64                                                    |
+ +----------------------------------------------------------------------*/
+
+// Helper to turn an index into a random value (SplitMix64)
+static unsigned long long mix64(unsigned long long x)
+{
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+}
+
+/*
+ *  The same features as hash64, with random values from a generator instead
+ *  of the Polyglot tables: index 64*piece+square for the pieces, and the
+ *  indices after those for the castling rights, the en passant file and the
+ *  side to move.
+ */
+unsigned long long secondHash64(Board_t self)
+{
+        enum { castleIndex = (blackPawn + 1) * 64, enPassantIndex = castleIndex + 4, turnIndex = enPassantIndex + 8 };
+
+        unsigned long long key = 0ULL;
+
+        for (int square=0; square<boardSize; square++) {
+                int piece = self->squares[square];
+                if (piece != empty)
+                        key ^= mix64(64 * piece + polyglotSquare(square));
+        }
+
+        for (int i=0; i<4; i++)
+                if (self->castleFlags & (castleFlagWhiteKside << i))
+                        key ^= mix64(castleIndex + i);
+
+        normalizeEnPassantStatus(self);
+        if (self->enPassantPawn != 0)
+                key ^= mix64(enPassantIndex + polyglotSquare(self->enPassantPawn) % 8);
+
+        if (sideToMove(self) == white)
+                key ^= mix64(turnIndex);
+
+        return key;
+}
+
+/*----------------------------------------------------------------------+
+ |      updateKeys                                                      |
+ +----------------------------------------------------------------------*/
+
+void updateKeys(Board_t self)
+{
+        self->pawnKey = 0;
+        self->materialKey = 0;
+        for (int square=0; square<boardSize; square++) {
+                int piece = self->squares[square];
+                self->pawnKey ^= pawnKeyOf(piece, square);
+                self->materialKey += materialKeys[piece];
+        }
+}
+
 /*----------------------------------------------------------------------+
  |      isPromotion                                                     |
  +----------------------------------------------------------------------*/
@@ -796,6 +1178,428 @@ void normalizeEnPassantStatus(Board_t self)
         self->enPassantPawn = 0; // Clear en passant flag if there is no such legal capture
 }
 
+/*----------------------------------------------------------------------+
+ |      countLegalMoves                                                 |
+ +----------------------------------------------------------------------*/
+
+// Helper to count the legal moves by generating and trying them
+static int countMovesOneByOne(Board_t self, bool *isInCheck)
+{
+        updateSideInfo(self);
+        *isInCheck = inCheck(self);
+
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(self, moveList);
+
+        int nrLegalMoves = 0;
+        for (int i=0; i<nrMoves; i++)
+                nrLegalMoves += isLegalMove(self, moveList[i]);
+        return nrLegalMoves;
+}
+
+#if haveAvx2
+
+/*
+ *  Four boards at once, with each vector lane holding the bitboards of one
+ *  board. Instead of the moves of each piece, count the destinations of all
+ *  pieces of a kind together, one direction at a time: each destination
+ *  then belongs to exactly one move. The side to move can differ per lane.
+ *  Lanes with en passant take the slow path, as do some illegal setups
+ *  that the generator treats in its own way: touching kings, pawns on the
+ *  first or last rank, and castling rights without the king and rook.
+ */
+
+#define squareBit(square) (1ULL << (square))
+#define rankBits(rank) (\
+        squareBit(square(fileA, rank)) | squareBit(square(fileB, rank)) |\
+        squareBit(square(fileC, rank)) | squareBit(square(fileD, rank)) |\
+        squareBit(square(fileE, rank)) | squareBit(square(fileF, rank)) |\
+        squareBit(square(fileG, rank)) | squareBit(square(fileH, rank)))
+
+// Lines through the king, for the pinned pieces
+enum { lineN, lineE, lineNE, lineNW, nrLines };
+
+// Shift the bitboards in all lanes by a vector, in either direction
+#define shiftLanes(bits, vector) ((vector) > 0\
+        ? _mm256_slli_epi64(bits, (vector) & 63)\
+        : _mm256_srli_epi64(bits, -(vector) & 63))
+
+// Step from each square in all lanes, dropping the squares that leave the board
+#define stepLanes(bits, vector)\
+        shiftLanes(_mm256_and_si256(bits, _mm256_set1_epi64x(sourceMask(vector))), vector)
+
+#define allLanes _mm256_set1_epi64x(-1)
+
+// Helper to select per lane: from `a' where the mask is set, from `b' where not
+static inline avx2 __m256i selectLanes(__m256i mask, __m256i a, __m256i b)
+{
+        return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+}
+
+// Helper to make a mask of the lanes that have any bit set
+static inline avx2 __m256i nonZeroLanes(__m256i bits)
+{
+        return _mm256_xor_si256(_mm256_cmpeq_epi64(bits, _mm256_setzero_si256()), allLanes);
+}
+
+// Helper to count the bits in each lane
+static inline avx2 __m256i countLanes(__m256i bits)
+{
+        __m256i nibbleCounts = _mm256_setr_epi8(
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        __m256i nibbles = _mm256_set1_epi8(0x0f);
+        __m256i low  = _mm256_and_si256(bits, nibbles);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi64(bits, 4), nibbles);
+        __m256i counts = _mm256_add_epi8(
+                _mm256_shuffle_epi8(nibbleCounts, low),
+                _mm256_shuffle_epi8(nibbleCounts, high));
+        return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+// Helper to fill from the sliders along one direction, until and including the first occupied square
+static inline avx2 __m256i slideLanes(__m256i sliders, __m256i empty, int vector)
+{
+        __m256i inside = _mm256_set1_epi64x(sourceMask(-vector));
+        __m256i open = _mm256_and_si256(empty, inside);
+
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, shiftLanes(sliders, vector)));
+        open = _mm256_and_si256(open, shiftLanes(open, vector));
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, shiftLanes(sliders, 2 * vector)));
+        open = _mm256_and_si256(open, shiftLanes(open, 2 * vector));
+        sliders = _mm256_or_si256(sliders, _mm256_and_si256(open, shiftLanes(sliders, 4 * vector)));
+
+        return _mm256_and_si256(shiftLanes(sliders, vector), inside);
+}
+
+struct lanes {
+        __m256i empty, ours;
+        __m256i king, straight, diagonal;       // ours
+        __m256i theirStraight, theirDiagonal;
+        __m256i checkers;                       // all of them
+        __m256i evasions;                       // the lines from the king to sliders giving check
+        __m256i pinned;
+        __m256i pinLines[nrLines];              // from the king to the pinning slider
+};
+
+// Helper to find the checks and pins along one direction from the king
+static inline avx2 void findPins(struct lanes *self, int vector, int line)
+{
+        __m256i sliders = (line == lineN || line == lineE) ? self->theirStraight : self->theirDiagonal;
+
+        __m256i ray = slideLanes(self->king, self->empty, vector);
+        __m256i checker = _mm256_and_si256(ray, sliders);
+        self->checkers = _mm256_or_si256(self->checkers, checker);
+        self->evasions = _mm256_or_si256(self->evasions, _mm256_and_si256(nonZeroLanes(checker), ray));
+
+        __m256i blocker = _mm256_and_si256(ray, self->ours);
+        __m256i beyond = slideLanes(blocker, self->empty, vector);
+        __m256i isPinned = nonZeroLanes(_mm256_and_si256(beyond, sliders));
+        self->pinned = _mm256_or_si256(self->pinned, _mm256_and_si256(isPinned, blocker));
+        self->pinLines[line] = _mm256_or_si256(self->pinLines[line],
+                _mm256_and_si256(isPinned, _mm256_or_si256(ray, beyond)));
+}
+
+// Helper to count the slider moves along one direction
+static inline avx2 __m256i countSlides(const struct lanes *self, __m256i target, int vector, int line)
+{
+        __m256i sliders = (line == lineN || line == lineE) ? self->straight : self->diagonal;
+        sliders = _mm256_and_si256(sliders,
+                _mm256_or_si256(_mm256_xor_si256(self->pinned, allLanes), self->pinLines[line]));
+        return countLanes(_mm256_and_si256(slideLanes(sliders, self->empty, vector), target));
+}
+
+// Helper to count pawn moves, with four for each promotion
+static inline avx2 __m256i countPawnMoves(__m256i destinations)
+{
+        __m256i promotions = _mm256_set1_epi64x(rankBits(rank1) | rankBits(rank8));
+        return _mm256_add_epi64(
+                countLanes(_mm256_andnot_si256(promotions, destinations)),
+                _mm256_slli_epi64(countLanes(_mm256_and_si256(promotions, destinations)), 2));
+}
+
+// Helper to count the castling moves of a board, or return -1 if it can't be done here
+static int countCastlingMoves(Board_t self, unsigned long long occupied, unsigned long long attacked, bool isInCheck)
+{
+        int rank, kside, qside, king, rook;
+        if (sideToMove(self) == white) {
+                rank = rank1;
+                kside = castleFlagWhiteKside; qside = castleFlagWhiteQside;
+                king = whiteKing; rook = whiteRook;
+        } else {
+                rank = rank8;
+                kside = castleFlagBlackKside; qside = castleFlagBlackQside;
+                king = blackKing; rook = blackRook;
+        }
+
+        int flags = self->castleFlags & (kside | qside);
+        if (!flags)
+                return 0;
+        if (self->squares[square(fileE, rank)] != king
+         || ((flags & kside) && self->squares[square(fileH, rank)] != rook)
+         || ((flags & qside) && self->squares[square(fileA, rank)] != rook))
+                return -1;
+        if (isInCheck)
+                return 0;
+
+        unsigned long long blocked = occupied | attacked;
+        unsigned long long ksidePath = squareBit(square(fileF, rank)) | squareBit(square(fileG, rank));
+        unsigned long long qsidePath = squareBit(square(fileD, rank)) | squareBit(square(fileC, rank));
+        unsigned long long qsideRook = squareBit(square(fileB, rank));
+
+        return ((flags & kside) && !(blocked & ksidePath))
+             + ((flags & qside) && !(blocked & qsidePath) && !(occupied & qsideRook));
+}
+
+// Helper to step from the squares in all lanes in the eight king directions
+static inline avx2 __m256i kingStepLanes(__m256i bits)
+{
+        return _mm256_or_si256(
+                _mm256_or_si256(
+                        _mm256_or_si256(stepLanes(bits, stepN), stepLanes(bits, stepNE)),
+                        _mm256_or_si256(stepLanes(bits, stepE), stepLanes(bits, stepSE))),
+                _mm256_or_si256(
+                        _mm256_or_si256(stepLanes(bits, stepS), stepLanes(bits, stepSW)),
+                        _mm256_or_si256(stepLanes(bits, stepW), stepLanes(bits, stepNW))));
+}
+
+// Helper to jump from the squares in all lanes in the eight knight directions
+static inline avx2 __m256i knightJumpLanes(__m256i bits)
+{
+        return _mm256_or_si256(
+                _mm256_or_si256(
+                        _mm256_or_si256(stepLanes(bits, jumpNNE), stepLanes(bits, jumpENE)),
+                        _mm256_or_si256(stepLanes(bits, jumpESE), stepLanes(bits, jumpSSE))),
+                _mm256_or_si256(
+                        _mm256_or_si256(stepLanes(bits, jumpSSW), stepLanes(bits, jumpWSW)),
+                        _mm256_or_si256(stepLanes(bits, jumpWNW), stepLanes(bits, jumpNNW))));
+}
+
+// Helper to count the knight moves, one direction at a time
+static inline avx2 __m256i countJumps(__m256i knights, __m256i target)
+{
+        #define jumps(vector) countLanes(_mm256_and_si256(stepLanes(knights, vector), target))
+        return _mm256_add_epi64(
+                _mm256_add_epi64(
+                        _mm256_add_epi64(jumps(jumpNNE), jumps(jumpENE)),
+                        _mm256_add_epi64(jumps(jumpESE), jumps(jumpSSE))),
+                _mm256_add_epi64(
+                        _mm256_add_epi64(jumps(jumpSSW), jumps(jumpWSW)),
+                        _mm256_add_epi64(jumps(jumpWNW), jumps(jumpNNW))));
+        #undef jumps
+}
+
+// Helper to count the legal moves of four boards. Returns the lanes that need the slow path.
+static avx2 int countMovesAvx2(Board_t boards[4], int counts[4], bool isInCheck[4])
+{
+        /*
+         *  Load the boards into the lanes. The pieces are indexed by their white
+         *  kind, as ours for the side to move and theirs for the other side.
+         */
+
+        long long ours[whitePawn+1][4], theirs[whitePawn+1][4];
+        long long isWhite[4], empties[4];
+        int slowLanes = 0;
+
+        for (int lane=0; lane<4; lane++) {
+                Board_t board = boards[lane];
+                __m256i low  = _mm256_loadu_si256((const __m256i *) &board->squares[0]);
+                __m256i high = _mm256_loadu_si256((const __m256i *) &board->squares[32]);
+
+                bool whiteToMove = (sideToMove(board) == white);
+                for (int piece=whiteKing; piece<=whitePawn; piece++) {
+                        long long whites = pieceBitboard(low, high, piece);
+                        long long blacks = pieceBitboard(low, high, piece - whiteKing + blackKing);
+                        ours[piece][lane] = whiteToMove ? whites : blacks;
+                        theirs[piece][lane] = whiteToMove ? blacks : whites;
+                }
+                isWhite[lane] = whiteToMove ? -1 : 0;
+                empties[lane] = pieceBitboard(low, high, empty);
+
+                // Pawns on the first or last rank don't have moves in the generator
+                unsigned long long pawns = ours[whitePawn][lane] | theirs[whitePawn][lane];
+                if (board->enPassantPawn != 0 || (pawns & (rankBits(rank1) | rankBits(rank8))))
+                        slowLanes |= 1 << lane;
+        }
+
+        #define lanes(bitboards) _mm256_loadu_si256((const __m256i *) (bitboards))
+
+        struct lanes self;
+        __m256i whites = lanes(isWhite);
+        self.empty = lanes(empties);
+        self.king = lanes(ours[whiteKing]);
+        self.straight = _mm256_or_si256(lanes(ours[whiteQueen]), lanes(ours[whiteRook]));
+        self.diagonal = _mm256_or_si256(lanes(ours[whiteQueen]), lanes(ours[whiteBishop]));
+        __m256i knights = lanes(ours[whiteKnight]);
+        __m256i pawns = lanes(ours[whitePawn]);
+        self.ours = _mm256_or_si256(
+                _mm256_or_si256(self.king, _mm256_or_si256(self.straight, self.diagonal)),
+                _mm256_or_si256(knights, pawns));
+
+        __m256i theirKing = lanes(theirs[whiteKing]);
+        self.theirStraight = _mm256_or_si256(lanes(theirs[whiteQueen]), lanes(theirs[whiteRook]));
+        self.theirDiagonal = _mm256_or_si256(lanes(theirs[whiteQueen]), lanes(theirs[whiteBishop]));
+        __m256i theirKnights = lanes(theirs[whiteKnight]);
+        __m256i theirPawns = lanes(theirs[whitePawn]);
+        __m256i theirPieces = _mm256_andnot_si256(_mm256_or_si256(self.empty, self.ours), allLanes);
+
+        #undef lanes
+
+        /*
+         *  Squares that the king can't go to. Sliders see through the king,
+         *  as it can't step back along their line.
+         */
+
+        __m256i open = _mm256_or_si256(self.empty, self.king);
+        __m256i attacked = _mm256_or_si256(
+                _mm256_or_si256(
+                        _mm256_or_si256(slideLanes(self.theirStraight, open, stepN),
+                                        slideLanes(self.theirStraight, open, stepS)),
+                        _mm256_or_si256(slideLanes(self.theirStraight, open, stepE),
+                                        slideLanes(self.theirStraight, open, stepW))),
+                _mm256_or_si256(
+                        _mm256_or_si256(slideLanes(self.theirDiagonal, open, stepNE),
+                                        slideLanes(self.theirDiagonal, open, stepSW)),
+                        _mm256_or_si256(slideLanes(self.theirDiagonal, open, stepNW),
+                                        slideLanes(self.theirDiagonal, open, stepSE))));
+
+        __m256i pawnAttacks = selectLanes(whites,
+                _mm256_or_si256(stepLanes(theirPawns, stepSE), stepLanes(theirPawns, stepSW)),
+                _mm256_or_si256(stepLanes(theirPawns, stepNE), stepLanes(theirPawns, stepNW)));
+
+        __m256i theirKingSteps = kingStepLanes(theirKing);
+        attacked = _mm256_or_si256(
+                _mm256_or_si256(attacked, pawnAttacks),
+                _mm256_or_si256(knightJumpLanes(theirKnights), theirKingSteps));
+
+        // Kings that touch are left to the generator
+        __m256i kingsTouch = nonZeroLanes(_mm256_and_si256(theirKingSteps, self.king));
+        slowLanes |= _mm256_movemask_pd(_mm256_castsi256_pd(kingsTouch));
+
+        /*
+         *  Checks and pins
+         */
+
+        self.checkers = _mm256_setzero_si256();
+        self.evasions = _mm256_setzero_si256();
+        self.pinned = _mm256_setzero_si256();
+        for (int line=0; line<nrLines; line++)
+                self.pinLines[line] = _mm256_setzero_si256();
+
+        findPins(&self, stepN, lineN);
+        findPins(&self, stepS, lineN);
+        findPins(&self, stepE, lineE);
+        findPins(&self, stepW, lineE);
+        findPins(&self, stepNE, lineNE);
+        findPins(&self, stepSW, lineNE);
+        findPins(&self, stepNW, lineNW);
+        findPins(&self, stepSE, lineNW);
+
+        // Knights and pawns give check from where they would capture the king
+        __m256i kingAsPawn = selectLanes(whites,
+                _mm256_or_si256(stepLanes(self.king, stepNE), stepLanes(self.king, stepNW)),
+                _mm256_or_si256(stepLanes(self.king, stepSE), stepLanes(self.king, stepSW)));
+        __m256i contactCheckers = _mm256_or_si256(
+                _mm256_and_si256(knightJumpLanes(self.king), theirKnights),
+                _mm256_and_si256(kingAsPawn, theirPawns));
+        self.checkers = _mm256_or_si256(self.checkers, contactCheckers);
+        self.evasions = _mm256_or_si256(self.evasions, contactCheckers);
+
+        // Out of a single check, capture or block. Out of a double check, only the king moves.
+        __m256i nrCheckers = countLanes(self.checkers);
+        __m256i isNotInCheck = _mm256_cmpeq_epi64(nrCheckers, _mm256_setzero_si256());
+        __m256i isInSingleCheck = _mm256_cmpeq_epi64(nrCheckers, _mm256_set1_epi64x(1));
+        __m256i allowed = _mm256_or_si256(isNotInCheck, _mm256_and_si256(isInSingleCheck, self.evasions));
+
+        /*
+         *  Count the moves. Pinned pieces only move along their pin line,
+         *  which never gets them out of check.
+         */
+
+        __m256i target = _mm256_andnot_si256(self.ours, allowed);
+        __m256i total = _mm256_add_epi64(
+                _mm256_add_epi64(
+                        _mm256_add_epi64(countSlides(&self, target, stepN, lineN),
+                                         countSlides(&self, target, stepS, lineN)),
+                        _mm256_add_epi64(countSlides(&self, target, stepE, lineE),
+                                         countSlides(&self, target, stepW, lineE))),
+                _mm256_add_epi64(
+                        _mm256_add_epi64(countSlides(&self, target, stepNE, lineNE),
+                                         countSlides(&self, target, stepSW, lineNE)),
+                        _mm256_add_epi64(countSlides(&self, target, stepNW, lineNW),
+                                         countSlides(&self, target, stepSE, lineNW))));
+
+        __m256i unpinned = _mm256_xor_si256(self.pinned, allLanes);
+        total = _mm256_add_epi64(total, countJumps(_mm256_and_si256(knights, unpinned), target));
+
+        __m256i kingTarget = _mm256_andnot_si256(_mm256_or_si256(self.ours, attacked), allLanes);
+        total = _mm256_add_epi64(total, countLanes(_mm256_and_si256(kingStepLanes(self.king), kingTarget)));
+
+        // Pawns of white lanes move up, those of black lanes down
+        __m256i whitePawns = _mm256_and_si256(whites, pawns);
+        __m256i blackPawns = _mm256_andnot_si256(whites, pawns);
+        __m256i pushers = _mm256_or_si256(unpinned, self.pinLines[lineN]);
+        __m256i pushes = _mm256_and_si256(self.empty, _mm256_or_si256(
+                stepLanes(_mm256_and_si256(whitePawns, pushers), stepN),
+                stepLanes(_mm256_and_si256(blackPawns, pushers), stepS)));
+        __m256i doublePushes = _mm256_and_si256(self.empty, _mm256_or_si256(
+                stepLanes(_mm256_and_si256(pushes, _mm256_set1_epi64x(rankBits(rank3))), stepN),
+                stepLanes(_mm256_and_si256(pushes, _mm256_set1_epi64x(rankBits(rank6))), stepS)));
+        total = _mm256_add_epi64(total, countPawnMoves(_mm256_and_si256(pushes, allowed)));
+        total = _mm256_add_epi64(total, countLanes(_mm256_and_si256(doublePushes, allowed)));
+
+        __m256i captureNE = _mm256_or_si256(unpinned, self.pinLines[lineNE]); // and SW
+        __m256i captureNW = _mm256_or_si256(unpinned, self.pinLines[lineNW]); // and SE
+        __m256i victims = _mm256_and_si256(theirPieces, allowed);
+        __m256i capturesNE = _mm256_and_si256(victims, _mm256_or_si256(
+                stepLanes(_mm256_and_si256(whitePawns, captureNE), stepNE),
+                stepLanes(_mm256_and_si256(blackPawns, captureNE), stepSW)));
+        __m256i capturesNW = _mm256_and_si256(victims, _mm256_or_si256(
+                stepLanes(_mm256_and_si256(whitePawns, captureNW), stepNW),
+                stepLanes(_mm256_and_si256(blackPawns, captureNW), stepSE)));
+        total = _mm256_add_epi64(total, countPawnMoves(capturesNE));
+        total = _mm256_add_epi64(total, countPawnMoves(capturesNW));
+
+        /*
+         *  Castling, lane by lane
+         */
+
+        long long totals[4], checks[4], attacks[4];
+        _mm256_storeu_si256((__m256i *) totals, total);
+        _mm256_storeu_si256((__m256i *) checks, nrCheckers);
+        _mm256_storeu_si256((__m256i *) attacks, attacked);
+
+        for (int lane=0; lane<4; lane++) {
+                isInCheck[lane] = checks[lane] > 0;
+                int castlingMoves = countCastlingMoves(boards[lane], ~empties[lane], attacks[lane], isInCheck[lane]);
+                if (castlingMoves < 0)
+                        slowLanes |= 1 << lane;
+                counts[lane] = totals[lane] + castlingMoves;
+        }
+
+        return slowLanes;
+}
+
+#endif
+
+extern void countLegalMoves(Board_t boards[], int nrBoards, int counts[], bool isInCheck[])
+{
+        int first = 0;
+
+#if haveAvx2
+        if (isAvx2Supported)
+                for (; first+4<=nrBoards; first+=4) {
+                        int slowLanes = countMovesAvx2(&boards[first], &counts[first], &isInCheck[first]);
+                        for (int lane=0; lane<4; lane++)
+                                if (slowLanes & (1 << lane))
+                                        counts[first+lane] = countMovesOneByOne(boards[first+lane], &isInCheck[first+lane]);
+                }
+#endif
+
+        for (int i=first; i<nrBoards; i++)
+                counts[i] = countMovesOneByOne(boards[i], &isInCheck[i]);
+}
+
 /*----------------------------------------------------------------------+
  |                                                                      |
  +----------------------------------------------------------------------*/
@@ -0,0 +1,137 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      perft.c -- count move paths for testing the move generator      |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <pthread.h>
+#include <stdbool.h>
+
+// Other module includes
+#include "Board.h"
+#include "budget.h"
+
+// Own include
+#include "perft.h"
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      perft                                                           |
+ +----------------------------------------------------------------------*/
+
+// Helper that expects the side info to be valid already
+static unsigned long long perftLoop(Board_t self, int depth)
+{
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(self, moveList);
+
+        unsigned long long total = 0;
+        for (int i=0; i<nrMoves; i++) {
+                makeMove(self, moveList[i]);
+                updateSideInfo(self);
+                bool isLegal = self->side->attacks[self->xside->king] == 0;
+                if (isLegal)
+                        total += (depth > 1) ? perftLoop(self, depth - 1) : 1;
+                undoMove(self);
+        }
+        return total;
+}
+
+extern unsigned long long perft(Board_t self, int depth)
+{
+        if (depth < 1)
+                return 1;
+
+        updateSideInfo(self);
+        return perftLoop(self, depth);
+}
+
+/*----------------------------------------------------------------------+
+ |      perftWithBudget                                                 |
+ +----------------------------------------------------------------------*/
+
+// Budget and the nodes not charged yet
+struct meter {
+        struct budget *budget;
+        int pending;
+        bool mustStop;
+};
+
+// Helper for the budgeted count. Checks the budget for every move that is made.
+static unsigned long long perftLoopWithBudget(Board_t self, int depth, struct meter *meter)
+{
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(self, moveList);
+
+        unsigned long long total = 0;
+        for (int i=0; i<nrMoves && !meter->mustStop; i++) {
+                meter->mustStop = countNode(meter->budget, &meter->pending);
+                makeMove(self, moveList[i]);
+                updateSideInfo(self);
+                bool isLegal = self->side->attacks[self->xside->king] == 0;
+                if (isLegal)
+                        total += (depth > 1) ? perftLoopWithBudget(self, depth - 1, meter) : 1;
+                undoMove(self);
+        }
+        return total;
+}
+
+extern unsigned long long perftWithBudget(Board_t self, int depth, struct budget *budget)
+{
+        if (depth < 1)
+                return 1;
+
+        struct meter meter = { .budget = budget, .pending = 0, .mustStop = false };
+        updateSideInfo(self);
+        unsigned long long total = perftLoopWithBudget(self, depth, &meter);
+        flushNodes(budget, &meter.pending);
+        return total;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
@@ -0,0 +1,18 @@
+
+/*
+ *  Deeper counts from the start position don't fit in 64 bits anymore
+ */
+enum { maxPerftDepth = 13 };
+
+/*
+ *  Count the number of legal move paths of the given length
+ */
+unsigned long long perft(Board_t self, int depth);
+
+struct budget;
+
+/*
+ *  Like perft, but stop when the budget is exhausted. The count is then
+ *  partial. The budget must have been started, and can be NULL.
+ */
+unsigned long long perftWithBudget(Board_t self, int depth, struct budget *budget);
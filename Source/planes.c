@@ -0,0 +1,384 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      planes.c -- input and policy planes for neural networks         |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Other module includes
+#include "Board.h"
+#include "fenChunks.h"
+
+// Own include
+#include "planes.h"
+
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+enum { rankStep = rank2 - rank1, fileStep = fileB - fileA };
+
+// Coordinates from white's side, 0 to 7, with the ranks reversed when flipped
+#define fileIndex(square)               ((file(square) - fileA) * fileStep)
+#define rankIndex(square, flipRanks)    (((rank(square) - rank1) * rankStep) ^ (flipRanks))
+#define indexToSquare(fileNr, rankNr) \
+        square(fileA + (fileNr) * fileStep, rank1 + (rankNr) * rankStep)
+
+// Policy planes
+enum {
+        queenPlanes = 0,                // 8 directions times 7 distances
+        knightPlanes = 56,              // 8 jumps
+        underpromotionPlanes = 64       // 3 pieces times 3 directions
+};
+
+// Encoder of one position in a batch
+typedef void encodeFunction(Board_t board, void *out, int flags);
+
+struct batch {
+        unsigned char *out;
+        size_t positionSize;    // in bytes
+        int invalidFill;        // byte value for invalid FENs
+        encodeFunction *encode;
+        int flags;
+};
+
+/*----------------------------------------------------------------------+
+ |      Data                                                            |
+ +----------------------------------------------------------------------*/
+
+// Plane of each piece, without and with swapping the colors. -1 for none.
+static const signed char piecePlanes[2][13] = {
+        {
+                [empty] = -1,
+                [whiteKing] = 0, [whiteQueen] = 1, [whiteRook] = 2,
+                [whiteBishop] = 3, [whiteKnight] = 4, [whitePawn] = 5,
+                [blackKing] = 6, [blackQueen] = 7, [blackRook] = 8,
+                [blackBishop] = 9, [blackKnight] = 10, [blackPawn] = 11,
+        }, {
+                [empty] = -1,
+                [whiteKing] = 6, [whiteQueen] = 7, [whiteRook] = 8,
+                [whiteBishop] = 9, [whiteKnight] = 10, [whitePawn] = 11,
+                [blackKing] = 0, [blackQueen] = 1, [blackRook] = 2,
+                [blackBishop] = 3, [blackKnight] = 4, [blackPawn] = 5,
+        }
+};
+
+// Queen move directions: N, NE, E, SE, S, SW, W, NW, as file and rank steps
+static const signed char queenSteps[8][2] = {
+        { 0, 1 }, { 1, 1 }, { 1, 0 }, { 1, -1 }, { 0, -1 }, { -1, -1 }, { -1, 0 }, { -1, 1 }
+};
+
+// The same, indexed by the signs of the file and rank difference, plus 1
+static const signed char queenDirections[3][3] = {
+        { 5, 6, 7 },
+        { 4, -1, 0 },
+        { 3, 2, 1 }
+};
+
+// Knight jumps clockwise from NNE, as file and rank steps
+static const signed char knightSteps[8][2] = {
+        { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 }
+};
+
+// The same, indexed by the file and rank difference, plus 2. -1 for none.
+static const signed char knightJumps[5][5] = {
+        { -1, 5, -1, 6, -1 },
+        { 4, -1, -1, -1, 7 },
+        { -1, -1, -1, -1, -1 },
+        { 3, -1, -1, -1, 0 },
+        { -1, 2, -1, 1, -1 }
+};
+
+// Promotion flags of the underpromotions, in the order of their planes
+static const int underpromotions[3] = {
+        knightPromotionFlags, bishopPromotionFlags, rookPromotionFlags
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      boardToPlanes                                                   |
+ +----------------------------------------------------------------------*/
+
+// Helper to fill a whole plane
+static void fillPlane(unsigned char *planes, int plane, bool isSet)
+{
+        memset(&planes[64 * plane], isSet, 64);
+}
+
+// Helper that writes the planes as bytes
+static void encodeBoard(Board_t self, unsigned char planes[planesSize], bool isFlipped)
+{
+        int flipRanks = isFlipped ? 7 : 0;
+
+        memset(planes, 0, 12 * 64);
+        for (int square=0; square<boardSize; square++) {
+                int plane = piecePlanes[isFlipped][self->squares[square]];
+                if (plane >= 0)
+                        planes[64 * plane + 8 * rankIndex(square, flipRanks) + fileIndex(square)] = 1;
+        }
+
+        fillPlane(planes, 12, sideToMove(self) == white);
+
+        int castleFlags = self->castleFlags;
+        if (isFlipped)
+                castleFlags = ((castleFlags & (castleFlagWhiteKside | castleFlagWhiteQside)) << 2)
+                            | ((castleFlags & (castleFlagBlackKside | castleFlagBlackQside)) >> 2);
+        fillPlane(planes, 13, castleFlags & castleFlagWhiteKside);
+        fillPlane(planes, 14, castleFlags & castleFlagWhiteQside);
+        fillPlane(planes, 15, castleFlags & castleFlagBlackKside);
+        fillPlane(planes, 16, castleFlags & castleFlagBlackQside);
+
+        fillPlane(planes, 17, false);
+        normalizeEnPassantStatus(self);
+        if (self->enPassantPawn) {
+                int passedRank = (sideToMove(self) == white ? 5 : 2) ^ flipRanks; // the square passed over
+                planes[64 * 17 + 8 * passedRank + fileIndex(self->enPassantPawn)] = 1;
+        }
+}
+
+extern void boardToPlanes(Board_t self, void *planes, int flags)
+{
+        bool isFlipped = (flags & planesFlip) && sideToMove(self) == black;
+
+        if (flags & planesFloat) {
+                unsigned char bytes[planesSize];
+                encodeBoard(self, bytes, isFlipped);
+                float *values = planes;
+                for (int i=0; i<planesSize; i++)
+                        values[i] = bytes[i];
+        } else
+                encodeBoard(self, planes, isFlipped);
+}
+
+/*----------------------------------------------------------------------+
+ |      moveToPolicyIndex                                               |
+ +----------------------------------------------------------------------*/
+
+extern int moveToPolicyIndex(int move, bool isFlipped)
+{
+        int flipRanks = isFlipped ? 7 : 0;
+        int from = from(move), to = to(move);
+        int fromFile = fileIndex(from), fromRank = rankIndex(from, flipRanks);
+        int fileDiff = fileIndex(to) - fromFile;
+        int rankDiff = rankIndex(to, flipRanks) - fromRank;
+        int plane = -1;
+
+        int promotion = move & (3 << promotionBits);
+        if ((move & specialMoveFlag) && promotion != queenPromotionFlags) {
+                if ((rankDiff == 1 || rankDiff == -1) && -1 <= fileDiff && fileDiff <= 1)
+                        for (int i=0; i<3; i++)
+                                if (underpromotions[i] == promotion)
+                                        plane = underpromotionPlanes + 3 * i + fileDiff + 1;
+        } else if (fileDiff == 0 || rankDiff == 0 || fileDiff == rankDiff || fileDiff == -rankDiff) {
+                int distance = (fileDiff != 0) ? abs(fileDiff) : abs(rankDiff);
+                int direction = queenDirections[(fileDiff > 0) - (fileDiff < 0) + 1]
+                                               [(rankDiff > 0) - (rankDiff < 0) + 1];
+                if (direction >= 0)
+                        plane = queenPlanes + 7 * direction + distance - 1;
+        } else if (abs(fileDiff) <= 2 && abs(rankDiff) <= 2) {
+                int jump = knightJumps[fileDiff + 2][rankDiff + 2];
+                if (jump >= 0)
+                        plane = knightPlanes + jump;
+        }
+
+        if (plane < 0)
+                return -1;
+        return 64 * plane + 8 * fromRank + fromFile;
+}
+
+/*----------------------------------------------------------------------+
+ |      policyIndexToMove                                               |
+ +----------------------------------------------------------------------*/
+
+extern int policyIndexToMove(int index, bool isFlipped)
+{
+        if (index < 0 || index >= policySize)
+                return -1;
+
+        int flipRanks = isFlipped ? 7 : 0;
+        int plane = index >> 6;
+        int fromFile = index & 7, fromRank = (index >> 3) & 7;
+        int fileDiff, rankDiff, flags = 0;
+
+        if (plane < knightPlanes) {
+                int direction = (plane - queenPlanes) / 7, distance = (plane - queenPlanes) % 7 + 1;
+                fileDiff = queenSteps[direction][0] * distance;
+                rankDiff = queenSteps[direction][1] * distance;
+        } else if (plane < underpromotionPlanes) {
+                fileDiff = knightSteps[plane - knightPlanes][0];
+                rankDiff = knightSteps[plane - knightPlanes][1];
+        } else {
+                // Towards the nearest last rank
+                if (fromRank != 1 && fromRank != 6)
+                        return -1;
+                fileDiff = (plane - underpromotionPlanes) % 3 - 1;
+                rankDiff = (fromRank == 6) ? 1 : -1;
+                flags = specialMoveFlag | underpromotions[(plane - underpromotionPlanes) / 3];
+        }
+
+        int toFile = fromFile + fileDiff, toRank = fromRank + rankDiff;
+        if (toFile < 0 || toFile > 7 || toRank < 0 || toRank > 7)
+                return -1;
+
+        int from = indexToSquare(fromFile, fromRank ^ flipRanks);
+        int to = indexToSquare(toFile, toRank ^ flipRanks);
+        return flags | move(from, to);
+}
+
+/*----------------------------------------------------------------------+
+ |      boardToPolicy                                                   |
+ +----------------------------------------------------------------------*/
+
+extern int boardToPolicy(Board_t self, void *out, int flags)
+{
+        bool isFlipped = (flags & policyFlip) && sideToMove(self) == black;
+
+        int moveList[maxMoves];
+        updateSideInfo(self);
+        int nrMoves = generateMoves(self, moveList);
+
+        int nrLegalMoves = 0;
+        for (int i=0; i<nrMoves; i++)
+                if (isLegalMove(self, moveList[i]))
+                        moveList[nrLegalMoves++] = moveList[i];
+
+        if (flags & policyIndices) {
+                short *indices = out;
+                for (int i=0; i<nrLegalMoves; i++)
+                        indices[i] = moveToPolicyIndex(moveList[i], isFlipped);
+                for (int i=nrLegalMoves; i<maxMoves; i++)
+                        indices[i] = -1;
+        } else if (flags & policyFloat) {
+                float *mask = out;
+                for (int i=0; i<policySize; i++)
+                        mask[i] = 0.0f;
+                for (int i=0; i<nrLegalMoves; i++)
+                        mask[moveToPolicyIndex(moveList[i], isFlipped)] = 1.0f;
+        } else {
+                unsigned char *mask = out;
+                memset(mask, 0, policySize);
+                for (int i=0; i<nrLegalMoves; i++)
+                        mask[moveToPolicyIndex(moveList[i], isFlipped)] = 1;
+        }
+
+        return nrLegalMoves;
+}
+
+/*----------------------------------------------------------------------+
+ |      Batches                                                         |
+ +----------------------------------------------------------------------*/
+
+// Helper to encode a chunk of positions of a batch
+static long encodeChunk(void *context, const char *const fens[], long first, long last)
+{
+        struct batch *batch = context;
+        long firstInvalid = last;
+
+        for (long i=first; i<last; i++) {
+                unsigned char *out = batch->out + i * batch->positionSize;
+                struct board board;
+                if (setupBoard(&board, fens[i]) > 0)
+                        batch->encode(&board, out, batch->flags);
+                else {
+                        memset(out, batch->invalidFill, batch->positionSize);
+                        if (i < firstInvalid)
+                                firstInvalid = i;
+                }
+        }
+        return firstInvalid;
+}
+
+/*----------------------------------------------------------------------+
+ |      encodePlanes                                                    |
+ +----------------------------------------------------------------------*/
+
+extern long encodePlanes(const char *const fens[], long nrFens, void *planes, int flags, int nrThreads)
+{
+        struct batch batch = {
+                .out = planes,
+                .positionSize = planesSize * ((flags & planesFloat) ? sizeof(float) : 1),
+                .invalidFill = 0, // all zero in either type
+                .encode = boardToPlanes,
+                .flags = flags,
+        };
+        return runFenChunks(fens, nrFens, nrThreads, encodeChunk, &batch);
+}
+
+/*----------------------------------------------------------------------+
+ |      encodePolicy                                                    |
+ +----------------------------------------------------------------------*/
+
+// Helper to drop the move count
+static void encodePolicyOfBoard(Board_t board, void *out, int flags)
+{
+        (void) boardToPolicy(board, out, flags);
+}
+
+extern long encodePolicy(const char *const fens[], long nrFens, void *out, int flags, int nrThreads)
+{
+        size_t positionSize;
+        if (flags & policyIndices)
+                positionSize = maxMoves * sizeof(short);
+        else
+                positionSize = policySize * ((flags & policyFloat) ? sizeof(float) : 1);
+
+        struct batch batch = {
+                .out = out,
+                .positionSize = positionSize,
+                .invalidFill = (flags & policyIndices) ? 0xff : 0, // -1 or all zero
+                .encode = encodePolicyOfBoard,
+                .flags = flags,
+        };
+        return runFenChunks(fens, nrFens, nrThreads, encodeChunk, &batch);
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
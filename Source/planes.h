@@ -0,0 +1,91 @@
+
+/*
+ *  Input planes for neural networks: a position as 8x8 planes of 0 and 1
+ *
+ *  Planes  0-5:  white king, queen, rook, bishop, knight, pawn
+ *  Planes  6-11: the same for black
+ *  Plane  12:    white to move
+ *  Planes 13-16: castling rights: white king side, white queen side,
+ *                black king side, black queen side
+ *  Plane  17:    the en passant target square, if there is a legal capture
+ *
+ *  Each plane is indexed by 8*rank+file, from a1 (0) to h8 (63). When the
+ *  board is flipped to the perspective of the side to move, black to move
+ *  has the ranks reversed and the colors swapped in planes 0-11 and 13-16,
+ *  so that planes 0-5 always hold the pieces of the side to move and they
+ *  always move up the board. Plane 12 keeps telling the actual color.
+ */
+
+enum {
+        nrPlanes = 18,
+        planesSize = nrPlanes * 64 // values per position
+};
+
+enum planesFlags {
+        planesFloat = 1 << 0, // float values instead of unsigned char
+        planesFlip  = 1 << 1  // perspective of the side to move
+};
+
+/*
+ *  Write the planes of the position. Can invalidate the side info.
+ */
+void boardToPlanes(Board_t self, void *planes, int flags);
+
+/*
+ *  Parse and encode positions in parallel, into consecutive planesSize
+ *  values. With nrThreads <= 0, use one thread per processor. Invalid FENs
+ *  get planes of all zeros. Return the index of the first invalid FEN, or
+ *  nrFens if all are valid, or -1 with errno set on failure.
+ */
+long encodePlanes(const char *const fens[], long nrFens, void *planes, int flags, int nrThreads);
+
+/*
+ *  Policy planes: a move as an index into 73 planes of 64 origin squares,
+ *  indexed the same way as the input planes. The index is 64*plane+from.
+ *
+ *  Planes  0-55:  queen moves: 8 directions clockwise from north, times
+ *                 distances 1 to 7
+ *  Planes 56-63:  knight moves, clockwise from north-north-east
+ *  Planes 64-72:  underpromotions to knight, bishop, rook, times the
+ *                 directions towards the a-file, straight, towards the h-file
+ *
+ *  King moves, castling (as the king's two-square move), pawn moves and
+ *  queen promotions take the queen planes. The flip mirrors the ranks, so
+ *  that the moves of black are seen from black's side.
+ */
+
+enum {
+        nrPolicyPlanes = 73,
+        policySize = nrPolicyPlanes * 64
+};
+
+enum policyFlags {
+        policyFloat   = 1 << 0, // float mask instead of unsigned char
+        policyFlip    = 1 << 1, // perspective of the side to move
+        policyIndices = 1 << 2  // list of maxMoves shorts, padded with -1, instead of a mask
+};
+
+/*
+ *  Map a move to its policy index, or return -1 for moves that no piece
+ *  can make
+ */
+int moveToPolicyIndex(int move, bool isFlipped);
+
+/*
+ *  Map a policy index to a move, or return -1 if it leaves the board.
+ *  Only underpromotions get the special move flag.
+ */
+int policyIndexToMove(int index, bool isFlipped);
+
+/*
+ *  Write the legal moves of the position as a mask of policySize values,
+ *  or as a list of indices. With policyFlip, only positions with black to
+ *  move are flipped. Return the number of legal moves.
+ */
+int boardToPolicy(Board_t self, void *out, int flags);
+
+/*
+ *  Parse positions and write their legal moves in parallel, like
+ *  encodePlanes(). Invalid FENs get an empty mask or list.
+ */
+long encodePolicy(const char *const fens[], long nrFens, void *out, int flags, int nrThreads);
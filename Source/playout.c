@@ -0,0 +1,308 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      playout.c -- random games                                       |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  Random numbers come from xorshift64*, seeded per game with splitmix64
+ *  from the seed and the game number. Games are therefore reproducible
+ *  one by one, regardless of the number of threads or the batch size.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Other module includes
+#include "Board.h"
+#include "budget.h"
+#include "perft.h"
+#include "workers.h"
+
+// Own include
+#include "playout.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+struct batch {
+        Board_t start;
+        const struct playoutOptions *options;
+        unsigned long long firstGame;
+        struct game *games;
+        int nrGames;
+        int next; // next game to play, or nrGames when the budget is exhausted
+        pthread_mutex_t lock;
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------+
+ |      Random numbers                                                  |
+ +----------------------------------------------------------------------*/
+
+static unsigned long long splitmix64(unsigned long long x)
+{
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+}
+
+static unsigned long long nextRandom(unsigned long long *state)
+{
+        unsigned long long x = *state;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        *state = x;
+        return x * 0x2545f4914f6cdd1dULL;
+}
+
+// Uniform random number from 0 to n-1
+static unsigned randomBelow(unsigned long long *state, unsigned n)
+{
+        return ((nextRandom(state) >> 32) * n) >> 32;
+}
+
+/*----------------------------------------------------------------------+
+ |      playout                                                         |
+ +----------------------------------------------------------------------*/
+
+// Neither side can mate with what is left
+static bool isInsufficientMaterial(Board_t board)
+{
+        int nrMinors = 0;
+        for (int square=0; square<boardSize; square++) {
+                switch (board->squares[square]) {
+                case whiteKnight: case whiteBishop:
+                case blackKnight: case blackBishop:
+                        nrMinors++;
+                        break;
+                case whiteQueen: case whiteRook: case whitePawn:
+                case blackQueen: case blackRook: case blackPawn:
+                        return false;
+                }
+        }
+        return nrMinors <= 1;
+}
+
+static enum moveClass classifyMove(Board_t board, int move, bool isCheck)
+{
+        int from = from(move), to = to(move);
+
+        if (isCheck)
+                return checkMoveClass;
+        if (isPromotion(board, from, to))
+                return promotionMoveClass;
+        if (board->squares[to] != empty)
+                return captureMoveClass;
+        if ((move & specialMoveFlag) && file(from) != file(to)
+         && (board->squares[from] == whitePawn || board->squares[from] == blackPawn))
+                return captureMoveClass; // en passant
+        return quietMoveClass;
+}
+
+extern void playout(Board_t board, const struct playoutOptions *options, unsigned long long gameNumber, struct game *game)
+{
+        unsigned long long state = splitmix64(options->seed + splitmix64(gameNumber));
+        if (state == 0)
+                state = 1; // xorshift can't leave 0
+
+        int maxPlies = options->maxPlies;
+        if (maxPlies > maxGamePlies)
+                maxPlies = maxGamePlies;
+
+        struct board sample = *board;
+
+        game->nrPlies = 0;
+        game->end = gameUnfinished;
+
+        while (game->nrPlies < maxPlies) {
+                if (isInsufficientMaterial(board)) {
+                        game->end = gameInsufficientMaterial;
+                        break;
+                }
+
+                int moveList[maxMoves];
+                updateSideInfo(board);
+                bool isCheck = inCheck(board);
+                int nrMoves = generateMoves(board, moveList);
+
+                int legalMoves[maxMoves];
+                unsigned weights[maxMoves];
+                int nrLegalMoves = 0;
+                unsigned total = 0;
+
+                for (int i=0; i<nrMoves; i++) {
+                        int move = moveList[i];
+                        makeMove(board, move);
+                        updateSideInfo(board);
+                        bool isLegal = board->side->attacks[board->xside->king] == 0;
+                        bool givesCheck = board->xside->attacks[board->side->king] != 0;
+                        undoMove(board);
+
+                        if (!isLegal)
+                                continue;
+
+                        int weight = options->weights[classifyMove(board, move, givesCheck)];
+                        legalMoves[nrLegalMoves] = move;
+                        weights[nrLegalMoves] = (weight > 0) ? weight : 0;
+                        total += weights[nrLegalMoves];
+                        nrLegalMoves++;
+                }
+
+                if (nrLegalMoves == 0) {
+                        game->end = isCheck ? gameCheckmate : gameStalemate;
+                        break;
+                }
+
+                int choice;
+                if (total == 0)
+                        choice = randomBelow(&state, nrLegalMoves); // only excluded moves: ignore the weights
+                else {
+                        unsigned r = randomBelow(&state, total);
+                        for (choice=0; r>=weights[choice]; choice++)
+                                r -= weights[choice];
+                }
+
+                makeMove(board, legalMoves[choice]);
+                game->moves[game->nrPlies++] = legalMoves[choice];
+        }
+
+        game->samplePly = randomBelow(&state, game->nrPlies + 1);
+
+        if (options->perftDepth > 0) {
+                for (int i=0; i<game->samplePly; i++)
+                        makeMove(&sample, game->moves[i]);
+                for (int depth=1; depth<=options->perftDepth && depth<=maxPlayoutPerftDepth; depth++)
+                        game->perft[depth] = perft(&sample, depth);
+                freeBoard(&sample);
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |      playouts                                                        |
+ +----------------------------------------------------------------------*/
+
+// Thread body: take games from the batch until none are left
+static void work(void *argument, int index)
+{
+        struct batch *batch = argument;
+        struct budget *budget = batch->options->budget;
+        int pending = 0;
+
+        for (;;) {
+                pthread_mutex_lock(&batch->lock);
+                if (budget && getBudgetStop(budget) != budgetRunning)
+                        batch->nrGames = batch->next; // only finish the games in progress
+                int i = batch->next;
+                bool isLeft = i < batch->nrGames;
+                if (isLeft)
+                        batch->next++;
+                pthread_mutex_unlock(&batch->lock);
+                if (!isLeft)
+                        break;
+
+                struct board board = *batch->start;
+                playout(&board, batch->options, batch->firstGame + i, &batch->games[i]);
+                freeBoard(&board);
+
+                pending += batch->games[i].nrPlies; // countNode() adds the start position
+                countNode(budget, &pending);
+        }
+        flushNodes(budget, &pending);
+}
+
+extern int playouts(Board_t start, const struct playoutOptions *options,
+        unsigned long long firstGame, struct game games[], int nrGames, int nrThreads)
+{
+        if (nrGames <= 0)
+                return 0;
+
+        nrThreads = resolveThreads(nrThreads);
+        if (nrThreads > nrGames)
+                nrThreads = nrGames;
+
+        struct batch batch = {
+                .start = start,
+                .options = options,
+                .firstGame = firstGame,
+                .games = games,
+                .nrGames = nrGames,
+                .next = 0,
+        };
+        if ((errno = pthread_mutex_init(&batch.lock, NULL)) != 0)
+                return -1;
+
+        runWorkers(work, &batch, nrThreads);
+        pthread_mutex_destroy(&batch.lock);
+        return batch.nrGames;
+}
+
+/*----------------------------------------------------------------------+
+ |      gameResult                                                      |
+ +----------------------------------------------------------------------*/
+
+extern const char *gameResult(const struct game *game, Board_t start)
+{
+        switch (game->end) {
+        case gameCheckmate:
+                // The side to move at the end is mated
+                return ((start->plyNumber + game->nrPlies) & 1) == white ? "0-1" : "1-0";
+        case gameStalemate:
+        case gameInsufficientMaterial:
+                return "1/2-1/2";
+        default:
+                return "*";
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,64 @@
+
+/*
+ *  Random playouts: games of randomly chosen legal moves
+ */
+
+enum { maxGamePlies = 1024, maxPlayoutPerftDepth = 6 };
+
+// So that the weights of all moves of a position add up without overflow
+enum { maxMoveWeight = 0xffff };
+
+// Move classes for weighted move selection. A move is in the last class that applies.
+enum moveClass {
+        quietMoveClass,
+        captureMoveClass,
+        promotionMoveClass,
+        checkMoveClass,
+        nrMoveClasses
+};
+
+enum gameEnd {
+        gameUnfinished,          // maximum length reached
+        gameCheckmate,
+        gameStalemate,
+        gameInsufficientMaterial // no pawns, rooks or queens, and at most one minor piece
+};
+
+struct playoutOptions {
+        unsigned long long seed;
+        int maxPlies;                // at most maxGamePlies
+        int weights[nrMoveClasses];  // at most maxMoveWeight, all equal for a uniform choice
+        int perftDepth;              // for the sampled position, 0 for none
+        struct budget *budget;       // started by the caller, or NULL for no limit
+};
+
+struct game {
+        int nrPlies;
+        enum gameEnd end;
+        int moves[maxGamePlies];
+        int samplePly;                                    // a random ply, from 0 to nrPlies
+        unsigned long long perft[maxPlayoutPerftDepth+1]; // at samplePly, indexed by depth
+};
+
+/*
+ *  Play a random game from the position. Each game number gives its own
+ *  sequence of random numbers for the seed, so that results don't depend
+ *  on how games are distributed over threads. The board is left at the
+ *  final position, with the game as its history: see freeBoard().
+ */
+void playout(Board_t board, const struct playoutOptions *options, unsigned long long gameNumber, struct game *game);
+
+/*
+ *  Play games firstGame up to firstGame+nrGames in parallel, all from the
+ *  same position. With nrThreads <= 0, use one thread per processor.
+ *  Each played position counts as a node of the budget. Once it is
+ *  exhausted no new games are started, so the games that were played
+ *  are the first ones. Return their number, or -1 with errno set on failure.
+ */
+int playouts(Board_t start, const struct playoutOptions *options,
+        unsigned long long firstGame, struct game games[], int nrGames, int nrThreads);
+
+/*
+ *  Result string for a finished game: "1-0", "0-1", "1/2-1/2" or "*"
+ */
+const char *gameResult(const struct game *game, Board_t start);
@@ -0,0 +1,467 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      positionDb.c -- memory mapped position database                 |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ *  File layout: a header of 64 bytes, then the slots. Each slot holds
+ *  the key and the value. The home slot of a key is given by its top
+ *  bits, and collisions are resolved by linear probing. The load factor
+ *  is kept at or below 3/4. Numbers are in native byte order.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// mmap(), fsync()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Other module includes
+#include "Board.h"
+
+// Own include
+#include "positionDb.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+static const char fileMagic[8] = { 'C', 'M', 'D', 'B', '0', '0', '0', '1' };
+
+struct header {
+        char magic[8];
+        unsigned long long capacity;
+        unsigned long long count;
+        int valueSize;
+        int recordSize;
+        char reserved[32];
+};
+
+enum { headerSize = 64, maxValueSize = 1 << 16 };
+
+#define record(self, slot)   ((self)->records + (size_t) (slot) * (self)->recordSize)
+#define homeSlot(self, key)  ((key) >> (self)->shift)
+#define nextSlot(self, slot) (((slot) + 1) & ((self)->capacity - 1))
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static unsigned long long getKey(const unsigned char *record)
+{
+        unsigned long long key;
+        memcpy(&key, record, sizeof key);
+        return key;
+}
+
+static void setCapacity(struct positionDb *self, unsigned long long capacity)
+{
+        self->capacity = capacity;
+        self->shift = 64;
+        while (capacity > 1) {
+                self->shift--;
+                capacity >>= 1;
+        }
+}
+
+/*
+ *  Find the slot of the key, or the empty slot where it goes. Return NULL
+ *  if the key isn't there and there is no empty slot, which only a corrupt
+ *  file can cause.
+ */
+static unsigned char *findSlot(const struct positionDb *self, unsigned long long key)
+{
+        unsigned long long slot = homeSlot(self, key);
+        for (unsigned long long n=0; n<self->capacity; n++) {
+                unsigned char *r = record(self, slot);
+                unsigned long long k = getKey(r);
+                if (k == key || k == 0)
+                        return r;
+                slot = nextSlot(self, slot);
+        }
+        return NULL;
+}
+
+/*
+ *  Move all records into a new table
+ */
+static int resize(struct positionDb *self, unsigned long long capacity)
+{
+        unsigned char *records = calloc(capacity, self->recordSize);
+        if (!records)
+                return -1;
+
+        struct positionDb old = *self;
+        self->records = records;
+        setCapacity(self, capacity);
+
+        for (unsigned long long slot=0; slot<old.capacity; slot++) {
+                const unsigned char *r = record(&old, slot);
+                unsigned long long key = getKey(r);
+                if (key != 0)
+                        memcpy(findSlot(self, key), r, self->recordSize); // the larger table has room
+        }
+        free(old.records);
+        return 0;
+}
+
+/*
+ *  Make room for n more keys
+ */
+static int reserve(struct positionDb *self, unsigned long long n)
+{
+        unsigned long long capacity = self->capacity;
+        while (4 * (self->count + n) > 3 * capacity)
+                capacity *= 2;
+        return (capacity > self->capacity) ? resize(self, capacity) : 0;
+}
+
+static bool isValidHeader(const struct header *header, size_t fileSize)
+{
+        unsigned long long capacity = header->capacity;
+        return memcmp(header->magic, fileMagic, sizeof fileMagic) == 0
+            && header->valueSize > 0 && header->valueSize <= maxValueSize
+            && header->recordSize == 8 + (header->valueSize + 7) / 8 * 8
+            && capacity >= positionDbMinCapacity && (capacity & (capacity - 1)) == 0
+            && header->count < capacity
+            && (fileSize - headerSize) / header->recordSize == capacity
+            && fileSize == headerSize + capacity * header->recordSize;
+}
+
+static void setupFromHeader(struct positionDb *self, const struct header *header)
+{
+        setCapacity(self, header->capacity);
+        self->count = header->count;
+        self->valueSize = header->valueSize;
+        self->recordSize = header->recordSize;
+}
+
+/*
+ *  Readers: map the file at self->path
+ */
+static int mapFile(struct positionDb *self)
+{
+        int fd = open(self->path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return -1;
+        }
+
+        size_t mapSize = st.st_size;
+        void *map = (mapSize >= headerSize)
+                ? mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0)
+                : MAP_FAILED;
+        int saveErrno = errno;
+        close(fd);
+        if (map == MAP_FAILED) {
+                errno = (mapSize < headerSize) ? EINVAL : saveErrno;
+                return -1;
+        }
+
+        struct header header;
+        memcpy(&header, map, sizeof header);
+        if (!isValidHeader(&header, mapSize)) {
+                munmap(map, mapSize);
+                errno = EINVAL;
+                return -1;
+        }
+
+        self->map = map;
+        self->mapSize = mapSize;
+        self->records = (unsigned char *)map + headerSize;
+        self->fileId[0] = st.st_dev;
+        self->fileId[1] = st.st_ino;
+        setupFromHeader(self, &header);
+        return 0;
+}
+
+/*
+ *  Writers: read the file at self->path into memory, or start an empty table
+ */
+static int readFile(struct positionDb *self, int valueSize)
+{
+        FILE *fp = fopen(self->path, "rb");
+        if (!fp) {
+                if (errno != ENOENT)
+                        return -1;
+                if (valueSize <= 0 || valueSize > maxValueSize) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                self->valueSize = valueSize;
+                self->recordSize = 8 + (valueSize + 7) / 8 * 8;
+                self->count = 0;
+                setCapacity(self, positionDbMinCapacity);
+                self->records = calloc(self->capacity, self->recordSize);
+                return self->records ? 0 : -1;
+        }
+
+        struct header header;
+        struct stat st;
+        bool ok = fstat(fileno(fp), &st) == 0
+               && fread(&header, sizeof header, 1, fp) == 1;
+        if (ok && (!isValidHeader(&header, st.st_size)
+                || (valueSize != 0 && valueSize != header.valueSize))) {
+                ok = false;
+                errno = EINVAL;
+        }
+        if (ok) {
+                setupFromHeader(self, &header);
+                self->records = malloc(self->capacity * self->recordSize);
+                ok = self->records
+                  && fread(self->records, self->recordSize, self->capacity, fp) == self->capacity;
+                if (!ok && !ferror(fp))
+                        errno = EINVAL;
+        }
+
+        int saveErrno = errno;
+        fclose(fp);
+        errno = saveErrno;
+        if (!ok) {
+                free(self->records);
+                self->records = NULL;
+                return -1;
+        }
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      openPositionDb / closePositionDb                                |
+ +----------------------------------------------------------------------*/
+
+extern int openPositionDb(struct positionDb *self, const char *path, int valueSize, bool writable)
+{
+        *self = (struct positionDb) { .map = NULL, .records = NULL, .lockFd = -1 };
+
+        self->path = malloc(strlen(path) + sizeof ".lock");
+        if (!self->path)
+                return -1;
+
+        if (writable) {
+                // Only one writer at a time
+                sprintf(self->path, "%s.lock", path);
+                self->lockFd = open(self->path, O_RDWR | O_CREAT, 0666);
+                if (self->lockFd < 0 || flock(self->lockFd, LOCK_EX | LOCK_NB) != 0) {
+                        int saveErrno = errno;
+                        closePositionDb(self);
+                        errno = saveErrno;
+                        return -1;
+                }
+        }
+
+        strcpy(self->path, path);
+        if ((writable ? readFile(self, valueSize) : mapFile(self)) != 0) {
+                int saveErrno = errno;
+                closePositionDb(self);
+                errno = saveErrno;
+                return -1;
+        }
+
+        if (!writable && valueSize != 0 && valueSize != self->valueSize) {
+                closePositionDb(self);
+                errno = EINVAL;
+                return -1;
+        }
+        return 0;
+}
+
+extern void closePositionDb(struct positionDb *self)
+{
+        if (self->map)
+                munmap(self->map, self->mapSize);
+        else
+                free(self->records);
+        if (self->lockFd >= 0)
+                close(self->lockFd); // releases the lock
+        free(self->path);
+        *self = (struct positionDb) { .map = NULL, .records = NULL, .lockFd = -1 };
+}
+
+/*----------------------------------------------------------------------+
+ |      refreshPositionDb                                               |
+ +----------------------------------------------------------------------*/
+
+extern int refreshPositionDb(struct positionDb *self)
+{
+        if (!self->map)
+                return 0; // writers have the latest version
+
+        struct stat st;
+        if (stat(self->path, &st) != 0)
+                return -1;
+        if (st.st_dev == self->fileId[0] && st.st_ino == self->fileId[1])
+                return 0;
+
+        struct positionDb old = *self;
+        if (mapFile(self) != 0) {
+                int saveErrno = errno;
+                *self = old;
+                errno = saveErrno;
+                return -1;
+        }
+        munmap(old.map, old.mapSize);
+        return 1;
+}
+
+/*----------------------------------------------------------------------+
+ |      lookupPositionDb                                                |
+ +----------------------------------------------------------------------*/
+
+extern const void *lookupPositionDb(const struct positionDb *self, unsigned long long key)
+{
+        if (key == 0)
+                return NULL;
+
+        const unsigned char *r = findSlot(self, key);
+        return (r && getKey(r) == key) ? r + 8 : NULL;
+}
+
+extern const void *lookupPositionDbBoard(const struct positionDb *self, Board_t board)
+{
+        return lookupPositionDb(self, hash64(board));
+}
+
+/*----------------------------------------------------------------------+
+ |      putPositionDb / loadPositionDb                                  |
+ +----------------------------------------------------------------------*/
+
+extern int putPositionDb(struct positionDb *self, unsigned long long key, const void *value)
+{
+        if (self->map || key == 0) {
+                errno = self->map ? EBADF : EINVAL;
+                return -1;
+        }
+
+        unsigned char *r = findSlot(self, key);
+        if (!r || getKey(r) == 0) {
+                if (reserve(self, 1) != 0)
+                        return -1;
+                r = findSlot(self, key);
+                if (!r) { // full, despite its count
+                        errno = EIO;
+                        return -1;
+                }
+                memcpy(r, &key, sizeof key);
+                self->count++;
+        }
+        memcpy(r + 8, value, self->valueSize);
+        return 0;
+}
+
+extern int loadPositionDb(struct positionDb *self, const unsigned long long keys[], const void *values, long n)
+{
+        if (self->map) {
+                errno = EBADF;
+                return -1;
+        }
+        if (reserve(self, n) != 0)
+                return -1;
+
+        for (long i=0; i<n; i++)
+                if (putPositionDb(self, keys[i], (const char *)values + i * self->valueSize) != 0)
+                        return -1;
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      commitPositionDb                                                |
+ +----------------------------------------------------------------------*/
+
+extern int commitPositionDb(struct positionDb *self)
+{
+        if (self->map) {
+                errno = EBADF;
+                return -1;
+        }
+
+        char *tmpPath = malloc(strlen(self->path) + sizeof ".tmp");
+        if (!tmpPath)
+                return -1;
+        sprintf(tmpPath, "%s.tmp", self->path); // private to the lock holder
+
+        FILE *fp = fopen(tmpPath, "wb");
+        if (!fp) {
+                free(tmpPath);
+                return -1;
+        }
+
+        struct header header = {
+                .capacity   = self->capacity,
+                .count      = self->count,
+                .valueSize  = self->valueSize,
+                .recordSize = self->recordSize
+        };
+        memcpy(header.magic, fileMagic, sizeof fileMagic);
+
+        bool ok = fwrite(&header, sizeof header, 1, fp) == 1
+               && fwrite(self->records, self->recordSize, self->capacity, fp) == self->capacity
+               && fflush(fp) == 0
+               && fsync(fileno(fp)) == 0;
+        ok = (fclose(fp) == 0) && ok;
+        ok = ok && rename(tmpPath, self->path) == 0;
+
+        int saveErrno = errno;
+        if (!ok)
+                remove(tmpPath);
+        free(tmpPath);
+        errno = saveErrno;
+
+        return ok ? 0 : -1;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
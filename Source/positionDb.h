@@ -0,0 +1,76 @@
+
+/*
+ *  Position database: fixed-size values keyed by the Polyglot hash,
+ *  in a memory mapped open addressing table
+ *
+ *  Readers map the file and share it with other processes through the page
+ *  cache. A single writer works on a private copy and commits it by writing
+ *  a new file and renaming it over the old one, so readers always see
+ *  a complete table. Readers pick up a commit with refreshPositionDb().
+ */
+
+enum { positionDbMinCapacity = 64 };
+
+struct positionDb {
+        void *map;                      // readers: the file mapping
+        size_t mapSize;
+        unsigned char *records;         // key followed by value, key 0 marks an empty slot
+        unsigned long long capacity;    // number of slots, a power of two
+        unsigned long long count;       // number of keys
+        int valueSize;                  // in bytes
+        int recordSize;                 // key and value, rounded up to 8 bytes
+        int shift;                      // the top bits of the key give the home slot
+        int lockFd;                     // writers: locked file descriptor, or -1 for readers
+        char *path;
+        unsigned long long fileId[2];   // device and inode of the mapped file
+};
+
+/*
+ *  Open a database for reading, or for writing. A writer holds an exclusive
+ *  lock on `path.lock' until it is closed, and creates the database if it
+ *  doesn't exist yet. valueSize is only needed for that, and is checked
+ *  otherwise unless it is 0. Return 0 on success, or -1 with errno set on
+ *  failure.
+ */
+int openPositionDb(struct positionDb *self, const char *path, int valueSize, bool writable);
+
+/*
+ *  Release the table. A writer's uncommitted changes are lost.
+ */
+void closePositionDb(struct positionDb *self);
+
+/*
+ *  Remap the file if a writer has committed since it was opened.
+ *  Must not run concurrently with lookups on the same object.
+ *  Return 1 if it changed, 0 if not, or -1 with errno set on failure.
+ */
+int refreshPositionDb(struct positionDb *self);
+
+/*
+ *  Find the value for a key, or return NULL if there is none
+ */
+const void *lookupPositionDb(const struct positionDb *self, unsigned long long key);
+
+/*
+ *  Find the value for a position
+ */
+const void *lookupPositionDbBoard(const struct positionDb *self, Board_t board);
+
+/*
+ *  Writers: insert or replace a value. Key 0 is reserved.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int putPositionDb(struct positionDb *self, unsigned long long key, const void *value);
+
+/*
+ *  Writers: insert n values, stored consecutively, after making room for all
+ *  of them at once. Keys in ascending order fill the table front to back.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int loadPositionDb(struct positionDb *self, const unsigned long long keys[], const void *values, long n);
+
+/*
+ *  Writers: atomically replace the file with the current table.
+ *  Return 0 on success, or -1 with errno set on failure.
+ */
+int commitPositionDb(struct positionDb *self);
@@ -0,0 +1,168 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      symmetry.c -- canonical positions under color flip and mirror   |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Standard includes
+#include <stdbool.h>
+#include <stddef.h>
+
+// Other module includes
+#include "Board.h"
+
+// Own include
+#include "symmetry.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+#define flipColor(piece) ((piece) >= blackKing ? (piece) - (blackKing - whiteKing) \
+                                               : (piece) + (blackKing - whiteKing))
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static int transformSquare(int square, int transform)
+{
+        int file = file(square);
+        int rank = rank(square);
+
+        if (transform & transformFlipColors)
+                rank = rank1 + rank8 - rank;
+        if (transform & transformMirrorFiles)
+                file = fileA + fileH - file;
+
+        return square(file, rank);
+}
+
+// Setup the transformed position of other, without history
+static void setupTransformed(Board_t self, Board_t other, int transform)
+{
+        for (int square=0; square<boardSize; square++) {
+                int piece = other->squares[square];
+                if (piece != empty && (transform & transformFlipColors))
+                        piece = flipColor(piece);
+                self->squares[transformSquare(square, transform)] = piece;
+        }
+
+        int castleFlags = other->castleFlags;
+        if (transform & transformFlipColors) {
+                castleFlags = ((castleFlags & (castleFlagWhiteKside | castleFlagWhiteQside)) << 2)
+                            | ((castleFlags & (castleFlagBlackKside | castleFlagBlackQside)) >> 2);
+        }
+        self->castleFlags = castleFlags;
+
+        self->enPassantPawn = other->enPassantPawn ? transformSquare(other->enPassantPawn, transform) : 0;
+
+        // Keep the move number and the halfmove clock
+        self->plyNumber = (transform & transformFlipColors) ? other->plyNumber ^ 1 : other->plyNumber;
+        self->lastZeroing = self->plyNumber - halfmoveClock(other);
+
+        updateKeys(self);
+
+#ifndef NDEBUG
+        self->debugSideInfoPlyNumber = -1; // side info is invalid
+#endif
+
+        self->undoLen = 0;
+        self->undoHeap = NULL;
+        self->undoHeapSize = 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      transformBoard                                                  |
+ +----------------------------------------------------------------------*/
+
+extern int transformBoard(Board_t self, int transform)
+{
+        if ((transform & transformMirrorFiles) && self->castleFlags != 0)
+                return -1;
+
+        struct board transformed;
+        setupTransformed(&transformed, self, transform);
+        freeBoard(self);
+        *self = transformed;
+        return 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      transformMove                                                   |
+ +----------------------------------------------------------------------*/
+
+extern int transformMove(int move, int transform)
+{
+        int flags = move & ~move(boardSize - 1, boardSize - 1);
+        return flags | move(transformSquare(from(move), transform), transformSquare(to(move), transform));
+}
+
+/*----------------------------------------------------------------------+
+ |      canonicalizeBoard                                               |
+ +----------------------------------------------------------------------*/
+
+extern int canonicalizeBoard(Board_t self)
+{
+        // With castling rights, only try the color flip
+        int nrCandidates = (self->castleFlags == 0) ? nrTransforms : transformFlipColors + 1;
+
+        int best = transformNone;
+        unsigned long long bestKey = hash64(self);
+
+        for (int transform=1; transform<nrCandidates; transform++) {
+                struct board transformed;
+                setupTransformed(&transformed, self, transform);
+                unsigned long long key = hash64(&transformed);
+                if (key < bestKey) {
+                        best = transform;
+                        bestKey = key;
+                }
+        }
+
+        transformBoard(self, best);
+        return best;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
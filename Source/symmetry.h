@@ -0,0 +1,34 @@
+
+/*
+ *  Symmetry transforms of positions, for keying caches canonically
+ *
+ *  Transforms are combinations of these bits. Each transform is its own
+ *  inverse, so the same transform maps moves and positions back.
+ */
+
+enum transform {
+        transformNone        = 0,
+        transformFlipColors  = 1 << 0, // swap colors and side to move, and mirror the ranks
+        transformMirrorFiles = 1 << 1, // mirror the files, only without castling rights
+        nrTransforms         = 4
+};
+
+/*
+ *  Apply a transform to the position. The move history is forgotten.
+ *  Return 0 on success, or -1 if the transform mirrors the files while
+ *  there are castling rights.
+ */
+int transformBoard(Board_t self, int transform);
+
+/*
+ *  Map a move to the transformed position
+ */
+int transformMove(int move, int transform);
+
+/*
+ *  Replace the position by its canonical representative: the transform of
+ *  it with the lowest hash64(), trying the file mirror only if there are
+ *  no castling rights. The move history is forgotten. Return the transform
+ *  that was applied. hash64() then gives the canonical hash.
+ */
+int canonicalizeBoard(Board_t self);
@@ -0,0 +1,120 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      workers.c -- run a function on several threads                  |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *  contributors may be used to endorse or promote products derived
+ *  from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// sysconf()
+#define _POSIX_C_SOURCE 200809L
+
+// Standard includes
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+// Own include
+#include "workers.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+struct worker {
+        pthread_t thread;
+        bool isStarted;
+        workerFunction *function;
+        void *argument;
+        int index;
+};
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static void *work(void *argument)
+{
+        struct worker *self = argument;
+        self->function(self->argument, self->index);
+        return NULL;
+}
+
+/*----------------------------------------------------------------------+
+ |      resolveThreads                                                  |
+ +----------------------------------------------------------------------*/
+
+extern int resolveThreads(int nrThreads)
+{
+        if (nrThreads <= 0)
+                nrThreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nrThreads <= 0)
+                nrThreads = 1;
+        return nrThreads;
+}
+
+/*----------------------------------------------------------------------+
+ |      runWorkers                                                      |
+ +----------------------------------------------------------------------*/
+
+extern void runWorkers(workerFunction *function, void *argument, int nrWorkers)
+{
+        if (nrWorkers <= 0)
+                return;
+
+        struct worker workers[nrWorkers];
+        for (int i=0; i<nrWorkers; i++)
+                workers[i] = (struct worker) { .function = function, .argument = argument, .index = i };
+
+        for (int i=1; i<nrWorkers; i++)
+                workers[i].isStarted = pthread_create(&workers[i].thread, NULL, work, &workers[i]) == 0;
+        work(&workers[0]);
+
+        for (int i=1; i<nrWorkers; i++) {
+                if (workers[i].isStarted)
+                        pthread_join(workers[i].thread, NULL);
+                else
+                        work(&workers[i]);
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
@@ -0,0 +1,28 @@
+
+/*
+ *  Threads for the batch functions
+ */
+
+/*
+ *  Upper limit of a requested number of threads. Larger numbers are
+ *  mistakes rather than requests, and each thread takes a stack.
+ */
+enum { maxThreads = 1024 };
+
+/*
+ *  The number of threads to use: nrThreads itself, or one per processor
+ *  when nrThreads <= 0
+ */
+int resolveThreads(int nrThreads);
+
+/*
+ *  The body of a worker. The index runs from 0 up to the number of workers.
+ */
+typedef void workerFunction(void *argument, int index);
+
+/*
+ *  Run nrWorkers workers in parallel and wait until all have returned.
+ *  Worker 0 runs on this thread. A worker whose thread fails to start runs
+ *  on this thread after worker 0, so worker 0 must never wait for another.
+ */
+void runWorkers(workerFunction *function, void *argument, int nrWorkers);
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+
+#
+#  Benchmark the Python API over sets of positions from Data/perft-random.epd
+#
+#  Each benchmark times individual calls and reports calls per second and
+#  latency percentiles. Results can be saved as a baseline, and a later run
+#  compared against it: a benchmark whose rate drops by more than the
+#  threshold is a regression, and makes the exit status non-zero.
+#
+#  Example:
+#      python3 Tools/benchmark.py --save baseline.json
+#      python3 Tools/benchmark.py --compare baseline.json --threshold 0.1
+#
+
+import argparse
+import array
+import json
+import os
+import platform
+import random
+import re
+import sys
+import time
+
+import chessmoves as cm
+
+epdFile = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'Data', 'perft-random.epd')
+
+#-----------------------------------------------------------------------
+#       Position sets
+#-----------------------------------------------------------------------
+
+def readPositions(path):
+        """ Distinct positions of the EPD file, in file order """
+        seen = set()
+        positions = []
+        with open(path) as f:
+                for line in f:
+                        fen = ' '.join(line.split()[:4])
+                        if fen and fen not in seen:
+                                seen.add(fen)
+                                positions.append(fen)
+        return positions
+
+def nrPieces(fen):
+        return sum(c.isalpha() for c in fen.split()[0])
+
+def positionSets(positions, size):
+        """ Representative subsets, each of at most size positions """
+        features = []
+        for fen in positions:
+                moves = list(cm.moves(fen))
+                features.append((fen,
+                                 nrPieces(fen),
+                                 sum(m[-1] in '+#' for m in moves),
+                                 sum('=' in m for m in moves)))
+
+        sets = {
+                'openings':    [f for f, n, c, p in features if n >= 30],
+                'middlegames': [f for f, n, c, p in features if 16 <= n < 30],
+                'checks':      [f for f, n, c, p in features if c >= 3],
+                'promotions':  [f for f, n, c, p in features if p >= 4],
+                'endgames':    [f for f, n, c, p in features if n <= 10],
+        }
+
+        rng = random.Random(1)
+        for name, fens in sets.items():
+                if len(fens) > size:
+                        sets[name] = rng.sample(fens, size)
+        return sets
+
+#-----------------------------------------------------------------------
+#       Benchmarks
+#-----------------------------------------------------------------------
+
+def benchmarks(sets):
+        """ Yield (name, [(function, argument), ...], items per call) """
+        everything = [fen for fens in sets.values() for fen in fens]
+
+        for notation in cm.notations:
+                for setName, fens in sets.items():
+                        yield ('moves %s %s' % (notation, setName),
+                               [(lambda fen, n=notation: cm.moves(fen, notation=n), fen) for fen in fens], 1)
+
+        yield ('moves san values',
+               [(lambda fen: list(cm.moves(fen).values()), fen) for fen in everything], 1)
+
+        cm.set_moves_cache(64 << 20)
+        yield ('moves san cached',
+               [(cm.moves, fen) for fen in everything], 1)
+
+        firstMoves = [(fen, next(iter(cm.moves(fen)))) for fen in everything if cm.moves(fen)]
+        for notation in cm.notations:
+                yield ('move %s' % notation,
+                       [(lambda a, n=notation: cm.move(a[0], a[1], notation=n), a) for a in firstMoves], 1)
+
+        yield ('position', [(cm.position, fen) for fen in everything], 1)
+        yield ('hash', [(cm.hash, fen) for fen in everything], 1)
+        yield ('canonical', [(cm.canonical, fen) for fen in everything], 1)
+        yield ('transform', [(lambda fen: cm.transform(fen, cm.flipColors), fen) for fen in everything], 1)
+
+        # Batch APIs, on one thread so that results don't depend on the machine size
+        games = [g for g in cm.playouts(20, max_plies=80, threads=1)]
+        for output in ['moves', 'fens', 'hashes']:
+                yield ('play %s' % output,
+                       [(lambda g, o=output: cm.play(cm.startPosition, g[0], output=o), g) for g in games],
+                       sum(len(g[0]) for g in games) / len(games))
+
+        yield ('playouts', [(lambda seed: cm.playouts(10, seed=seed, max_plies=100, threads=1), seed)
+                            for seed in range(10)], 10)
+
+        planes = bytearray(len(everything) * cm.planesPerPosition * 64)
+        yield ('encode_planes', [(lambda fens: cm.encode_planes(fens, planes, threads=1), everything)],
+               len(everything))
+        mask = bytearray(len(everything) * cm.policySize)
+        yield ('encode_policy', [(lambda fens: cm.encode_policy(fens, mask, threads=1), everything)],
+               len(everything))
+        counts = bytearray(len(everything) * 2)
+        yield ('count_moves', [(lambda fens: cm.count_moves(fens, counts, threads=1), everything)],
+               len(everything))
+        keys = array.array('Q', bytes(len(everything) * 8 * 4))
+        yield ('hash_keys', [(lambda fens: cm.hash_keys(fens, keys, keys=('hash', 'second', 'pawns', 'material'),
+                                                        threads=1), everything)],
+               len(everything))
+
+        records = [cm.encode_game(g[0], entropy=True) for g in games]
+        yield ('decode_games', [(lambda data: cm.decode_games(data, entropy=True, notation='uci'), b''.join(records))],
+               sum(len(g[0]) for g in games))
+
+        endgames = sets['endgames']
+        yield ('mate_in_batch', [(lambda fens: cm.mate_in_batch(fens, 2, threads=1), endgames)],
+               len(endgames))
+
+def percentile(sortedValues, p):
+        i = min(len(sortedValues) - 1, int(p / 100 * len(sortedValues)))
+        return sortedValues[i]
+
+def measure(calls, minTime):
+        """ Time the calls one by one, cycling through them for at least minTime seconds """
+        for function, argument in calls: # warm up
+                function(argument)
+
+        timer = time.perf_counter_ns
+        latencies = []
+        deadline = timer() + minTime * 1e9
+        while not latencies or timer() < deadline:
+                for function, argument in calls:
+                        start = timer()
+                        function(argument)
+                        latencies.append(timer() - start)
+
+        latencies.sort()
+        total = sum(latencies)
+        return {
+                'calls':  len(latencies),
+                'rate':   len(latencies) * 1e9 / total,
+                'p50':    percentile(latencies, 50) / 1e3,
+                'p90':    percentile(latencies, 90) / 1e3,
+                'p99':    percentile(latencies, 99) / 1e3,
+        }
+
+#-----------------------------------------------------------------------
+#       Main
+#-----------------------------------------------------------------------
+
+def main():
+        parser = argparse.ArgumentParser(description='Benchmark the chessmoves Python API')
+        parser.add_argument('--time', type=float, default=0.5, help='minimum seconds per benchmark (default: 0.5)')
+        parser.add_argument('--positions', type=int, default=200, help='positions per set (default: 200)')
+        parser.add_argument('--filter', default='', help='only run benchmarks matching this regular expression')
+        parser.add_argument('--save', metavar='FILE', help='save the results as a baseline')
+        parser.add_argument('--compare', metavar='FILE', help='compare against a saved baseline')
+        parser.add_argument('--threshold', type=float, default=0.10,
+                            help='relative slowdown that counts as a regression (default: 0.10)')
+        args = parser.parse_args()
+
+        baseline = None
+        if args.compare:
+                with open(args.compare) as f:
+                        baseline = json.load(f)['results']
+
+        cm.set_moves_cache(0)
+        sets = positionSets(readPositions(epdFile), args.positions)
+        print('sets: ' + ', '.join('%s %d' % (name, len(fens)) for name, fens in sets.items()))
+
+        header = '%-26s %12s %12s %9s %9s %9s' % ('benchmark', 'calls/s', 'items/s', 'p50 us', 'p90 us', 'p99 us')
+        if baseline is not None:
+                header += ' %8s' % 'change'
+        print(header)
+
+        results = {}
+        regressions = []
+        for name, calls, itemsPerCall in benchmarks(sets):
+                if not re.search(args.filter, name):
+                        continue
+                r = measure(calls, args.time)
+                results[name] = r
+                line = '%-26s %12.0f %12.0f %9.2f %9.2f %9.2f' % (
+                        name, r['rate'], r['rate'] * itemsPerCall, r['p50'], r['p90'], r['p99'])
+                if baseline is not None and name in baseline:
+                        change = r['rate'] / baseline[name]['rate'] - 1
+                        line += ' %+7.1f%%' % (100 * change)
+                        if change < -args.threshold:
+                                line += ' REGRESSION'
+                                regressions.append(name)
+                print(line)
+                sys.stdout.flush()
+
+        cm.set_moves_cache(0)
+
+        if args.save:
+                with open(args.save, 'w') as f:
+                        json.dump({
+                                'python':   platform.python_version(),
+                                'machine':  platform.machine(),
+                                'time':     time.strftime('%Y-%m-%d %H:%M:%S'),
+                                'results':  results,
+                        }, f, indent=1, sort_keys=True)
+                        f.write('\n')
+
+        if regressions:
+                print('%d regression(s) beyond %.0f%%: %s' % (
+                        len(regressions), 100 * args.threshold, ', '.join(regressions)))
+                sys.exit(1)
+
+if __name__ == '__main__':
+        main()
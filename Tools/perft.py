@@ -1,4 +1,4 @@
-#!/usr/bin/env python
+#!/usr/bin/env python3
 
 import chessmoves
 import sys
@@ -18,5 +18,5 @@ if __name__ == '__main__':
                 depth = 1
 
         for line in sys.stdin:
-                print perft(line, depth)
+                print(perft(line, depth))
 
@@ -1,12 +1,16 @@
-#!/usr/bin/env python
+#!/usr/bin/env python3
 
+import array
+import os
+import struct
+import tempfile
 import chessmoves as cm
 
-print cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/p2N3P/P4B2/KPPR4/3R4 w - -').keys()
-print cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/p2N3P/P4B2/KPPR4/3R4 w - -')['b4']
-print cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b - b3').keys()
-print cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b - b3')['Rb8']
-print cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b -').keys()
+print(list(cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/p2N3P/P4B2/KPPR4/3R4 w - -').keys()))
+print(cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/p2N3P/P4B2/KPPR4/3R4 w - -')['b4'])
+print(list(cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b - b3').keys()))
+print(cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b - b3')['Rb8'])
+print(list(cm.moves('2r3r1/3b1p1k/1p2pPp1/2npP1Pp/pP1N3P/P4B2/K1PR4/3R4 b -').keys()))
 
 for pos, ref in [
         ('rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -', 0x463b96181691fc9c),
@@ -21,7 +25,7 @@ for pos, ref in [
         ]:
         hash = cm.hash(pos)
         result = 'OK' if hash == ref else 'NOK'
-        print '0x%016x [ref: 0x%016x] %s %s' % (hash, ref, result, pos)
+        print('0x%016x [ref: 0x%016x] %s %s' % (hash, ref, result, pos))
 
 # Test move parsing
 
@@ -40,6 +44,124 @@ for move in [
         '0-0', '0-0-0', '00', '000',
         'O-O-0', 'o-o-o-o', 'o-oo', 'oo-o', 'O-O-', 'o', '0', 'O', 'O--O']:
         try:
-                print 'parse:', parsePos, move, '->', cm.move(parsePos, move)
+                print('parse:', parsePos, move, '->', cm.move(parsePos, move))
         except ValueError as err:
-                print err
+                print(err)
+
+# Test mate search
+
+for pos in [
+        'r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq -',
+        'r1b1kb1r/pppp1ppp/5q2/4n3/3KP3/2N3PN/PPP4P/R1BQ1B1R b kq -',
+        '2k5/8/1K6/8/8/8/8/7R w - -',
+        '6k1/8/6K1/8/8/8/8/7R b - -']:
+        print('mate:', pos, cm.mate_in(pos, 3))
+print(cm.mate_in_batch(['2k5/8/1K6/8/8/8/8/7R w - -', '6k1/8/6K1/8/8/8/8/7R w - -'], 2, notation='uci'))
+
+# Test random games
+
+print(cm.playouts(2, seed=7, max_plies=12))
+print(cm.playouts(2, seed=7, max_plies=12, output='samples', threads=1))
+print(cm.playouts(1, fen='8/8/8/8/8/5K2/8/R5k1 b - -', seed=1, weights=[0, 0, 0, 1], notation='uci'))
+
+# Test playing a game
+
+print(cm.play(cm.startPosition, 'e4 e5 Nf3 Nc6 Bb5 a6 Ba4 Nf6 O-O Be7'))
+print(cm.play(cm.startPosition, ['e2e4', 'e7e5', 'Ke2', 'Ke7', 'Kf3'], output='fens'))
+print(cm.play(cm.startPosition, 'd4 d5 c4 dxc4', notation='uci', output='hashes'))
+
+# Test symmetry
+
+for pos in [
+        cm.startPosition,
+        'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3',
+        '8/8/8/4k3/8/8/3P4/4K3 w - -',
+        '8/8/8/4k3/8/8/3P4/4K3 b - -']:
+        print('canonical:', pos, cm.canonical(pos))
+print(cm.transform('8/8/8/4k3/8/8/3P4/4K3 w - -', cm.flipColors | cm.mirrorFiles))
+print(cm.transform_move('d2d4', cm.mirrorFiles), cm.transform_move('a7b8q', cm.flipColors))
+try:
+        cm.transform(cm.startPosition, cm.mirrorFiles)
+except ValueError as err:
+        print(err)
+
+# Test the lazy moves mapping
+
+moves = cm.moves('k7/8/8/8/8/8/8/K6R w - -')
+print(len(moves), 'Rh2' in moves, 'Rh8+' in moves, moves['Rh8+'], moves.get('Rg9'), sorted(moves.copy().items())[:2])
+print(moves == moves.copy(), list(moves) == list(moves.keys()), repr(cm.moves('7k/6Q1/6K1/8/8/8/8/8 b - -')))
+
+# Test the moves cache
+
+cm.set_moves_cache(1 << 20)
+for i in range(3):
+        print(sorted(cm.moves(cm.startPosition, notation='uci').items())[:2])
+info = cm.moves_cache_info()
+print(info['hits'], info['misses'], info['entries'])
+cm.set_moves_cache(0)
+
+# Test move counters and repetitions
+
+print(cm.position('rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1', counters=True))
+print(cm.play(cm.startPosition, 'e4 e5 Nf3', output='fens', counters=True))
+print(cm.play(cm.startPosition, 'e4 Nf6 Nc3 Ng8 Nb1', output='clocks'))
+print(cm.play(cm.startPosition, 'Nf3 Nf6 Ng1 Ng8 Nf3 Nf6 Ng1 Ng8', output='repetitions'))
+
+# Test input planes
+
+planes = bytearray(2 * cm.planesPerPosition * 64)
+print(cm.encode_planes([cm.startPosition, 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq -'], planes, flip=True))
+print([sum(planes[i*64:i*64+64]) for i in range(2 * cm.planesPerPosition)])
+print(planes[cm.planesPerPosition*64 + 5*64 + 8:cm.planesPerPosition*64 + 5*64 + 16].hex())
+print(cm.policy_index('e7e8n'), cm.policy_index('e2e4', flip=True), cm.policy_move(cm.policy_index('b7a8r')))
+mask = bytearray(cm.policySize)
+print(cm.encode_policy(['4k3/8/8/8/8/8/8/R3K2R w KQ -'], mask), sum(mask), mask[cm.policy_index('e1g1')])
+
+# Test move counts
+
+counts = bytearray(8)
+print(cm.count_moves([cm.startPosition, 'rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq -',
+                      '7k/5Q2/6K1/8/8/8/8/8 b - -', 'r3k2r/8/8/8/8/8/8/R3K2R w KQkq -'], counts), list(counts))
+
+# Test hash keys
+
+fens = [cm.startPosition, '8/8/4k3/8/8/3K4/4P3/8 w - -', '8/8/4k3/8/8/2K5/3P4/8 b - -']
+keys = array.array('Q', bytes(8 * 4 * len(fens)))
+print(cm.hash_keys(fens, keys, keys=('hash', 'second', 'pawns', 'material')), '%016x %016x' % (keys[0], keys[1]),
+      [keys[4*i] == cm.hash(fen) for i, fen in enumerate(fens)], keys[7] == keys[11], keys[6] == keys[10])
+
+# The keys that the board updates while play() makes moves and undoes the
+# legality tests must equal the keys computed from scratch for each FEN
+for fen, game in [(cm.startPosition, 'e4 Nf6 e5 d5 exd6 exd6 Nf3 Be7 Bd3 O-O O-O Nc6 Re1 Bg4 Rxe7 Qxe7 h3 Bxf3 Qxf3 Nd4'),
+                  ('r3k2r/1P4p1/8/3pP3/8/8/6p1/R3K2R w KQkq d6', 'exd6 gxh1=N bxa8=Q+ Kd7 Qxh8 Ng3 O-O-O Ne2+ Kb2 Ke6 Qxg7 Nc3 Kxc3')]:
+        fens, errorIndex = cm.play(fen, game, output='fens')
+        keys = array.array('Q', bytes(8 * 2 * len(fens)))
+        cm.hash_keys(fens, keys, keys=('pawns', 'material'))
+        print(errorIndex, len(fens), cm.play(fen, game, output='pawn_keys')[0] == list(keys[0::2]),
+              cm.play(fen, game, output='material_keys')[0] == list(keys[1::2]))
+
+# Test game compression
+
+record = cm.encode_game('e4 e5 Nf3 Nc6 Bb5 a6 Ba4 Nf6 O-O Be7')
+print(record.hex(), cm.decode_games(record + record))
+record = cm.encode_game('e4 e5 Nf3 Nc6 Bb5 a6 Ba4 Nf6 O-O Be7', entropy=True)
+print(record.hex(), cm.decode_games(record, entropy=True, notation='uci'))
+
+# Test the position database: write, reopen and refresh
+
+with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, 'test.db')
+        db = cm.PositionDb(path, value_size=4, write=True)
+        db.put(cm.startPosition, struct.pack('<I', 1200))
+        db.load(range(1, 5001), b''.join(struct.pack('<I', 3 * key) for key in range(1, 5001)))
+        db.commit()
+        reader = cm.PositionDb(path)
+        print(reader.value_size, reader.get(cm.startPosition), cm.hash(cm.startPosition) in reader,
+              all(reader.get(key) == struct.pack('<I', 3 * key) for key in range(1, 5001)), reader.get(5001))
+        db.put(cm.startPosition, struct.pack('<I', 1201))
+        db.put(5001, bytes(4))
+        print(reader.refresh(), end=' ')
+        db.commit()
+        print(reader.refresh(), reader.refresh(), reader.get(cm.startPosition), reader.get(5001))
+        del db, reader
+        print(cm.PositionDb(path).get(cm.startPosition), cm.PositionDb(path, write=True).get(2))
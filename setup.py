@@ -1,14 +1,29 @@
-from distutils.core import setup, Extension
+from setuptools import setup, Extension
 
 module1 = Extension(
         'chessmoves',
         sources = [
+                'Source/bitbase.c',
+                'Source/budget.c',
                 'Source/chessmovesmodule.c',
+                'Source/fenChunks.c',
                 'Source/format.c',
+                'Source/gameCodec.c',
+                'Source/hashKeys.c',
+                'Source/history.c',
+                'Source/mate.c',
+                'Source/moveCount.c',
                 'Source/moves.c',
+                'Source/perft.c',
+                'Source/planes.c',
+                'Source/playout.c',
                 'Source/polyglot.c',
-                'Source/stringCopy.c' ],
-        extra_compile_args = ['-O3', '-std=c99', '-Wall', '-pedantic'],
+                'Source/positionDb.c',
+                'Source/stringCopy.c',
+                'Source/symmetry.c',
+                'Source/workers.c' ],
+        extra_compile_args = ['-O3', '-std=c99', '-Wall', '-pedantic', '-pthread'],
+        extra_link_args = ['-pthread'],
         undef_macros = ['NDEBUG']
 )
 
@@ -19,4 +34,5 @@ setup(
         author       = 'Marcel van Kervinck',
         author_email = 'marcelk@bitpit.net',
         url          = 'http://marcelk.net/chessmoves',
+        python_requires = '>=3.8',
         ext_modules  = [module1])